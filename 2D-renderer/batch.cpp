@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <omp.h>
+
+#include "batch.h"
+#include "profiler.h"
+
+std::string view_filename(const std::string &pattern, const int i){
+    const size_t first = pattern.find('#');
+    if (first == std::string::npos){
+        const size_t dot = pattern.find_last_of('.');
+        const size_t slash = pattern.find_last_of('/');
+        const size_t at = dot == std::string::npos || (slash != std::string::npos && dot < slash) ? pattern.size() : dot;
+        return pattern.substr(0, at) + "_" + std::to_string(i) + pattern.substr(at);
+    }
+    size_t last = first;
+    while (last < pattern.size() && pattern[last] == '#') last++;
+    std::string number = std::to_string(i);
+    if (number.size() < last - first) number.insert(0, last - first - number.size(), '0');
+    return pattern.substr(0, first) + number + pattern.substr(last);
+}
+
+std::vector<View> turntable_views(const int n, const std::string &pattern){
+    // rotated, the corners of the [-1, 1] cube reach sqrt(2) in depth
+    Mat4 squeeze;
+    squeeze.m[2][2] = 1 / std::sqrt(2.);
+    std::vector<View> views(n);
+    for (int i = 0; i < n; i++){
+        views[i].transform = squeeze * Mat4::rotation_y(2 * M_PI * i / n);
+        views[i].filename = view_filename(pattern, i);
+    }
+    return views;
+}
+
+bool read_views(const std::string &filename, const std::string &pattern, std::vector<View> &views){
+    std::ifstream in(filename);
+    if (!in.is_open()){
+        std::cerr << "can't open " << filename << "\n";
+        return false;
+    }
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); lineNumber++){
+        line = line.substr(0, line.find('#'));
+        std::istringstream numbers(line);
+        View view;
+        int n = 0;
+        double value;
+        while (n < 16 && numbers >> value) view.transform.m[n / 4][n % 4] = value, n++;
+        if (n == 0 && numbers.eof()) continue;
+        if (n < 16 || !(numbers >> std::ws).eof()){
+            std::cerr << filename << ":" << lineNumber << ": expected the 16 numbers of a matrix\n";
+            return false;
+        }
+        view.filename = view_filename(pattern, views.size());
+        views.push_back(view);
+    }
+    return true;
+}
+
+FramebufferPool::FramebufferPool(const int n, const int w, const int h){
+    for (int i = 0; i < n; i++){
+        framebuffers.push_back(std::make_unique<Framebuffer>(w, h));
+        free.push_back(framebuffers.back().get());
+    }
+}
+
+Framebuffer *FramebufferPool::acquire(){
+    Framebuffer *framebuffer;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this]{ return !free.empty(); });
+        framebuffer = free.back();
+        free.pop_back();
+    }
+    TGAImage &image = framebuffer->image;
+    std::fill(image.buffer(), image.buffer() + (size_t)image.width() * image.height() * image.bytespp(), 0);
+    framebuffer->depth.clear();
+    return framebuffer;
+}
+
+void FramebufferPool::release(Framebuffer *framebuffer){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        free.push_back(framebuffer);
+    }
+    available.notify_one();
+}
+
+// images waiting to be written, handed from the rendering threads to the writer
+class WriteQueue {
+public:
+    void push(Framebuffer *framebuffer, const std::string *filename){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.emplace_back(framebuffer, filename);
+        }
+        ready.notify_one();
+    }
+    // no more images will be pushed
+    void close(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_one();
+    }
+    // the next image, false once the queue is closed and empty
+    bool pop(Framebuffer *&framebuffer, const std::string *&filename){
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]{ return closed || !pending.empty(); });
+        if (pending.empty()) return false;
+        framebuffer = pending.front().first;
+        filename = pending.front().second;
+        pending.pop_front();
+        return true;
+    }
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::pair<Framebuffer *, const std::string *>> pending;
+    bool closed = false;
+};
+
+BatchStats render_batch(const std::vector<View> &views, const int width, const int height, const DrawView &drawView){
+    BatchStats stats;
+    const int nviews = views.size();
+    const int nthreads = std::max(1, std::min(omp_get_max_threads(), nviews));
+    // one framebuffer per rendering thread, and one more so a thread can start its next view while an image is written
+    FramebufferPool pool(nthreads + 1, width, height);
+    WriteQueue queue;
+
+    std::thread writer([&]{
+        Framebuffer *framebuffer;
+        const std::string *filename;
+        while (queue.pop(framebuffer, filename)){
+            bool ok;
+            {
+                PROFILE_STAGE("tga write");
+                ok = framebuffer->image.write_tga_file(*filename);
+            }
+            pool.release(framebuffer);
+            if (!ok) stats.failed++;
+        }
+    });
+
+    std::vector<DrawStats> threadStats(nthreads);
+    #pragma omp parallel num_threads(nthreads)
+    {
+        // the parallel loops of draw() split their work by omp_get_max_threads(), which has to match the single
+        // thread their nested regions get here (a lone thread is not a parallel region, its draws still use every core)
+        if (nthreads > 1) omp_set_num_threads(1);
+        DrawStats &sum = threadStats[omp_get_thread_num()];
+        #pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < nviews; i++){
+            PROFILE_STAGE("view");
+            Framebuffer *framebuffer = pool.acquire();
+            add(sum, drawView(views[i].transform, *framebuffer));
+            queue.push(framebuffer, &views[i].filename);
+        }
+    }
+    queue.close();
+    writer.join();
+
+    stats.views = nviews;
+    for (const DrawStats &s : threadStats) add(stats.draw, s);
+    return stats;
+}
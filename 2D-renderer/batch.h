@@ -0,0 +1,61 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "depthbuffer.h"
+#include "geometry.h"
+#include "pipeline.h"
+#include "tgaimage.h"
+
+// one image of a batch: the transform of the mesh into clip space, and the file the image is written to
+struct View {
+    Mat4 transform;
+    std::string filename;
+};
+
+// the name of view i: the first run of '#' in the pattern is replaced by i, zero padded to the length of the run
+// (a pattern without '#' gets _i before its extension)
+std::string view_filename(const std::string &pattern, const int i);
+// n views of the mesh turning about the vertical axis, its depth squeezed so the near and far planes never cut it
+std::vector<View> turntable_views(const int n, const std::string &pattern);
+// views from a text file: one transform per line, as the 16 numbers of the matrix row after row ('#' starts a comment)
+bool read_views(const std::string &filename, const std::string &pattern, std::vector<View> &views);
+
+// everything a view is rendered into, allocated once and reused from view to view
+struct Framebuffer {
+    Framebuffer(const int w, const int h) : image(w, h, TGAImage::RGB), depth(w, h) {}
+    TGAImage image;
+    DepthBuffer depth;
+    DrawCache cache;
+};
+
+// fixed set of framebuffers shared by the threads rendering and the thread writing the images
+class FramebufferPool {
+public:
+    FramebufferPool(const int n, const int w, const int h);
+    // a cleared framebuffer, waits until one is given back if they are all in use
+    Framebuffer *acquire();
+    void release(Framebuffer *framebuffer);
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<std::unique_ptr<Framebuffer>> framebuffers;
+    std::vector<Framebuffer *> free;
+};
+
+struct BatchStats {
+    int views = 0, failed = 0; // images rendered, and images that couldn't be written
+    DrawStats draw;            // summed over the views
+};
+
+// draws the mesh of a batch with the transform of a view into a framebuffer
+typedef std::function<DrawStats(const Mat4 &transform, Framebuffer &framebuffer)> DrawView;
+
+// renders the views of a batch: views are rendered in parallel, one per thread (each view drawn single threaded
+// unless there is only one thread), and every image is written to its file by a separate thread while the next
+// views are being rendered
+BatchStats render_batch(const std::vector<View> &views, const int width, const int height, const DrawView &drawView);
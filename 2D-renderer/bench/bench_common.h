@@ -0,0 +1,102 @@
+#pragma once
+// helpers shared by the benchmarks of both renderers: statistics of repeated runs and checks against golden images
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include "../tgaimage.h"
+
+// mean and (sample) standard deviation of repeated measurements
+struct Summary {
+    double mean = 0, stddev = 0;
+};
+
+inline Summary summarize(const std::vector<double> &samples){
+    Summary s;
+    if (samples.empty()) return s;
+    for (double v : samples) s.mean += v;
+    s.mean /= samples.size();
+    if (samples.size() < 2) return s;
+    for (double v : samples) s.stddev += (v - s.mean) * (v - s.mean);
+    s.stddev = std::sqrt(s.stddev / (samples.size() - 1));
+    return s;
+}
+
+// parses a comma separated list of positive integers, like "1,2,4"
+inline std::vector<int> parse_list(const std::string &list){
+    std::vector<int> values;
+    for (size_t start = 0; start <= list.size();){
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        int v = std::atoi(list.substr(start, end - start).c_str());
+        if (v > 0) values.push_back(v);
+        start = end + 1;
+    }
+    return values;
+}
+
+// creates the directory if it does not exist yet, returns false if it cannot be used
+inline bool make_directory(const std::string &dir){
+    return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+// how an image compares with its golden reference
+struct GoldenCheck {
+    enum Status { MATCH, CREATED, DIFFERENT, MISSING, FAILED } status = FAILED;
+    long long differing = 0; // pixels with at least one channel different
+    int maxDiff = 0;         // largest difference of a channel
+
+    const char *name() const {
+        switch (status){
+            case MATCH:     return "match";
+            case CREATED:   return "new";
+            case DIFFERENT: return "DIFFERENT";
+            case MISSING:   return "MISSING";
+            default:        return "FAILED";
+        }
+    }
+};
+
+// compares the image with the golden reference in filename; with update set, the image becomes the reference
+// instead, so the goldens are recorded by a run on a known good version (a missing reference is not recorded, it
+// fails the check like a different image)
+// vflip is how the image is written, like in TGAImage::write_tga_file()
+inline GoldenCheck check_golden(const std::string &filename, const TGAImage &image, const bool update, const bool vflip = true){
+    GoldenCheck check;
+    if (update){
+        if (image.write_tga_file(filename, vflip)) check.status = GoldenCheck::CREATED;
+        return check;
+    }
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0){
+        check.status = GoldenCheck::MISSING;
+        return check;
+    }
+
+    TGAImage golden;
+    if (!golden.read_tga_file(filename)) return check;
+    // reading a file written with vflip turns it upside down
+    if (vflip) golden.flip_vertically();
+    check.status = GoldenCheck::DIFFERENT;
+    if (golden.width() != image.width() || golden.height() != image.height() || golden.bytespp() != image.bytespp()){
+        check.differing = (long long)image.width() * image.height();
+        check.maxDiff = 255;
+        return check;
+    }
+    const int bpp = image.bytespp();
+    for (int y = 0; y < image.height(); y++){
+        const std::uint8_t *a = image.row(y), *b = golden.row(y);
+        for (int x = 0; x < image.width(); x++){
+            int diff = 0;
+            for (int c = 0; c < bpp; c++) diff = std::max(diff, std::abs(a[x * bpp + c] - b[x * bpp + c]));
+            if (diff) check.differing++;
+            check.maxDiff = std::max(check.maxDiff, diff);
+        }
+    }
+    if (!check.differing) check.status = GoldenCheck::MATCH;
+    return check;
+}
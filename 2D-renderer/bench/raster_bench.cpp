@@ -0,0 +1,212 @@
+// measures the throughput of the rasterizer on procedural meshes from 1K faces up (10M with --max 10000000, which
+// needs a few GB of memory) at several resolutions and thread counts, and checks every image against its golden
+// reference so that an optimization cannot change pixels unnoticed; it then checks that frames redrawn incrementally
+// after edits (including removed faces) are identical to full draws
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include "bench_common.h"
+#include "../depthbuffer.h"
+#include "../mesh.h"
+#include "../pipeline.h"
+
+// kinds of generated meshes
+enum class MeshKind { SPHERE, SOUP_SMALL, SOUP_MIXED, SOUP_LARGE };
+
+static const char *kind_name(const MeshKind kind){
+    switch (kind){
+        case MeshKind::SPHERE:     return "sphere";
+        case MeshKind::SOUP_SMALL: return "soup-small";
+        case MeshKind::SOUP_MIXED: return "soup-mixed";
+        default:                   return "soup-large";
+    }
+}
+
+// a sphere of radius 0.9 around the origin tessellated in about n triangles, with shared vertices
+// (the rings are closed by repeating their first vertex and the triangles at the poles are degenerate)
+static void sphere_mesh(Mesh &mesh, const int n){
+    const int stacks = std::max(2, int(std::sqrt(n / 4.))), slices = 2 * stacks;
+    mesh = Mesh();
+    for (int i = 0; i <= stacks; i++){
+        const double theta = M_PI * i / stacks;
+        for (int j = 0; j <= slices; j++){
+            const double phi = 2 * M_PI * j / slices;
+            mesh.x.push_back(0.9 * std::sin(theta) * std::cos(phi));
+            mesh.y.push_back(0.9 * std::cos(theta));
+            mesh.z.push_back(0.9 * std::sin(theta) * std::sin(phi));
+        }
+    }
+    // counter-clockwise seen from outside
+    for (int i = 0; i < stacks; i++){
+        for (int j = 0; j < slices; j++){
+            const int a = i * (slices + 1) + j, b = a + slices + 1;
+            mesh.indices.insert(mesh.indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+    build_clusters(mesh);
+}
+
+// n independent triangles scattered over the view volume, whose sizes (the radius of their circumcircle,
+// in clip space units where the screen is 2 wide) are uniform in [minSize, maxSize] on a log scale
+static void triangle_soup(Mesh &mesh, const int n, const double minSize, const double maxSize){
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> unit(0, 1);
+    mesh = Mesh();
+    for (int f = 0; f < n; f++){
+        const double cx = 2 * unit(rng) - 1, cy = 2 * unit(rng) - 1, cz = 1.8 * unit(rng) - 0.9;
+        const double size = minSize * std::pow(maxSize / minSize, unit(rng));
+        const double angle = 2 * M_PI * unit(rng);
+        for (int k = 0; k < 3; k++){
+            // counter-clockwise, so none of them is culled
+            const double a = angle + 2 * M_PI * k / 3;
+            mesh.x.push_back(cx + size * std::cos(a));
+            mesh.y.push_back(cy + size * std::sin(a));
+            mesh.z.push_back(cz);
+            mesh.indices.push_back(f * 3 + k);
+        }
+    }
+    build_clusters(mesh);
+}
+
+static void generate(Mesh &mesh, const MeshKind kind, const int n){
+    switch (kind){
+        case MeshKind::SPHERE:     sphere_mesh(mesh, n); break;
+        case MeshKind::SOUP_SMALL: triangle_soup(mesh, n, 0.002, 0.01); break;
+        case MeshKind::SOUP_MIXED: triangle_soup(mesh, n, 0.002, 0.5); break;
+        case MeshKind::SOUP_LARGE: triangle_soup(mesh, n, 0.1, 0.5); break;
+    }
+}
+
+static double seconds_since(const std::chrono::steady_clock::time_point &start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// draws a sequence of edits of a sphere with draw_incremental(), and checks that every frame is byte-identical to
+// a full draw of the edited mesh; prints one line per edit and returns false if any frame differs
+static bool check_edits(const int size){
+    Mesh base;
+    sphere_mesh(base, 10000);
+    std::mt19937 rng(42);
+    std::vector<TGAColor> colors(base.nfaces());
+    for (TGAColor &color : colors)
+        for (int c = 0; c < 3; c++) color[c] = rng() % 255;
+
+    // each edit starts from the base mesh: new colors, moved vertices, removed faces, and the base again
+    struct Edit { const char *name; Mesh mesh; std::vector<TGAColor> colors; };
+    std::vector<Edit> edits = {{"base", base, colors}, {"recolored", base, colors}, {"moved", base, colors},
+                               {"removed", base, colors}, {"restored", base, colors}};
+    for (int f = 0; f < base.nfaces(); f += 5) edits[1].colors[f] = TGAColor{255, 255, 255, 255};
+    Mesh &moved = edits[2].mesh;
+    for (int v = 0; v < moved.nverts(); v++)
+        if (moved.y[v] > 0.7f) moved.x[v] += 0.02f;
+    build_clusters(moved);
+    Mesh &removed = edits[3].mesh;
+    removed.indices.resize(base.nfaces() * 3 / 4 * 3);
+    build_clusters(removed);
+
+    TGAImage image(size, size, TGAImage::RGB);
+    DepthBuffer depth(size, size), fullDepth(size, size);
+    DrawCache cache, fullCache;
+    FrameState frame;
+    bool ok = true;
+    for (const Edit &edit : edits){
+        IncrementalStats incremental;
+        draw_incremental(edit.mesh, Mat4(), edit.colors, image, depth, cache, frame, incremental);
+        TGAImage full(size, size, TGAImage::RGB);
+        fullDepth.clear();
+        draw(edit.mesh, Mat4(), edit.colors, full, fullDepth, fullCache);
+
+        bool same = true;
+        for (int y = 0; same && y < size; y++) same = !std::memcmp(image.row(y), full.row(y), (size_t)size * image.bytespp());
+        ok &= same;
+        std::printf("%-11s %-10d %-6d %d of %d tiles redrawn, %lld pixels shaded again: %s\n", edit.name,
+                    edit.mesh.nfaces(), size, incremental.dirtyTiles, incremental.tiles, incremental.reshaded,
+                    same ? "identical" : "DIFFERENT");
+    }
+    return ok;
+}
+
+int main(int argc, char** argv){
+    std::vector<int> threads = {1}, resolutions = {512, 2048};
+    if (omp_get_max_threads() > 1) threads.push_back(omp_get_max_threads());
+    int maxFaces = 1000000, runs = 5;
+    std::string goldenDir = "bench/golden";
+    bool update = false;
+
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) threads = parse_list(argv[++i]);
+        else if (arg == "--resolutions" && i + 1 < argc) resolutions = parse_list(argv[++i]);
+        else if (arg == "--max" && i + 1 < argc) maxFaces = atoi(argv[++i]);
+        else if (arg == "--runs" && i + 1 < argc) runs = std::max(1, atoi(argv[++i]));
+        else if (arg == "--golden" && i + 1 < argc) goldenDir = argv[++i];
+        else if (arg == "--update-golden") update = true;
+        else {
+            std::cout << "Usage: " << argv[0] << " [--threads 1,2,4] [--resolutions 512,2048] [--max faces] [--runs n]"
+                         " [--golden dir] [--update-golden]" << std::endl;
+            return 1;
+        }
+    }
+    if (update && !make_directory(goldenDir)){
+        std::cerr << "can't create " << goldenDir << "\n";
+        return 1;
+    }
+
+    std::cout << "mesh        faces      size   threads  time (ms)          Mtri/s             golden" << std::endl;
+    bool ok = true;
+    Mesh mesh;
+    DrawCache cache;
+    for (MeshKind kind : {MeshKind::SPHERE, MeshKind::SOUP_SMALL, MeshKind::SOUP_MIXED, MeshKind::SOUP_LARGE}){
+        for (long long n = 1000; n <= maxFaces; n *= 10){
+            generate(mesh, kind, n);
+            std::mt19937 rng(42);
+            std::vector<TGAColor> colors(mesh.nfaces());
+            for (TGAColor &color : colors)
+                for (int c = 0; c < 3; c++) color[c] = rng() % 255;
+
+            for (int size : resolutions){
+                TGAImage image(size, size, TGAImage::RGB);
+                DepthBuffer depth(size, size);
+                for (int nthreads : threads){
+                    omp_set_num_threads(nthreads);
+                    std::vector<double> times, rates;
+                    for (int run = 0; run < runs; run++){
+                        image = TGAImage(size, size, TGAImage::RGB);
+                        depth.clear();
+                        auto start = std::chrono::steady_clock::now();
+                        draw(mesh, Mat4(), colors, image, depth, cache);
+                        double t = seconds_since(start);
+                        times.push_back(t * 1e3);
+                        rates.push_back(mesh.nfaces() / t * 1e-6);
+                    }
+
+                    // the image does not depend on the number of threads, so they all share the same golden
+                    // (with --update-golden, it is rewritten by the first thread count and the others are compared to it)
+                    std::string golden = goldenDir + "/" + kind_name(kind) + "_" + std::to_string(n) + "_" +
+                                         std::to_string(size) + ".tga";
+                    GoldenCheck check = check_golden(golden, image, update && nthreads == threads[0]);
+                    ok &= check.status == GoldenCheck::MATCH || check.status == GoldenCheck::CREATED;
+
+                    Summary time = summarize(times), rate = summarize(rates);
+                    std::printf("%-11s %-10d %-6d %-8d %8.3f +- %-7.3f %8.3f +- %-7.3f %s", kind_name(kind), mesh.nfaces(), size,
+                                nthreads, time.mean, time.stddev, rate.mean, rate.stddev, check.name());
+                    if (check.status == GoldenCheck::DIFFERENT)
+                        std::printf(" (%lld pixels, max difference %d)", check.differing, check.maxDiff);
+                    std::printf("\n");
+                }
+            }
+        }
+    }
+
+    std::cout << "\nedit        faces      size   incremental frame against a full draw" << std::endl;
+    ok &= check_edits(512);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <atomic>
+
+#include "depthbuffer.h"
+
+DepthBuffer::DepthBuffer(const int w, const int h) : w(w), h(h),
+    blocksX((w + BLOCK - 1) / BLOCK), blocksY((h + BLOCK - 1) / BLOCK),
+    tilesX((w + TILE - 1) / TILE), tilesY((h + TILE - 1) / TILE) {
+    clear();
+}
+
+// the generations of all depth buffers come from one counter
+static std::atomic<std::uint64_t> generations(0);
+
+void DepthBuffer::clear(const float z) {
+    gen = ++generations;
+    data.assign(w * h, z);
+    blockMin.assign(blocksX * blocksY, z);
+    blockMax.assign(blocksX * blocksY, z);
+    tileMin.assign(tilesX * tilesY, z);
+}
+
+void DepthBuffer::clear_tile(const int tx, const int ty, const float z) {
+    gen = ++generations;
+    const int x0 = tx * TILE, y0 = ty * TILE, x1 = std::min(x0 + TILE, w), y1 = std::min(y0 + TILE, h);
+    for (int y = y0; y < y1; y++) std::fill(row(y) + x0, row(y) + x1, z);
+    const int per = TILE / BLOCK;
+    for (int by = ty * per; by < std::min((ty + 1) * per, blocksY); by++)
+        for (int bx = tx * per; bx < std::min((tx + 1) * per, blocksX); bx++)
+            blockMin[bx + by * blocksX] = blockMax[bx + by * blocksX] = z;
+    tileMin[tx + ty * tilesX] = z;
+}
+
+void DepthBuffer::update_block(const int bx, const int by) {
+    const int x0 = bx * BLOCK, y0 = by * BLOCK;
+    const int x1 = std::min(x0 + BLOCK, w), y1 = std::min(y0 + BLOCK, h);
+    float zmin = data[x0 + y0 * w], zmax = zmin;
+    for (int y = y0; y < y1; y++) {
+        const float *p = row(y);
+        for (int x = x0; x < x1; x++) {
+            zmin = std::min(zmin, p[x]);
+            zmax = std::max(zmax, p[x]);
+        }
+    }
+
+    float &bmin = blockMin[bx + by * blocksX];
+    const float old = bmin;
+    bmin = zmin;
+    blockMax[bx + by * blocksX] = zmax;
+
+    // depth values only ever grow, so the tile minimum can only change if this block was holding it
+    const int tx = x0 / TILE, ty = y0 / TILE;
+    float &tmin = tileMin[tx + ty * tilesX];
+    if (old > tmin || zmin == old) return;
+    const int per = TILE / BLOCK;
+    const int bx1 = std::min((tx + 1) * per, blocksX), by1 = std::min((ty + 1) * per, blocksY);
+    tmin = zmin;
+    for (int j = ty * per; j < by1; j++)
+        for (int i = tx * per; i < bx1; i++)
+            tmin = std::min(tmin, blockMin[i + j * blocksX]);
+}
+
+int DepthBuffer::width() const {
+    return w;
+}
+
+int DepthBuffer::height() const {
+    return h;
+}
+
+TGAImage DepthBuffer::to_image() const {
+    TGAImage image(w, h, TGAImage::GRAYSCALE);
+    for (int y = 0; y < h; y++) {
+        const float *z = row(y);
+        std::uint8_t *out = image.row(y);
+        for (int x = 0; x < w; x++)
+            out[x] = std::clamp(z[x], 0.f, 1.f) * 255;
+    }
+    return image;
+}
+
+bool DepthBuffer::write_tga_file(const std::string filename) const {
+    return to_image().write_tga_file(filename);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tgaimage.h"
+
+// floating point z-buffer, greater values are closer to the viewer
+// besides the per-pixel depth it keeps a coarse pyramid with the min/max depth of every BLOCK x BLOCK block
+// and of every TILE x TILE tile, so geometry hidden behind a whole block or tile can be rejected at once
+struct DepthBuffer {
+    static constexpr int BLOCK = 8;
+    static constexpr int TILE = 64;
+
+    DepthBuffer() = default;
+    DepthBuffer(const int w, const int h);
+    void clear(const float z = 0);
+    // changes on every clear(), and differs between depth buffers, so whoever keeps data along with a depth buffer
+    // (like the samples of multisampling) can tell when it was cleared
+    std::uint64_t generation() const { return gen; }
+    // clears only the TILE x TILE tile (tx, ty), which counts as a clear for generation()
+    void clear_tile(const int tx, const int ty, const float z = 0);
+
+    float get(const int x, const int y) const { return data[x + y * w]; }
+    float *row(const int y) { return data.data() + y * w; }
+    const float *row(const int y) const { return data.data() + y * w; }
+
+    // hierarchical z, indexed by block / tile coordinates
+    float block_min(const int bx, const int by) const { return blockMin[bx + by * blocksX]; }
+    float block_max(const int bx, const int by) const { return blockMax[bx + by * blocksX]; }
+    float tile_min(const int tx, const int ty) const { return tileMin[tx + ty * tilesX]; }
+
+    // must be called after writing to the pixels of block (bx, by), refreshes the block and its tile
+    void update_block(const int bx, const int by);
+
+    int width()  const;
+    int height() const;
+
+    // grayscale dump of the depth values, scaled to [0, 255]
+    TGAImage to_image() const;
+    bool write_tga_file(const std::string filename) const;
+private:
+    int w = 0, h = 0;
+    int blocksX = 0, blocksY = 0, tilesX = 0, tilesY = 0;
+    std::vector<float> data = {};
+    std::vector<float> blockMin = {}, blockMax = {};
+    std::vector<float> tileMin = {};
+    std::uint64_t gen = 0;
+};
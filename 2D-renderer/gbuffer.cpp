@@ -0,0 +1,13 @@
+#include "gbuffer.h"
+
+GBuffer::GBuffer(const int w, const int h) {
+    reset(w, h);
+}
+
+void GBuffer::reset(const int width, const int height) {
+    w = width, h = height;
+    triangle.assign(w * h, -1);
+    // the coordinates are only meaningful where a triangle was drawn, so they are left as they are
+    l1.resize(w * h);
+    l2.resize(w * h);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <vector>
+
+// visibility buffer of deferred shading: for every pixel, the triangle seen there and where the pixel lies in it,
+// so the pixels can be shaded once all the triangles are drawn; the depth of the pixels stays in the DepthBuffer
+// the triangles are drawn with
+struct GBuffer {
+    GBuffer() = default;
+    GBuffer(const int w, const int h);
+    // resizes the buffer if needed, and marks every pixel as empty
+    void reset(const int w, const int h);
+
+    int width()  const { return w; }
+    int height() const { return h; }
+
+    std::vector<int> triangle; // index of the triangle in the list that was rasterized, -1 where none was drawn
+    std::vector<float> l1, l2; // screen space barycentric coordinates of the pixel, the weights of vertices 1 and 2
+private:
+    int w = 0, h = 0;
+};
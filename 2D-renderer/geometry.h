@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <initializer_list>
+#include <tuple>
+#include <utility>
+
+template<int n> class Vec {
+    double coords[n] = {0};
+public:
+    Vec() = default;
+
+    Vec(std::initializer_list<double> list){
+        assert(list.size() <= n);
+        std::copy(list.begin(), list.end(), coords);
+    }
+
+    template<typename Tuple, std::size_t... Is>
+    Vec(const Tuple& t, std::index_sequence<Is...>){
+        ((coords[Is] = std::get<Is>(t)), ...);
+    }
+
+    template<typename Tuple>
+    Vec(const Tuple t) : Vec(t, std::make_index_sequence<std::tuple_size<Tuple>::value>{}) {}
+
+
+    double &operator[](const int i){
+        assert (i >= 0 && i < n);
+        return coords[i];
+    }
+
+    double operator[](const int i) const{
+        assert (i >= 0 && i < n);
+        return coords[i];
+    }
+};
+
+typedef Vec<3> Vec3;
+typedef Vec<4> Vec4;
+
+// 4x4 matrix transforming homogeneous points (x, y, z, w)
+struct Mat4 {
+    double m[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+
+    Mat4 operator*(const Mat4 &o) const {
+        Mat4 r;
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                r.m[i][j] = m[i][0] * o.m[0][j] + m[i][1] * o.m[1][j] + m[i][2] * o.m[2][j] + m[i][3] * o.m[3][j];
+        return r;
+    }
+
+    // transforms the point (x, y, z, 1)
+    Vec4 apply(const double x, const double y, const double z) const {
+        return {m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3],
+                m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3],
+                m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3],
+                m[3][0] * x + m[3][1] * y + m[3][2] * z + m[3][3]};
+    }
+
+    static Mat4 translation(const double x, const double y, const double z){
+        Mat4 r;
+        r.m[0][3] = x, r.m[1][3] = y, r.m[2][3] = z;
+        return r;
+    }
+
+    static Mat4 scaling(const double s){
+        Mat4 r;
+        r.m[0][0] = r.m[1][1] = r.m[2][2] = s;
+        return r;
+    }
+
+    // rotation around the vertical axis, angle in radians
+    static Mat4 rotation_y(const double angle){
+        Mat4 r;
+        r.m[0][0] = std::cos(angle), r.m[0][2] = std::sin(angle);
+        r.m[2][0] = -std::sin(angle), r.m[2][2] = std::cos(angle);
+        return r;
+    }
+};
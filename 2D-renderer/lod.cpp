@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <sys/stat.h>
+
+#include "lod.h"
+#include "profiler.h"
+
+// bump whenever the layout of the cache file changes
+constexpr std::uint32_t LOD_CACHE_VERSION = 1;
+// the planes keeping a border or a seam in place weigh as much as this many faces
+constexpr double FEATURE_WEIGHT = 10;
+// a collapse is refused if it turns a face by more than about 80 degrees (cosine of the angle)
+constexpr double MIN_FACE_TURN = 0.2;
+
+// sum of the squared distances to a set of planes, as a symmetric 4x4 matrix:
+// Q(p) = sum of w (n.p + d)^2, stored as its upper triangle aa ab ac ad bb bc bd cc cd dd
+struct Quadric {
+    double q[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+    void add_plane(const double n[3], const double d, const double w){
+        q[0] += w * n[0] * n[0]; q[1] += w * n[0] * n[1]; q[2] += w * n[0] * n[2]; q[3] += w * n[0] * d;
+        q[4] += w * n[1] * n[1]; q[5] += w * n[1] * n[2]; q[6] += w * n[1] * d;
+        q[7] += w * n[2] * n[2]; q[8] += w * n[2] * d;
+        q[9] += w * d * d;
+    }
+    Quadric operator+(const Quadric &o) const {
+        Quadric r;
+        for (int i = 0; i < 10; i++) r.q[i] = q[i] + o.q[i];
+        return r;
+    }
+    double error(const double p[3]) const {
+        const double x = p[0], y = p[1], z = p[2];
+        const double e = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                       + q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                       + q[7] * z * z + 2 * q[8] * z + q[9];
+        return std::max(0., e);
+    }
+};
+
+static void sub(const double a[3], const double b[3], double out[3]){
+    for (int k = 0; k < 3; k++) out[k] = a[k] - b[k];
+}
+
+static void cross(const double a[3], const double b[3], double out[3]){
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static double dot(const double a[3], const double b[3]){
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static bool normalize(double v[3]){
+    const double length = std::sqrt(dot(v, v));
+    if (!(length > 0)) return false;
+    for (int k = 0; k < 3; k++) v[k] /= length;
+    return true;
+}
+
+// moving vertex 'from' onto vertex 'to', along an edge of the mesh
+struct Collapse {
+    double cost;
+    int from, to;
+    unsigned fromStamp, toStamp; // the collapse is out of date once either vertex changed
+
+    bool operator<(const Collapse &o) const { return cost > o.cost; } // cheapest first in a priority_queue
+};
+
+// the state of the mesh while it is being simplified
+class Simplifier {
+public:
+    Simplifier(const Mesh &mesh) : mesh(mesh){
+        const int nverts = mesh.nverts(), nfaces = mesh.nfaces();
+        indices = mesh.indices, normalIndices = mesh.normalIndices, uvIndices = mesh.uvIndices;
+        faceAlive.assign(nfaces, 1);
+        liveFaces = nfaces;
+        vertexFaces.resize(nverts);
+        for (int f = 0; f < nfaces; f++)
+            for (int c = 0; c < 3; c++) vertexFaces[indices[3 * f + c]].push_back(f);
+        quadrics.resize(nverts);
+        stamps.assign(nverts, 0);
+        init_quadrics();
+    }
+
+    // collapses edges until at most target faces are left, false if it runs out of collapses before
+    bool simplify(const int target){
+        while (liveFaces > target){
+            if (queue.empty()) return false;
+            const Collapse c = queue.top();
+            queue.pop();
+            if (c.fromStamp != stamps[c.from] || c.toStamp != stamps[c.to] || !can_collapse(c.from, c.to)) continue;
+            error = std::max(error, std::sqrt(c.cost));
+            collapse(c.from, c.to);
+        }
+        return true;
+    }
+
+    // the faces left, as a mesh of their own
+    LODLevel level() const {
+        LODLevel level;
+        level.error = error;
+        Mesh &out = level.mesh;
+        std::vector<int> vertexMap(mesh.nverts(), -1), normalMap(mesh.nx.size(), -1), uvMap(mesh.u.size(), -1);
+        for (int f = 0; f < mesh.nfaces(); f++){
+            if (!faceAlive[f]) continue;
+            level.sourceFaces.push_back(f);
+            if (!mesh.faceMaterials.empty()) out.faceMaterials.push_back(mesh.faceMaterials[f]);
+            for (int c = 3 * f; c < 3 * f + 3; c++){
+                int &v = vertexMap[indices[c]];
+                if (v < 0){
+                    v = out.x.size();
+                    out.x.push_back(mesh.x[indices[c]]), out.y.push_back(mesh.y[indices[c]]), out.z.push_back(mesh.z[indices[c]]);
+                }
+                out.indices.push_back(v);
+                if (!normalIndices.empty()){
+                    const int n = normalIndices[c];
+                    if (n >= 0 && normalMap[n] < 0){
+                        normalMap[n] = out.nx.size();
+                        out.nx.push_back(mesh.nx[n]), out.ny.push_back(mesh.ny[n]), out.nz.push_back(mesh.nz[n]);
+                    }
+                    out.normalIndices.push_back(n < 0 ? -1 : normalMap[n]);
+                }
+                if (!uvIndices.empty()){
+                    const int t = uvIndices[c];
+                    if (t >= 0 && uvMap[t] < 0){
+                        uvMap[t] = out.u.size();
+                        out.u.push_back(mesh.u[t]), out.v.push_back(mesh.v[t]);
+                    }
+                    out.uvIndices.push_back(t < 0 ? -1 : uvMap[t]);
+                }
+            }
+        }
+        out.materials = mesh.materials;
+        build_clusters(out);
+        return level;
+    }
+
+    int faces() const { return liveFaces; }
+
+private:
+    const Mesh &mesh;
+    std::vector<int> indices, normalIndices, uvIndices; // of the faces, as the collapses change them
+    std::vector<char> faceAlive;
+    int liveFaces;
+    std::vector<std::vector<int>> vertexFaces; // faces around every vertex, dead ones are dropped now and then
+    std::vector<Quadric> quadrics;
+    std::vector<unsigned> stamps;
+    std::priority_queue<Collapse> queue;
+    double error = 0;
+
+    void position(const int v, double p[3]) const {
+        p[0] = mesh.x[v], p[1] = mesh.y[v], p[2] = mesh.z[v];
+    }
+
+    int corner(const int f, const int v) const {
+        for (int c = 0; c < 3; c++)
+            if (indices[3 * f + c] == v) return c;
+        return -1;
+    }
+
+    // the normal of face f (not normalized) with vertex 'from' moved onto 'to'
+    void face_normal(const int f, const int from, const int to, double n[3]) const {
+        double p[3][3];
+        for (int c = 0; c < 3; c++){
+            const int v = indices[3 * f + c];
+            position(v == from ? to : v, p[c]);
+        }
+        double e1[3], e2[3];
+        sub(p[1], p[0], e1);
+        sub(p[2], p[0], e2);
+        cross(e1, e2, n);
+    }
+
+    // the planes of the faces, and planes across the edges that have to stay in place: borders, edges shared by
+    // more than two faces, and seams where the faces on each side have different normals, uvs or materials
+    void init_quadrics(){
+        const int nfaces = mesh.nfaces();
+        for (int f = 0; f < nfaces; f++){
+            double n[3], p[3];
+            face_normal(f, -1, -1, n);
+            if (!normalize(n)) continue;
+            position(indices[3 * f], p);
+            for (int c = 0; c < 3; c++) quadrics[indices[3 * f + c]].add_plane(n, -dot(n, p), 1);
+        }
+
+        // the corners of every edge, grouped by edge
+        struct EdgeRef {
+            std::uint64_t key;
+            int face, corner; // the edge goes from this corner to the next one
+            bool operator<(const EdgeRef &o) const { return key < o.key || (key == o.key && face < o.face); }
+        };
+        std::vector<EdgeRef> edges(3 * nfaces);
+        for (int f = 0; f < nfaces; f++)
+            for (int c = 0; c < 3; c++){
+                const std::uint64_t a = indices[3 * f + c], b = indices[3 * f + (c + 1) % 3];
+                edges[3 * f + c] = {std::min(a, b) << 32 | std::max(a, b), f, c};
+            }
+        std::sort(edges.begin(), edges.end());
+
+        auto attribute = [&](const std::vector<int> &attr, const EdgeRef &e, const int v){
+            return attr.empty() ? 0 : attr[3 * e.face + corner(e.face, v)];
+        };
+        for (size_t first = 0, last; first < edges.size(); first = last){
+            for (last = first + 1; last < edges.size() && edges[last].key == edges[first].key; last++);
+            const int a = edges[first].key >> 32, b = edges[first].key & 0xffffffff;
+            if (a == b) continue;
+            bool feature = last - first != 2;
+            if (!feature){
+                const EdgeRef &e = edges[first], &o = edges[first + 1];
+                for (const int v : {a, b})
+                    feature |= attribute(normalIndices, e, v) != attribute(normalIndices, o, v) ||
+                               attribute(uvIndices, e, v) != attribute(uvIndices, o, v);
+                feature |= mesh.material(e.face) != mesh.material(o.face);
+            }
+            if (!feature) continue;
+            double pa[3], pb[3], edge[3];
+            position(a, pa);
+            position(b, pb);
+            sub(pb, pa, edge);
+            for (size_t i = first; i < last; i++){
+                double n[3], plane[3];
+                face_normal(edges[i].face, -1, -1, n);
+                cross(edge, n, plane);
+                if (!normalize(plane)) continue;
+                for (const int v : {a, b}) quadrics[v].add_plane(plane, -dot(plane, pa), FEATURE_WEIGHT);
+            }
+        }
+
+        for (size_t first = 0, last; first < edges.size(); first = last){
+            for (last = first + 1; last < edges.size() && edges[last].key == edges[first].key; last++);
+            const int a = edges[first].key >> 32, b = edges[first].key & 0xffffffff;
+            if (a != b) push(a, b), push(b, a);
+        }
+    }
+
+    void push(const int from, const int to){
+        double p[3];
+        position(to, p);
+        queue.push({(quadrics[from] + quadrics[to]).error(p), from, to, stamps[from], stamps[to]});
+    }
+
+    // the vertices sharing a live face with v
+    void neighbours(const int v, std::vector<int> &out) const {
+        out.clear();
+        for (const int f : vertexFaces[v]){
+            if (!faceAlive[f]) continue;
+            for (int c = 0; c < 3; c++)
+                if (indices[3 * f + c] != v) out.push_back(indices[3 * f + c]);
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    bool can_collapse(const int from, const int to){
+        int shared = 0;
+        for (const int f : vertexFaces[from]){
+            if (!faceAlive[f]) continue;
+            if (corner(f, to) >= 0){
+                shared++;
+                continue;
+            }
+            // the faces that stay must not fold over nor become degenerate
+            double before[3], after[3];
+            face_normal(f, -1, -1, before);
+            if (dot(before, before) == 0) continue; // already degenerate in the full mesh
+            face_normal(f, from, to, after);
+            const double turn = dot(before, after);
+            if (!(turn > MIN_FACE_TURN * std::sqrt(dot(before, before) * dot(after, after)))) return false;
+        }
+        if (!shared) return false; // not an edge any more
+
+        // the two vertices may only have the vertices across the collapsed faces in common, or the surface
+        // would be pinched into a non-manifold edge
+        neighbours(from, fromNeighbours);
+        neighbours(to, toNeighbours);
+        int common = 0;
+        for (size_t i = 0, j = 0; i < fromNeighbours.size() && j < toNeighbours.size();){
+            if (fromNeighbours[i] < toNeighbours[j]) i++;
+            else if (fromNeighbours[i] > toNeighbours[j]) j++;
+            else common++, i++, j++;
+        }
+        return common <= shared;
+    }
+    std::vector<int> fromNeighbours, toNeighbours;
+
+    void collapse(const int from, const int to){
+        std::vector<int> removed;
+        for (const int f : vertexFaces[from])
+            if (faceAlive[f] && corner(f, to) >= 0){
+                faceAlive[f] = 0;
+                liveFaces--;
+                removed.push_back(f);
+            }
+        for (const int f : vertexFaces[from]){
+            if (!faceAlive[f]) continue;
+            const int c = 3 * f + corner(f, from);
+            // the corner takes the normal and uv that 'to' has in a collapsed face on the same side of any seam
+            for (std::vector<int> *attr : {&normalIndices, &uvIndices}){
+                if (attr->empty()) continue;
+                for (const int r : removed)
+                    if ((*attr)[3 * r + corner(r, from)] == (*attr)[c]){
+                        (*attr)[c] = (*attr)[3 * r + corner(r, to)];
+                        break;
+                    }
+            }
+            indices[c] = to;
+            vertexFaces[to].push_back(f);
+        }
+        vertexFaces[from] = std::vector<int>();
+        quadrics[to] = quadrics[to] + quadrics[from];
+        stamps[from]++, stamps[to]++;
+
+        std::vector<int> &faces = vertexFaces[to];
+        faces.erase(std::remove_if(faces.begin(), faces.end(), [&](const int f){ return !faceAlive[f]; }), faces.end());
+        neighbours(to, toNeighbours);
+        for (const int v : toNeighbours) push(to, v), push(v, to);
+    }
+};
+
+void build_lods(const Mesh &mesh, MeshLODs &lods, const int minFaces){
+    PROFILE_STAGE("lod build");
+    lods.levels.clear();
+    for (int k = 0; k < 3; k++) lods.min[k] = lods.max[k] = 0;
+    if (!mesh.nverts()) return;
+    const std::vector<float> *coords[3] = {&mesh.x, &mesh.y, &mesh.z};
+    for (int k = 0; k < 3; k++){
+        const auto [lo, hi] = std::minmax_element(coords[k]->begin(), coords[k]->end());
+        lods.min[k] = *lo, lods.max[k] = *hi;
+    }
+
+    Simplifier simplifier(mesh);
+    for (int target = mesh.nfaces() / 2; target >= minFaces; target = simplifier.faces() / 2){
+        if (!simplifier.simplify(target)) break;
+        lods.levels.push_back(simplifier.level());
+    }
+}
+
+struct LODCacheHeader {
+    char magic[4] = {'L', 'O', 'D', 'S'};
+    std::uint32_t version = LOD_CACHE_VERSION;
+    std::uint64_t sourceSize = 0;  // the cache is only valid for the .obj it was built from,
+    std::int64_t  sourceMtime = 0; // recognized by its size and modification time (in nanoseconds)
+    std::uint32_t nlevels = 0;
+    float min[3] = {0, 0, 0}, max[3] = {0, 0, 0};
+};
+
+struct LODLevelHeader {
+    float error = 0;
+    std::uint64_t nverts = 0, nnormals = 0, nuvs = 0, nfaces = 0;
+    std::uint8_t hasNormalIndices = 0, hasUVIndices = 0, hasFaceMaterials = 0;
+};
+
+static std::int64_t mtime_ns(const struct stat &st){
+    return std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// the arrays of a level in the order they are stored in the cache
+static std::vector<std::vector<float> *> float_arrays(Mesh &mesh){
+    return {&mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz, &mesh.u, &mesh.v};
+}
+
+static std::vector<std::vector<int> *> index_arrays(LODLevel &level){
+    return {&level.mesh.indices, &level.mesh.normalIndices, &level.mesh.uvIndices, &level.mesh.faceMaterials,
+            &level.sourceFaces};
+}
+
+static bool read_cache(const std::string &path, const struct stat &source, const Mesh &mesh, MeshLODs &lods){
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+    LODCacheHeader header, expected;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!in.good() || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) ||
+        header.version != LOD_CACHE_VERSION || header.sourceSize != (std::uint64_t)source.st_size ||
+        header.sourceMtime != mtime_ns(source)) return false;
+
+    // the counts of a damaged cache are caught by the size of the file, before anything is allocated for them
+    struct stat st;
+    std::uint64_t left = stat(path.c_str(), &st) == 0 ? st.st_size - sizeof(header) : 0;
+    auto take = [&](const std::uint64_t count, const std::uint64_t bytes){
+        if (bytes && count > left / bytes) return false;
+        left -= count * bytes;
+        return true;
+    };
+    if (!take(header.nlevels, sizeof(LODLevelHeader))) return false;
+
+    std::copy(header.min, header.min + 3, lods.min);
+    std::copy(header.max, header.max + 3, lods.max);
+    lods.levels.resize(header.nlevels);
+    for (LODLevel &level : lods.levels){
+        LODLevelHeader h;
+        in.read(reinterpret_cast<char *>(&h), sizeof(h));
+        // per face: its corners, their normal and uv indices, its material and its source face
+        const int intsPerFace = 3 + (h.hasNormalIndices ? 3 : 0) + (h.hasUVIndices ? 3 : 0) + (h.hasFaceMaterials ? 1 : 0) + 1;
+        if (!in.good() || !take(h.nverts, 3 * sizeof(float)) || !take(h.nnormals, 3 * sizeof(float)) ||
+            !take(h.nuvs, 2 * sizeof(float)) || !take(h.nfaces, intsPerFace * sizeof(int))) return false;
+        level.error = h.error;
+        Mesh &m = level.mesh;
+        for (auto *v : {&m.x, &m.y, &m.z}) v->resize(h.nverts);
+        for (auto *v : {&m.nx, &m.ny, &m.nz}) v->resize(h.nnormals);
+        for (auto *v : {&m.u, &m.v}) v->resize(h.nuvs);
+        m.indices.resize(3 * h.nfaces);
+        m.normalIndices.resize(h.hasNormalIndices ? 3 * h.nfaces : 0);
+        m.uvIndices.resize(h.hasUVIndices ? 3 * h.nfaces : 0);
+        m.faceMaterials.resize(h.hasFaceMaterials ? h.nfaces : 0);
+        level.sourceFaces.resize(h.nfaces);
+        for (auto *v : float_arrays(m))
+            in.read(reinterpret_cast<char *>(v->data()), v->size() * sizeof(float));
+        for (auto *v : index_arrays(level))
+            in.read(reinterpret_cast<char *>(v->data()), v->size() * sizeof(int));
+        if (!in.good()) return false;
+        m.materials = mesh.materials;
+        if (!valid_mesh(m)) return false;
+        for (int face : level.sourceFaces)
+            if (face < 0 || face >= mesh.nfaces()) return false;
+        build_clusters(m);
+    }
+    return true;
+}
+
+static bool write_cache(const std::string &path, const struct stat &source, MeshLODs &lods){
+    // written next to the final file and renamed at the end, so readers never see a partial cache
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary);
+    if (!out.is_open()) return false;
+    LODCacheHeader header;
+    header.sourceSize = source.st_size;
+    header.sourceMtime = mtime_ns(source);
+    header.nlevels = lods.levels.size();
+    std::copy(lods.min, lods.min + 3, header.min);
+    std::copy(lods.max, lods.max + 3, header.max);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (LODLevel &level : lods.levels){
+        const Mesh &m = level.mesh;
+        LODLevelHeader h;
+        h.error = level.error;
+        h.nverts = m.x.size(), h.nnormals = m.nx.size(), h.nuvs = m.u.size(), h.nfaces = m.nfaces();
+        h.hasNormalIndices = m.has_normals(), h.hasUVIndices = m.has_uvs(), h.hasFaceMaterials = !m.faceMaterials.empty();
+        out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        for (auto *v : float_arrays(level.mesh))
+            out.write(reinterpret_cast<const char *>(v->data()), v->size() * sizeof(float));
+        for (auto *v : index_arrays(level))
+            out.write(reinterpret_cast<const char *>(v->data()), v->size() * sizeof(int));
+    }
+    out.close();
+    if (!out.good() || std::rename(tmpPath.c_str(), path.c_str())){
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool load_lods(const std::string &filename, const Mesh &mesh, MeshLODs &lods, const bool useCache){
+    struct stat st;
+    if (stat(filename.c_str(), &st)){
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    const std::string cachePath = filename + ".lodcache";
+    if (useCache && read_cache(cachePath, st, mesh, lods)) return true;
+    build_lods(mesh, lods);
+    if (useCache && !write_cache(cachePath, st, lods))
+        std::cerr << "can't write the level of detail cache " << cachePath << "\n";
+    return true;
+}
+
+int select_lod(const MeshLODs &lods, const Mat4 &transform, const int width, const int height, const float maxPixels){
+    if (lods.levels.empty() || !(maxPixels > 0)) return -1;
+    // the smallest w of the bounds of the mesh, where it comes closest to the eye
+    double wmin = INFINITY;
+    for (int corner = 0; corner < 8; corner++){
+        const double x = corner & 1 ? lods.max[0] : lods.min[0];
+        const double y = corner & 2 ? lods.max[1] : lods.min[1];
+        const double z = corner & 4 ? lods.max[2] : lods.min[2];
+        wmin = std::min(wmin, transform.apply(x, y, z)[3]);
+    }
+    if (!(wmin > 0)) return -1; // the mesh reaches the eye, any error can be arbitrarily large on screen
+
+    // how many pixels a model unit spans at most: the pixel column is (x / w + 1) * width / 2, which moving the
+    // point by d changes by (d.x - x / w * d.w) / w * width / 2, and |x / w| <= 1 on screen (the same for rows)
+    const auto &m = transform.m;
+    const double sx = width / 2., sy = height / 2.;
+    double xy = 0, w = 0;
+    for (int k = 0; k < 3; k++){
+        xy += (m[0][k] * sx) * (m[0][k] * sx) + (m[1][k] * sy) * (m[1][k] * sy);
+        w += m[3][k] * m[3][k];
+    }
+    const double pixelsPerUnit = (std::sqrt(xy) + std::sqrt(w * (sx * sx + sy * sy))) / wmin;
+
+    for (int l = lods.levels.size() - 1; l >= 0; l--)
+        if (lods.levels[l].error * pixelsPerUnit <= maxPixels) return l;
+    return -1;
+}
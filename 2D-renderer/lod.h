@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+#include "mesh.h"
+
+// one level of detail of a mesh: a simplified copy of it, holding only the vertices, normals and uvs it still uses
+struct LODLevel {
+    Mesh mesh;
+    std::vector<int> sourceFaces; // the face of the full mesh every face comes from
+    float error = 0;              // how far (in model units) the surface may have moved from the full mesh
+};
+
+// the levels of detail of a mesh, coarser and coarser: each one has about half the faces of the previous one
+// (the full mesh itself is not part of them)
+struct MeshLODs {
+    std::vector<LODLevel> levels;
+    float min[3] = {0, 0, 0}, max[3] = {0, 0, 0}; // bounds of the full mesh
+};
+
+// simplifies the mesh with quadric error metrics (Garland and Heckbert): edges are collapsed into one of their
+// ends, cheapest first, so the vertices of every level are vertices of the full mesh; borders and seams of the
+// normals, uvs and materials are kept in place, and collapses that would fold a face over are refused
+// levels stop at minFaces, or when nothing can be collapsed any more
+void build_lods(const Mesh &mesh, MeshLODs &lods, const int minFaces = 256);
+
+// build_lods() for the mesh of an .obj file; with useCache set, the levels are kept in <filename>.lodcache and
+// read from there for as long as the .obj does not change, like the mesh cache of load_obj()
+bool load_lods(const std::string &filename, const Mesh &mesh, MeshLODs &lods, const bool useCache = false);
+
+// the coarsest level whose error covers at most maxPixels once the mesh is drawn by draw() with the transform
+// into an image of width x height, or -1 for the full mesh
+int select_lod(const MeshLODs &lods, const Mat4 &transform, const int width, const int height, const float maxPixels);
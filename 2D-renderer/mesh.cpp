@@ -0,0 +1,49 @@
+#include <algorithm>
+
+#include "mesh.h"
+
+void build_clusters(Mesh &mesh, const int facesPerCluster){
+    const int nclusters = (mesh.nfaces() + facesPerCluster - 1) / facesPerCluster;
+    mesh.clusters.resize(nclusters);
+
+    #pragma omp parallel for schedule(static)
+    for (int c = 0; c < nclusters; c++){
+        MeshCluster &cluster = mesh.clusters[c];
+        cluster.firstFace = c * facesPerCluster;
+        cluster.nfaces = std::min(facesPerCluster, mesh.nfaces() - cluster.firstFace);
+
+        const int first = mesh.indices[cluster.firstFace * 3];
+        const float *coords[3] = {mesh.x.data(), mesh.y.data(), mesh.z.data()};
+        for (int k = 0; k < 3; k++) cluster.min[k] = cluster.max[k] = coords[k][first];
+        for (int i = cluster.firstFace * 3; i < (cluster.firstFace + cluster.nfaces) * 3; i++){
+            const int v = mesh.indices[i];
+            for (int k = 0; k < 3; k++){
+                cluster.min[k] = std::min(cluster.min[k], coords[k][v]);
+                cluster.max[k] = std::max(cluster.max[k], coords[k][v]);
+            }
+        }
+    }
+}
+
+// every index is below count, and not negative unless it is the -1 of an optional attribute
+static bool in_range(const std::vector<int> &indices, const size_t count, const bool optional){
+    for (int i : indices)
+        if (i < (optional ? -1 : 0) || (i >= 0 && (size_t)i >= count)) return false;
+    return true;
+}
+
+bool valid_mesh(const Mesh &mesh){
+    const size_t nindices = mesh.indices.size();
+    if (nindices % 3 || mesh.y.size() != mesh.x.size() || mesh.z.size() != mesh.x.size() ||
+        mesh.ny.size() != mesh.nx.size() || mesh.nz.size() != mesh.nx.size() || mesh.v.size() != mesh.u.size() ||
+        (mesh.has_normals() && mesh.normalIndices.size() != nindices) ||
+        (mesh.has_uvs() && mesh.uvIndices.size() != nindices) ||
+        (!mesh.faceMaterials.empty() && mesh.faceMaterials.size() != nindices / 3)) return false;
+    if (!in_range(mesh.indices, mesh.x.size(), false) || !in_range(mesh.normalIndices, mesh.nx.size(), true) ||
+        !in_range(mesh.uvIndices, mesh.u.size(), true) || !in_range(mesh.faceMaterials, mesh.materials.size(), true))
+        return false;
+    for (const MeshCluster &cluster : mesh.clusters)
+        if (cluster.firstFace < 0 || cluster.nfaces < 0 || (long long)cluster.firstFace + cluster.nfaces > mesh.nfaces())
+            return false;
+    return true;
+}
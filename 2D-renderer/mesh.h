@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// a run of consecutive triangles of a mesh with the bounding box of their vertices, so they can be culled as a group
+struct MeshCluster {
+    int firstFace = 0, nfaces = 0;
+    float min[3] = {0, 0, 0}, max[3] = {0, 0, 0};
+};
+
+// surface properties of a group of faces, from the .mtl files of an .obj (only what the renderer uses)
+struct Material {
+    std::string name;
+    float diffuse[3] = {1, 1, 1}; // Kd
+    std::string diffuseMap;       // map_Kd, the path of the texture (relative to the working directory), empty if none
+};
+
+// triangle mesh with shared vertices, every attribute is kept in its own array
+// normals and texture coordinates are indexed separately from positions, like in .obj files,
+// so vertices sharing a position are still shared even when their normals or uvs differ
+struct Mesh {
+    std::vector<float> x, y, z;    // vertex positions
+    std::vector<float> nx, ny, nz; // normals, empty if the model has none
+    std::vector<float> u, v;       // texture coordinates, empty if the model has none
+
+    std::vector<int> indices;       // three position indices per triangle
+    std::vector<int> normalIndices; // per triangle corner like indices, or empty; -1 for corners without a normal
+    std::vector<int> uvIndices;     // per triangle corner like indices, or empty; -1 for corners without uvs
+
+    std::vector<Material> materials;
+    std::vector<int> faceMaterials;   // per triangle, index of its material or -1; empty if the mesh has no materials
+
+    std::vector<MeshCluster> clusters; // filled by build_clusters(), without them the mesh is never culled as a whole
+
+    int nverts() const { return x.size(); }
+    int nfaces() const { return indices.size() / 3; }
+    bool has_normals() const { return !normalIndices.empty(); }
+    bool has_uvs() const { return !uvIndices.empty(); }
+    int material(const int face) const { return faceMaterials.empty() ? -1 : faceMaterials[face]; }
+};
+
+// groups the faces of the mesh in clusters of (at most) facesPerCluster consecutive triangles
+void build_clusters(Mesh &mesh, const int facesPerCluster = 256);
+
+// true when every index of the mesh is in range (positions, normals and uvs, where -1 stands for no normal or uv,
+// face materials, and the faces of its clusters) and its arrays have matching sizes; meshes read back from a cache
+// file are checked with it, since a damaged file could otherwise make the draw read anywhere
+bool valid_mesh(const Mesh &mesh);
@@ -0,0 +1,439 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+
+#include "msaa.h"
+#include "profiler.h"
+
+// the standard patterns of Direct3D, moved from the center of the pixel to its top-left corner
+static const int PATTERN_1[1][2] = {{8, 8}};
+static const int PATTERN_2[2][2] = {{12, 12}, {4, 4}};
+static const int PATTERN_4[4][2] = {{6, 2}, {14, 6}, {2, 10}, {10, 14}};
+static const int PATTERN_8[8][2] = {{9, 5}, {7, 11}, {13, 9}, {5, 3}, {3, 13}, {1, 7}, {11, 15}, {15, 1}};
+static_assert(SUBPIXEL == 16, "the patterns are in 1/16 of a pixel");
+// the resolve goes by rows of depth tiles, which must not share the sample storage of a tile
+static_assert(SampleBuffer::TILE == DepthBuffer::TILE, "sample tiles are depth tiles");
+
+int supported_samples(const int samples){
+    if (samples >= 8) return 8;
+    if (samples >= 4) return 4;
+    if (samples >= 2) return 2;
+    return 1;
+}
+
+const int (*sample_positions(const int samples))[2]{
+    switch (supported_samples(samples)){
+        case 8: return PATTERN_8;
+        case 4: return PATTERN_4;
+        case 2: return PATTERN_2;
+        default: return PATTERN_1;
+    }
+}
+
+DepthPlane::DepthPlane(const ScreenTriangle &t){
+    const double e1x = t.p[1][0] - t.p[0][0], e1y = t.p[1][1] - t.p[0][1], e1z = t.p[1][2] - t.p[0][2];
+    const double e2x = t.p[2][0] - t.p[0][0], e2y = t.p[2][1] - t.p[0][1], e2z = t.p[2][2] - t.p[0][2];
+    const double area = e1x * e2y - e1y * e2x;
+    if (area == 0) return; // never rasterized anyway
+    za = (e1z * e2y - e1y * e2z) / area;
+    zb = (e1x * e2z - e1z * e2x) / area;
+    zc = t.p[0][2] - za * t.p[0][0] - zb * t.p[0][1];
+}
+
+void SampleBuffer::begin_draw(const DepthBuffer &depth, const int samples){
+    const int width = depth.width(), height = depth.height(), count = supported_samples(samples);
+    const bool sameFrame = &depth == frameDepth && depth.generation() == frameClears && width == w && height == h &&
+                           count == n;
+    w = width, h = height, n = count;
+    blocksX = (w + BLOCK - 1) / BLOCK;
+    blocksY = (h + BLOCK - 1) / BLOCK;
+    tilesX = (w + TILE - 1) / TILE;
+    const int tilesY = (h + TILE - 1) / TILE;
+    if (!sameFrame){
+        frameDepth = &depth;
+        blocks.assign((size_t)blocksX * blocksY, Block());
+        // the storage of the tiles keeps its capacity from one frame to the next
+        tiles.resize((size_t)tilesX * tilesY);
+        for (TileStorage &tile : tiles){
+            tile.depths.clear();
+            tile.colors.clear();
+            tile.freeHistory.clear();
+        }
+    }
+    frameClears = depth.generation();
+    for (Block &b : blocks) b.triangle = -1, b.slot = -1;
+    for (TileStorage &tile : tiles){
+        tile.samples.clear();
+        tile.free.clear();
+    }
+}
+
+const int *SampleBuffer::pixel(const int x, const int y) const {
+    const int bx = x / BLOCK, by = y / BLOCK;
+    const Block &b = blocks[bx + by * blocksX];
+    return &tile_of(bx, by).samples[((size_t)b.slot * BLOCK * BLOCK + (y % BLOCK) * BLOCK + x % BLOCK) * n];
+}
+
+int *SampleBuffer::pixel(const int x, const int y){
+    return const_cast<int *>(static_cast<const SampleBuffer *>(this)->pixel(x, y));
+}
+
+void SampleBuffer::fill_block(const int bx, const int by, const int triangle){
+    Block &b = blocks[bx + by * blocksX];
+    if (b.slot >= 0){
+        tile_of(bx, by).free.push_back(b.slot);
+        b.slot = -1;
+    }
+    b.triangle = triangle;
+}
+
+void SampleBuffer::expand_block(const int bx, const int by){
+    Block &b = blocks[bx + by * blocksX];
+    if (b.slot >= 0) return;
+    TileStorage &tile = tile_of(bx, by);
+    const size_t slotSize = (size_t)BLOCK * BLOCK * n;
+    if (!tile.free.empty()){
+        b.slot = tile.free.back();
+        tile.free.pop_back();
+    } else {
+        b.slot = tile.samples.size() / slotSize;
+        tile.samples.resize(tile.samples.size() + slotSize);
+    }
+    std::fill_n(tile.samples.begin() + b.slot * slotSize, slotSize, b.triangle);
+}
+
+void SampleBuffer::compress_block(const int bx, const int by){
+    Block &b = blocks[bx + by * blocksX];
+    if (b.slot < 0) return;
+    const size_t slotSize = (size_t)BLOCK * BLOCK * n;
+    const int *s = &tile_of(bx, by).samples[b.slot * slotSize];
+    if (std::all_of(s + 1, s + slotSize, [&](const int t){ return t == s[0]; })) fill_block(bx, by, s[0]);
+}
+
+const float *SampleBuffer::sample_depths(const int x, const int y) const {
+    const int bx = x / BLOCK, by = y / BLOCK;
+    const Block &b = blocks[bx + by * blocksX];
+    return &tile_of(bx, by).depths[((size_t)b.historySlot * BLOCK * BLOCK + (y % BLOCK) * BLOCK + x % BLOCK) * n];
+}
+
+const std::uint32_t *SampleBuffer::sample_colors(const int x, const int y) const {
+    const int bx = x / BLOCK, by = y / BLOCK;
+    const Block &b = blocks[bx + by * blocksX];
+    return &tile_of(bx, by).colors[((size_t)b.historySlot * BLOCK * BLOCK + (y % BLOCK) * BLOCK + x % BLOCK) * n];
+}
+
+void SampleBuffer::free_history(Block &b, TileStorage &tile){
+    if (b.historySlot >= 0) tile.freeHistory.push_back(b.historySlot);
+    b.historySlot = -1;
+}
+
+void SampleBuffer::keep_plane(const int bx, const int by, const DepthPlane &plane){
+    Block &b = blocks[bx + by * blocksX];
+    free_history(b, tile_of(bx, by));
+    b.history = History::PLANE;
+    b.plane = plane;
+}
+
+void SampleBuffer::prepare_samples(const int bx, const int by, float *&depths, std::uint32_t *&colors){
+    Block &b = blocks[bx + by * blocksX];
+    TileStorage &tile = tile_of(bx, by);
+    const size_t slotSize = (size_t)BLOCK * BLOCK * n;
+    if (!tile.freeHistory.empty()){
+        b.nextSlot = tile.freeHistory.back();
+        tile.freeHistory.pop_back();
+    } else {
+        b.nextSlot = tile.depths.size() / slotSize;
+        tile.depths.resize(tile.depths.size() + slotSize);
+        tile.colors.resize(tile.colors.size() + slotSize);
+    }
+    depths = &tile.depths[b.nextSlot * slotSize];
+    colors = &tile.colors[b.nextSlot * slotSize];
+}
+
+void SampleBuffer::keep_samples(const int bx, const int by){
+    Block &b = blocks[bx + by * blocksX];
+    free_history(b, tile_of(bx, by));
+    b.history = History::SAMPLES;
+    b.historySlot = b.nextSlot;
+    b.nextSlot = -1;
+}
+
+size_t SampleBuffer::expanded_memory() const {
+    const size_t slotSize = (size_t)BLOCK * BLOCK * n;
+    size_t bytes = 0;
+    for (const TileStorage &tile : tiles){
+        bytes += (tile.samples.size() / slotSize - tile.free.size()) * slotSize * sizeof(int);
+        bytes += (tile.depths.size() / slotSize - tile.freeHistory.size()) * slotSize * (sizeof(float) + sizeof(std::uint32_t));
+    }
+    return bytes;
+}
+
+// floor(v / SUBPIXEL), also for negative v
+static long long pixel_of(const long long v){
+    return v >= 0 ? v / SUBPIXEL : -((-v + SUBPIXEL - 1) / SUBPIXEL);
+}
+
+// rasterizes triangle i into the samples of the pixels of [x0, x1] x [y0, y1], returns the number of pixels written
+static long long rasterize_samples(const std::vector<ScreenTriangle> &triangles, const std::vector<DepthPlane> &planes,
+                                   const int i, int x0, int y0, int x1, int y1, SampleBuffer &samples,
+                                   const DepthBuffer &depth){
+    constexpr int BLOCK = SampleBuffer::BLOCK;
+    const ScreenTriangle &t = triangles[i];
+    long long vx[3], vy[3];
+    for (int k = 0; k < 3; k++) vx[k] = t.p[k][0], vy[k] = t.p[k][1];
+    if ((vx[1] - vx[0]) * (vy[2] - vy[0]) - (vx[2] - vx[0]) * (vy[1] - vy[0]) < 2) return 0; // degenerate or back-facing
+
+    const int xmin = std::max<long long>(x0, pixel_of(std::min(std::min(vx[0], vx[1]), vx[2])));
+    const int ymin = std::max<long long>(y0, pixel_of(std::min(std::min(vy[0], vy[1]), vy[2])));
+    const int xmax = std::min<long long>(x1, pixel_of(std::max(std::max(vx[0], vx[1]), vx[2])));
+    const int ymax = std::min<long long>(y1, pixel_of(std::max(std::max(vy[0], vy[1]), vy[2])));
+    if (xmin > xmax || ymin > ymax) return 0;
+
+    // edge functions as in rasterize_triangle(), over sample positions
+    long long a[3], b[3], c[3];
+    for (int k = 0; k < 3; k++){
+        const int j = (k + 1) % 3, l = (k + 2) % 3;
+        a[k] = vy[j] - vy[l];
+        b[k] = vx[l] - vx[j];
+        c[k] = vx[j] * vy[l] - vx[l] * vy[j];
+    }
+    const DepthPlane &plane = planes[i];
+    const int n = samples.samples();
+    const int (*positions)[2] = sample_positions(n);
+
+    long long written = 0, filled = 0, expanded = 0; // for the profile
+    for (int by = ymin - ymin % BLOCK; by <= ymax; by += BLOCK){
+        for (int bx = xmin - xmin % BLOCK; bx <= xmax; bx += BLOCK){
+            // every sample of the block lies in [sx0, sx1] x [sy0, sy1]
+            const long long sx[2] = {(long long)bx * SUBPIXEL, (long long)(bx + BLOCK) * SUBPIXEL - 1};
+            const long long sy[2] = {(long long)by * SUBPIXEL, (long long)(by + BLOCK) * SUBPIXEL - 1};
+            bool outside = false, inside = true;
+            for (int k = 0; k < 3; k++){
+                const long long e = a[k] * sx[0] + b[k] * sy[0] + c[k];
+                const long long dx = a[k] * (sx[1] - sx[0]), dy = b[k] * (sy[1] - sy[0]);
+                outside |= e + std::max(dx, 0LL) + std::max(dy, 0LL) < 0;
+                inside &= e + std::min(dx, 0LL) + std::min(dy, 0LL) >= 0;
+            }
+            if (outside) continue;
+
+            // how far the triangle is in front of what the block holds, at its corners: the difference of two
+            // depth planes is a plane too, so it is in front (or behind) everywhere if it is at all four corners
+            const int blockX = bx / BLOCK, blockY = by / BLOCK;
+            const int current = samples.block_triangle(blockX, blockY);
+            if (current != -2){
+                const SampleBuffer::History history = samples.history(blockX, blockY);
+                double dmin = INFINITY, dmax = -INFINITY;
+                for (int k = 0; k < 4; k++){
+                    const double z = plane.at(sx[k & 1], sy[k >> 1]);
+                    // a block that no triangle of the draw covers is as deep as what the previous draws left: the
+                    // depth buffer under it, a plane, or samples no deeper than the depth buffer (the closest of them)
+                    double lo, hi;
+                    if (current >= 0) lo = hi = planes[current].at(sx[k & 1], sy[k >> 1]);
+                    else if (history == SampleBuffer::History::PLANE)
+                        lo = hi = samples.history_plane(blockX, blockY).at(sx[k & 1], sy[k >> 1]);
+                    else {
+                        lo = history == SampleBuffer::History::EMPTY ? depth.block_min(blockX, blockY) : -INFINITY;
+                        hi = depth.block_max(blockX, blockY);
+                    }
+                    dmin = std::min(dmin, z - hi);
+                    dmax = std::max(dmax, z - lo);
+                }
+                if (dmax <= 0) continue; // behind the whole block
+
+                // a block inside the triangle (and inside the tile) that is in front of it just becomes the triangle
+                const bool whole = bx >= x0 && by >= y0 && bx + BLOCK - 1 <= x1 && by + BLOCK - 1 <= y1;
+                if (inside && whole && dmin > 0){
+                    samples.fill_block(blockX, blockY, i);
+                    written += BLOCK * BLOCK;
+                    filled++;
+                    continue;
+                }
+            }
+
+            if (samples.block_triangle(blockX, blockY) != -2) expanded++;
+            samples.expand_block(blockX, blockY);
+            for (int y = std::max(by, ymin); y <= std::min(by + BLOCK - 1, ymax); y++){
+                for (int x = std::max(bx, xmin); x <= std::min(bx + BLOCK - 1, xmax); x++){
+                    int *ids = samples.pixel(x, y);
+                    bool any = false;
+                    for (int s = 0; s < n; s++){
+                        const long long px = (long long)x * SUBPIXEL + positions[s][0];
+                        const long long py = (long long)y * SUBPIXEL + positions[s][1];
+                        if (a[0] * px + b[0] * py + c[0] < 0 || a[1] * px + b[1] * py + c[1] < 0 ||
+                            a[2] * px + b[2] * py + c[2] < 0) continue;
+                        const double z = plane.at(px, py);
+                        if (z <= (ids[s] >= 0 ? planes[ids[s]].at(px, py) : samples.history_depth(x, y, s, px, py, depth))) continue;
+                        ids[s] = i;
+                        any = true;
+                    }
+                    written += any;
+                }
+            }
+            if (inside) samples.compress_block(blockX, blockY);
+        }
+    }
+    PROFILE_COUNT("blocks filled whole", filled);
+    PROFILE_COUNT("blocks expanded", expanded);
+    return written;
+}
+
+long long rasterize_multisampled(const std::vector<ScreenTriangle> &triangles, const std::vector<DepthPlane> &planes,
+                                 const Rect &scissor, SampleBuffer &samples, const DepthBuffer &depth){
+    const int width = samples.width(), height = samples.height();
+    Rect clamped = {std::max(scissor.x0, 0), std::max(scissor.y0, 0),
+                    std::min(scissor.x1, width - 1), std::min(scissor.y1, height - 1)};
+    if (clamped.x0 > clamped.x1 || clamped.y0 > clamped.y1) return 0;
+
+    PROFILE_STAGE("rasterization");
+    TileBins bins;
+    {
+        PROFILE_STAGE("binning");
+        bin_triangles(triangles, width, height, clamped, bins, SUBPIXEL);
+    }
+    const int ntiles = bins.tilesX * bins.tilesY;
+
+    // a tile only touches its own blocks and their storage, so tiles are independent like in rasterize_binned()
+    long long written = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:written)
+    for (int t = 0; t < ntiles; t++){
+        if (bins.offsets[t] == bins.offsets[t + 1]) continue;
+        PROFILE_STAGE("raster tile");
+        int x0 = std::max((t % bins.tilesX) * TILE_SIZE, clamped.x0);
+        int y0 = std::max((t / bins.tilesX) * TILE_SIZE, clamped.y0);
+        int x1 = std::min((t % bins.tilesX + 1) * TILE_SIZE - 1, clamped.x1);
+        int y1 = std::min((t / bins.tilesX + 1) * TILE_SIZE - 1, clamped.y1);
+
+        for (int i = bins.offsets[t]; i < bins.offsets[t + 1]; i++)
+            written += rasterize_samples(triangles, planes, bins.faces[i], x0, y0, x1, y1, samples, depth);
+    }
+    return written;
+}
+
+// the screen space barycentric coordinates (l1, l2) of the point (x, y) in the triangle
+static void barycentric(const ScreenTriangle &t, const double x, const double y, float &l1, float &l2){
+    const double e1x = t.p[1][0] - t.p[0][0], e1y = t.p[1][1] - t.p[0][1];
+    const double e2x = t.p[2][0] - t.p[0][0], e2y = t.p[2][1] - t.p[0][1];
+    const double area = e1x * e2y - e1y * e2x, dx = x - t.p[0][0], dy = y - t.p[0][1];
+    l1 = (dx * e2y - dy * e2x) / area;
+    l2 = (e1x * dy - e1y * dx) / area;
+}
+
+static std::uint32_t pack(const std::uint8_t *bgra, const int bpp){
+    std::uint32_t c = 0;
+    std::memcpy(&c, bgra, bpp);
+    return c;
+}
+
+// the samples of a block where they differ: the ones the draw covered get the color of their triangle (shaded once per
+// triangle and pixel) and its depth, the others keep what they had, and the pixels get their average
+static long long resolve_expanded(const std::vector<ScreenTriangle> &triangles, const std::vector<DepthPlane> &planes,
+                                  SampleBuffer &samples, const PixelShader &shader, const int bx, const int by,
+                                  TGAImage &image, DepthBuffer &depth){
+    constexpr int BLOCK = SampleBuffer::BLOCK;
+    const int width = samples.width(), height = samples.height(), n = samples.samples(), bpp = image.bytespp();
+    const int (*positions)[2] = sample_positions(n);
+    const SampleBuffer::History history = samples.history(bx, by);
+    float *depths;
+    std::uint32_t *colors;
+    samples.prepare_samples(bx, by, depths, colors);
+
+    long long shaded = 0;
+    for (int y = by * BLOCK; y < std::min((by + 1) * BLOCK, height); y++){
+        float *drow = depth.row(y);
+        for (int x = bx * BLOCK; x < std::min((bx + 1) * BLOCK, width); x++){
+            std::uint8_t *pixel = image.pixel(x, y);
+            float *zs = depths + ((y % BLOCK) * BLOCK + x % BLOCK) * n;
+            std::uint32_t *cs = colors + ((y % BLOCK) * BLOCK + x % BLOCK) * n;
+            // what the samples had before the draw
+            const std::uint32_t pixelColor = pack(pixel, bpp);
+            for (int s = 0; s < n; s++){
+                if (history == SampleBuffer::History::SAMPLES){
+                    zs[s] = samples.sample_depths(x, y)[s];
+                    cs[s] = samples.sample_colors(x, y)[s];
+                } else {
+                    zs[s] = samples.history_depth(x, y, s, x * SUBPIXEL + positions[s][0], y * SUBPIXEL + positions[s][1], depth);
+                    cs[s] = pixelColor;
+                }
+            }
+
+            // the distinct triangles of the pixel, with how many samples see each and where they are
+            const int *ids = samples.pixel(x, y);
+            int tris[8], count[8], m = 0;
+            double sumX[8], sumY[8];
+            for (int s = 0; s < n; s++){
+                if (ids[s] < 0) continue;
+                const int sx = x * SUBPIXEL + positions[s][0], sy = y * SUBPIXEL + positions[s][1];
+                int j = 0;
+                while (j < m && tris[j] != ids[s]) j++;
+                if (j == m) tris[m] = ids[s], count[m] = 0, sumX[m] = sumY[m] = 0, m++;
+                count[j]++, sumX[j] += sx, sumY[j] += sy;
+                zs[s] = planes[ids[s]].at(sx, sy);
+            }
+            if (m == 0) continue; // the pixel stays as it was
+            for (int j = 0; j < m; j++){
+                float l1, l2;
+                barycentric(triangles[tris[j]], sumX[j] / count[j], sumY[j] / count[j], l1, l2);
+                const std::uint32_t c = pack(shader(tris[j], x, y, l1, l2).bgra, bpp);
+                for (int s = 0; s < n; s++) if (ids[s] == tris[j]) cs[s] = c;
+            }
+            shaded += m;
+
+            int total[4] = {0, 0, 0, 0};
+            float z = zs[0];
+            for (int s = 0; s < n; s++){
+                for (int k = 0; k < bpp; k++) total[k] += (cs[s] >> (8 * k)) & 255;
+                z = std::max(z, zs[s]);
+            }
+            for (int k = 0; k < bpp; k++) pixel[k] = (total[k] + n / 2) / n;
+            drow[x] = z;
+        }
+    }
+    samples.keep_samples(bx, by);
+    return shaded;
+}
+
+long long resolve_multisampled(const std::vector<ScreenTriangle> &triangles, const std::vector<DepthPlane> &planes,
+                               SampleBuffer &samples, const PixelShader &shader, TGAImage &image, DepthBuffer &depth){
+    PROFILE_STAGE("msaa resolve");
+    constexpr int BLOCK = SampleBuffer::BLOCK;
+    const int width = samples.width(), height = samples.height(), n = samples.samples(), bpp = image.bytespp();
+    const int (*positions)[2] = sample_positions(n);
+    const int blocksX = (width + BLOCK - 1) / BLOCK, blocksY = (height + BLOCK - 1) / BLOCK;
+
+    // blocks are resolved by rows of depth tiles, so no two threads update the same tile of the depth pyramid
+    const int rows = (height + DepthBuffer::TILE - 1) / DepthBuffer::TILE, blocksPerRow = DepthBuffer::TILE / BLOCK;
+    long long shaded = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:shaded)
+    for (int row = 0; row < rows; row++){
+        for (int by = row * blocksPerRow; by < std::min((row + 1) * blocksPerRow, blocksY); by++){
+            for (int bx = 0; bx < blocksX; bx++){
+                const int id = samples.block_triangle(bx, by);
+                if (id == -1) continue; // nothing drawn there
+                if (id == -2){
+                    shaded += resolve_expanded(triangles, planes, samples, shader, bx, by, image, depth);
+                    depth.update_block(bx, by);
+                    continue;
+                }
+                // all the samples see the same triangle, every pixel is shaded at its center
+                for (int y = by * BLOCK; y < std::min((by + 1) * BLOCK, height); y++){
+                    float *drow = depth.row(y);
+                    for (int x = bx * BLOCK; x < std::min((bx + 1) * BLOCK, width); x++){
+                        float l1, l2;
+                        barycentric(triangles[id], x * SUBPIXEL + SUBPIXEL / 2, y * SUBPIXEL + SUBPIXEL / 2, l1, l2);
+                        const TGAColor c = shader(id, x, y, l1, l2);
+                        std::memcpy(image.pixel(x, y), c.bgra, bpp);
+                        float z = -INFINITY;
+                        for (int s = 0; s < n; s++)
+                            z = std::max(z, (float)planes[id].at(x * SUBPIXEL + positions[s][0], y * SUBPIXEL + positions[s][1]));
+                        drow[x] = z;
+                        shaded++;
+                    }
+                }
+                samples.keep_plane(bx, by, planes[id]);
+                depth.update_block(bx, by);
+            }
+        }
+    }
+    return shaded;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "depthbuffer.h"
+#include "rasterizer.h"
+
+// vertices of multisampled triangles are in 1/SUBPIXEL of a pixel, so samples can fall between pixel corners
+constexpr int SUBPIXEL = 16;
+
+// the sample counts that have a pattern are 1, 2, 4 and 8, others get the largest one below them
+int supported_samples(const int samples);
+// where the samples of a pixel are, in 1/SUBPIXEL of a pixel from its top-left corner (the standard patterns of
+// Direct3D)
+const int (*sample_positions(const int samples))[2];
+
+// the depth of a multisampled triangle over the screen, in 1/SUBPIXEL pixel units
+struct DepthPlane {
+    double za = 0, zb = 0, zc = 0;
+
+    DepthPlane() = default;
+    DepthPlane(const ScreenTriangle &t);
+    double at(const double x, const double y) const { return za * x + zb * y + zc; }
+};
+
+// the samples of a multisampled image, kept by BLOCK x BLOCK blocks of pixels
+// during a draw, a sample holds the triangle of the draw it sees, or -1 if none; a block seen entirely through one
+// triangle (or through none) holds just that triangle, and only blocks where the samples differ hold one per sample
+// between the draws of a frame, a block keeps what the samples saw so far: nothing (the depth buffer and the image
+// tell, as for single-sampled pixels), a single plane (its pixels have its color), or a depth and a color per sample
+// per-sample storage belongs to the TILE x TILE tile of the block, so the worker drawing a tile never shares it
+class SampleBuffer {
+public:
+    static constexpr int BLOCK = DepthBuffer::BLOCK;
+    static constexpr int TILE = TILE_SIZE;
+
+    // what the previous draws of the frame left in a block
+    enum class History : std::uint8_t { EMPTY, PLANE, SAMPLES };
+
+    // starts a draw into the depth buffer: the frame goes on if it is the depth buffer of the previous draw and it was
+    // not cleared since, otherwise everything is dropped and a new frame starts
+    void begin_draw(const DepthBuffer &depth, const int samples);
+
+    int width()  const { return w; }
+    int height() const { return h; }
+    int samples() const { return n; }
+
+    // the triangle of the draw seen by the whole block (bx, by), or -2 if its samples are not all the same
+    int block_triangle(const int bx, const int by) const {
+        const Block &b = blocks[bx + by * blocksX];
+        return b.slot < 0 ? b.triangle : -2;
+    }
+    // the triangles of the draw seen by the samples of pixel (x, y), samples() of them
+    const int *pixel(const int x, const int y) const;
+    int *pixel(const int x, const int y);
+
+    // gives the block a single triangle
+    void fill_block(const int bx, const int by, const int triangle);
+    // gives the block one triangle per sample, all equal to its triangle so far
+    void expand_block(const int bx, const int by);
+    // goes back to a single triangle for the block if all its samples have the same one
+    void compress_block(const int bx, const int by);
+
+    History history(const int bx, const int by) const { return blocks[bx + by * blocksX].history; }
+    const DepthPlane &history_plane(const int bx, const int by) const { return blocks[bx + by * blocksX].plane; }
+    // the depths and colors (packed bgra) of the samples of pixel (x, y) in a block with History::SAMPLES
+    const float *sample_depths(const int x, const int y) const;
+    const std::uint32_t *sample_colors(const int x, const int y) const;
+    // the depth of sample s of pixel (x, y), at (sx, sy), before the current draw
+    double history_depth(const int x, const int y, const int s, const double sx, const double sy, const DepthBuffer &depth) const {
+        const Block &b = blocks[x / BLOCK + y / BLOCK * blocksX];
+        if (b.history == History::PLANE) return b.plane.at(sx, sy);
+        if (b.history == History::SAMPLES) return sample_depths(x, y)[s];
+        return depth.get(x, y);
+    }
+
+    // the block is now seen through a single plane
+    void keep_plane(const int bx, const int by, const DepthPlane &plane);
+    // gives the block per-sample history, the previous one staying readable until keep_samples() is called:
+    // returns where the depths and colors of the samples of its pixels go, pixel (x, y) of the block at
+    // ((x % BLOCK) + (y % BLOCK) * BLOCK) * samples()
+    void prepare_samples(const int bx, const int by, float *&depths, std::uint32_t *&colors);
+    void keep_samples(const int bx, const int by);
+
+    // bytes used by blocks with one triangle per sample, and by per-sample history
+    size_t expanded_memory() const;
+
+private:
+    struct Block {
+        int triangle = -1; // if not expanded
+        int slot = -1;     // expanded samples in the storage of the tile, -1 if not expanded
+        History history = History::EMPTY;
+        int historySlot = -1, nextSlot = -1; // per-sample history in the storage of the tile
+        DepthPlane plane;
+    };
+    struct TileStorage {
+        std::vector<int> samples;           // BLOCK * BLOCK * n per slot
+        std::vector<int> free;              // slots given back by compressed blocks
+        std::vector<float> depths;          // the same for history
+        std::vector<std::uint32_t> colors;
+        std::vector<int> freeHistory;
+    };
+    int w = 0, h = 0, n = 1;
+    int blocksX = 0, blocksY = 0, tilesX = 0;
+    const DepthBuffer *frameDepth = nullptr; // the depth buffer of the frame, as it was when the frame started
+    std::uint64_t frameClears = 0;
+    std::vector<Block> blocks;
+    std::vector<TileStorage> tiles;
+
+    TileStorage &tile_of(const int bx, const int by){
+        return tiles[bx * BLOCK / TILE + by * BLOCK / TILE * tilesX];
+    }
+    const TileStorage &tile_of(const int bx, const int by) const {
+        return tiles[bx * BLOCK / TILE + by * BLOCK / TILE * tilesX];
+    }
+    void free_history(Block &b, TileStorage &tile);
+};
+
+// multisampled visibility: the triangles (in 1/SUBPIXEL pixel units, with their depth planes) are binned and
+// rasterized by tile like rasterize_binned(), a sample takes a triangle when it is inside all three edges and the
+// triangle is in front of what the sample saw so far, in this draw or in the previous ones of the frame
+// a triangle covering a whole block in front of it replaces the block by itself without looking at the samples
+// returns the number of pixels written, counting every time a pixel is overwritten
+long long rasterize_multisampled(const std::vector<ScreenTriangle> &triangles, const std::vector<DepthPlane> &planes,
+                                 const Rect &scissor, SampleBuffer &samples, const DepthBuffer &depth);
+
+// the end of a multisampled draw: every pixel is shaded once per triangle of the draw its samples see, at the center
+// of those samples, and gets the average color of all its samples; the depth buffer gets the depth of its closest
+// sample, and the samples are kept for the next draws of the frame
+// returns the number of fragments shaded
+long long resolve_multisampled(const std::vector<ScreenTriangle> &triangles, const std::vector<DepthPlane> &planes,
+                               SampleBuffer &samples, const PixelShader &shader, TGAImage &image, DepthBuffer &depth);
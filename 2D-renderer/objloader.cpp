@@ -0,0 +1,530 @@
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "objloader.h"
+#include "profiler.h"
+
+// bump whenever the layout of the cache file changes
+constexpr std::uint32_t MESH_CACHE_VERSION = 3;
+
+struct MeshCacheHeader {
+    char magic[4] = {'M', 'E', 'S', 'H'};
+    std::uint32_t version = MESH_CACHE_VERSION;
+    std::uint64_t sourceSize = 0;  // the cache is only valid for the .obj it was built from,
+    std::int64_t  sourceMtime = 0; // recognized by its size and modification time (in nanoseconds)
+    std::uint64_t nverts = 0;
+    std::uint64_t nnormals = 0;
+    std::uint64_t nuvs = 0;
+    std::uint64_t nindices = 0;
+    std::uint8_t  hasNormalIndices = 0;
+    std::uint8_t  hasUVIndices = 0;
+    std::uint8_t  hasFaceMaterials = 0;
+    std::uint32_t nmtllibs = 0;    // followed by the paths of the .mtl files, which are read again on every load
+    std::uint32_t nmaterials = 0;  // and by the names of the materials
+};
+
+// the face indices pointing into one kind of vertex data (v, vt or vn)
+struct ObjIndices {
+    std::vector<int> indices;
+    std::vector<size_t> relative; // entries holding negative .obj indices, which are relative to the chunk's first element
+};
+
+// the vertex data and faces found in one chunk of the file
+struct ObjChunk {
+    Mesh mesh;
+    ObjIndices positions, uvs, normals;
+    std::vector<std::string> mtllibs;
+    std::vector<std::pair<int, std::string>> materialUses; // material names, with the first triangle of the chunk they apply to
+    bool ok = true;
+};
+
+static const char *skip_blanks(const char *p, const char *end){
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static bool parse_float(const char *&p, const char *end, float &value){
+    p = skip_blanks(p, end);
+    if (p < end && *p == '+') p++; // from_chars does not accept an explicit plus sign
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc()) return false;
+    p = next;
+    return true;
+}
+
+static bool parse_floats(const char *&p, const char *end, std::initializer_list<std::vector<float> *> values){
+    for (std::vector<float> *v : values){
+        float f;
+        if (!parse_float(p, end, f)) return false;
+        v->push_back(f);
+    }
+    return true;
+}
+
+static bool is_keyword(const char *p, const char *eol, const char *keyword){
+    const size_t n = std::strlen(keyword);
+    return eol - p >= (long)n && !std::memcmp(p, keyword, n) && (p + n == eol || p[n] == ' ' || p[n] == '\t' || p[n] == '\r');
+}
+
+// the rest of the line without surrounding blanks, for names
+static std::string rest_of_line(const char *p, const char *eol){
+    p = skip_blanks(p, eol);
+    while (eol > p && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r')) eol--;
+    return std::string(p, eol);
+}
+
+// one corner of a face: "v", "v/vt", "v//vn" or "v/vt/vn", with 0 standing for a missing index
+struct ObjCorner {
+    int v = 0, vt = 0, vn = 0;
+};
+
+static bool parse_corner(const char *&p, const char *eol, ObjCorner &corner){
+    int *fields[3] = {&corner.v, &corner.vt, &corner.vn};
+    for (int i = 0; i < 3; i++){
+        if (i > 0){
+            if (p == eol || *p != '/') break;
+            p++;
+            if (p < eol && *p == '/') continue; // empty field
+        }
+        auto [next, ec] = std::from_chars(p, eol, *fields[i]);
+        if (ec != std::errc() || !*fields[i]) return false;
+        p = next;
+    }
+    return corner.v != 0 && (p == eol || *p == ' ' || *p == '\t' || *p == '\r');
+}
+
+// converts a 1-based (or negative, relative) .obj index into a 0-based one, -1 meaning there is none
+static void push_index(ObjIndices &out, const int index, const int count){
+    if (index < 0){
+        out.relative.push_back(out.indices.size());
+        out.indices.push_back(count + index);
+    } else {
+        out.indices.push_back(index - 1);
+    }
+}
+
+static void parse_chunk(const char *p, const char *end, ObjChunk &chunk){
+    Mesh &m = chunk.mesh;
+    std::vector<ObjCorner> polygon;
+    while (p < end){
+        const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (!eol) eol = end;
+        p = skip_blanks(p, eol);
+
+        if (is_keyword(p, eol, "v")){ // parse a point
+            p += 1;
+            chunk.ok = parse_floats(p, eol, {&m.x, &m.y, &m.z});
+        } else if (is_keyword(p, eol, "vn")){ // parse a normal
+            p += 2;
+            chunk.ok = parse_floats(p, eol, {&m.nx, &m.ny, &m.nz});
+        } else if (is_keyword(p, eol, "vt")){ // parse texture coordinates, the optional w is ignored
+            p += 2;
+            chunk.ok = parse_floats(p, eol, {&m.u, &m.v});
+        } else if (is_keyword(p, eol, "mtllib")){
+            chunk.mtllibs.push_back(rest_of_line(p + 6, eol));
+        } else if (is_keyword(p, eol, "usemtl")){ // the material of the faces that follow
+            chunk.materialUses.emplace_back(chunk.positions.indices.size() / 3, rest_of_line(p + 6, eol));
+        } else if (is_keyword(p, eol, "f")){ // parse a face
+            polygon.clear();
+            p += 1;
+            while (chunk.ok && (p = skip_blanks(p, eol)) < eol){
+                polygon.emplace_back();
+                chunk.ok = parse_corner(p, eol, polygon.back());
+            }
+            chunk.ok = chunk.ok && polygon.size() >= 3;
+
+            // split polygons into a fan of triangles around their first vertex
+            for (size_t i = 2; chunk.ok && i < polygon.size(); i++){
+                for (const ObjCorner &c : {polygon[0], polygon[i - 1], polygon[i]}){
+                    push_index(chunk.positions, c.v, m.x.size());
+                    push_index(chunk.uvs, c.vt, m.u.size());
+                    push_index(chunk.normals, c.vn, m.nx.size());
+                }
+            }
+        }
+        if (!chunk.ok) return;
+        p = eol + 1;
+    }
+}
+
+// directory part of a path, with its trailing slash ("" for a file of the working directory)
+static std::string directory_of(const std::string &path){
+    const size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// reads the diffuse color and texture of the materials of the mesh from a .mtl file, other materials are ignored
+static void read_mtl(const std::string &path, std::vector<Material> &materials){
+    std::ifstream in(path);
+    if (!in.is_open()){
+        std::cerr << "can't open material file " << path << "\n";
+        return;
+    }
+    std::map<std::string, int> byName;
+    for (int i = 0; i < (int)materials.size(); i++) byName[materials[i].name] = i;
+
+    Material *current = nullptr;
+    std::string line;
+    while (std::getline(in, line)){
+        const char *p = line.data(), *eol = line.data() + line.size();
+        p = skip_blanks(p, eol);
+        if (is_keyword(p, eol, "newmtl")){
+            auto it = byName.find(rest_of_line(p + 6, eol));
+            current = it == byName.end() ? nullptr : &materials[it->second];
+        } else if (current && is_keyword(p, eol, "Kd")){
+            p += 2;
+            for (int c = 0; c < 3; c++) parse_float(p, eol, current->diffuse[c]);
+        } else if (current && is_keyword(p, eol, "map_Kd")){
+            // options like -s or -o come before the filename, which is taken to be the last word
+            std::string file = rest_of_line(p + 6, eol);
+            const size_t space = file.find_last_of(" \t");
+            if (space != std::string::npos) file = file.substr(space + 1);
+            current->diffuseMap = file.empty() || file[0] == '/' ? file : directory_of(path) + file;
+        }
+    }
+}
+
+static std::int64_t mtime_ns(const struct stat &st){
+    return std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// the arrays of a mesh in the order they are stored in the cache
+static std::vector<std::vector<float> *> float_arrays(Mesh &mesh){
+    return {&mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz, &mesh.u, &mesh.v};
+}
+
+static std::vector<std::vector<int> *> index_arrays(Mesh &mesh){
+    return {&mesh.indices, &mesh.normalIndices, &mesh.uvIndices};
+}
+
+static void write_string(std::ofstream &out, const std::string &s){
+    const std::uint32_t n = s.size();
+    out.write(reinterpret_cast<const char *>(&n), sizeof(n));
+    out.write(s.data(), n);
+}
+
+static bool read_string(std::ifstream &in, std::string &s){
+    std::uint32_t n = 0;
+    in.read(reinterpret_cast<char *>(&n), sizeof(n));
+    if (!in.good() || n > (1u << 20)) return false;
+    s.resize(n);
+    in.read(s.data(), n);
+    return in.good();
+}
+
+static bool read_cache(const std::string &path, const struct stat &source, Mesh &mesh, std::vector<std::string> &mtllibs){
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+    MeshCacheHeader header, expected;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!in.good() || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) ||
+        header.version != MESH_CACHE_VERSION || header.sourceSize != (std::uint64_t)source.st_size ||
+        header.sourceMtime != mtime_ns(source)) return false;
+
+    // the counts of a damaged cache are caught by the size of the file, before anything is allocated for them
+    // (every path and material name takes at least its length)
+    struct stat st;
+    std::uint64_t left = stat(path.c_str(), &st) == 0 ? st.st_size - sizeof(header) : 0;
+    auto take = [&](const std::uint64_t count, const std::uint64_t bytes){
+        if (count > left / bytes) return false;
+        left -= count * bytes;
+        return true;
+    };
+    const int intsPerCorner = 1 + (header.hasNormalIndices ? 1 : 0) + (header.hasUVIndices ? 1 : 0);
+    if (!take(header.nverts, 3 * sizeof(float)) || !take(header.nnormals, 3 * sizeof(float)) ||
+        !take(header.nuvs, 2 * sizeof(float)) || !take(header.nindices, intsPerCorner * sizeof(int)) ||
+        !take(header.hasFaceMaterials ? header.nindices / 3 : 0, sizeof(int)) ||
+        !take(header.nmtllibs, sizeof(std::uint32_t)) || !take(header.nmaterials, sizeof(std::uint32_t))) return false;
+
+    for (auto *v : {&mesh.x, &mesh.y, &mesh.z}) v->resize(header.nverts);
+    for (auto *v : {&mesh.nx, &mesh.ny, &mesh.nz}) v->resize(header.nnormals);
+    for (auto *v : {&mesh.u, &mesh.v}) v->resize(header.nuvs);
+    mesh.indices.resize(header.nindices);
+    mesh.normalIndices.resize(header.hasNormalIndices ? header.nindices : 0);
+    mesh.uvIndices.resize(header.hasUVIndices ? header.nindices : 0);
+    for (auto *v : float_arrays(mesh))
+        in.read(reinterpret_cast<char *>(v->data()), v->size() * sizeof(float));
+    for (auto *v : index_arrays(mesh))
+        in.read(reinterpret_cast<char *>(v->data()), v->size() * sizeof(int));
+
+    mtllibs.resize(header.nmtllibs);
+    for (std::string &lib : mtllibs)
+        if (!read_string(in, lib)) return false;
+    mesh.materials.resize(header.nmaterials);
+    for (Material &material : mesh.materials)
+        if (!read_string(in, material.name)) return false;
+    mesh.faceMaterials.resize(header.hasFaceMaterials ? header.nindices / 3 : 0);
+    in.read(reinterpret_cast<char *>(mesh.faceMaterials.data()), mesh.faceMaterials.size() * sizeof(int));
+    // the indices were checked by the parser when the cache was written, but the file may have been damaged since
+    return in.good() && valid_mesh(mesh);
+}
+
+static bool write_cache(const std::string &path, const struct stat &source, Mesh &mesh,
+                        const std::vector<std::string> &mtllibs){
+    // written next to the final file and renamed at the end, so readers never see a partial cache
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary);
+    if (!out.is_open()) return false;
+    MeshCacheHeader header;
+    header.sourceSize = source.st_size;
+    header.sourceMtime = mtime_ns(source);
+    header.nverts = mesh.x.size();
+    header.nnormals = mesh.nx.size();
+    header.nuvs = mesh.u.size();
+    header.nindices = mesh.indices.size();
+    header.hasNormalIndices = !mesh.normalIndices.empty();
+    header.hasUVIndices = !mesh.uvIndices.empty();
+    header.hasFaceMaterials = !mesh.faceMaterials.empty();
+    header.nmtllibs = mtllibs.size();
+    header.nmaterials = mesh.materials.size();
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (auto *v : float_arrays(mesh))
+        out.write(reinterpret_cast<const char *>(v->data()), v->size() * sizeof(float));
+    for (auto *v : index_arrays(mesh))
+        out.write(reinterpret_cast<const char *>(v->data()), v->size() * sizeof(int));
+    for (const std::string &lib : mtllibs) write_string(out, lib);
+    for (const Material &material : mesh.materials) write_string(out, material.name);
+    out.write(reinterpret_cast<const char *>(mesh.faceMaterials.data()), mesh.faceMaterials.size() * sizeof(int));
+    out.close();
+    if (!out.good() || std::rename(tmpPath.c_str(), path.c_str())){
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// appends the arrays of src at the given offsets of dst
+static void copy_at(const std::vector<float> &src, std::vector<float> &dst, const size_t offset){
+    std::copy(src.begin(), src.end(), dst.begin() + offset);
+}
+
+// shifts the relative indices of a chunk by the number of elements before it, then checks all of them
+// indices into an optional attribute the file has no data for are dropped later on, so they are not checked
+static bool resolve_indices(ObjIndices &in, const size_t first, const long long count, const bool optional){
+    if (optional && !count) return true;
+    for (size_t r : in.relative) in.indices[r] += first;
+    bool ok = true;
+    for (int index : in.indices) ok = ok && index < count && (index >= 0 || (optional && index == -1));
+    return ok;
+}
+
+// gives every triangle the material named by the last usemtl before it, materials are numbered in order of first use
+// and the .mtl files are returned (relative to the directory of the .obj) without being read yet
+static void resolve_materials(const std::vector<ObjChunk> &chunks, const std::vector<size_t> &indexOffset,
+                              const std::string &directory, Mesh &mesh, std::vector<std::string> &mtllibs){
+    std::map<std::string, int> byName;
+    bool used = false;
+    for (const ObjChunk &chunk : chunks){
+        for (const std::string &lib : chunk.mtllibs){
+            std::string path = lib.empty() || lib[0] == '/' ? lib : directory + lib;
+            if (std::find(mtllibs.begin(), mtllibs.end(), path) == mtllibs.end()) mtllibs.push_back(path);
+        }
+        used |= !chunk.materialUses.empty();
+    }
+    if (!used) return;
+
+    // a chunk starts with the material the previous one ended with
+    mesh.faceMaterials.assign(mesh.indices.size() / 3, -1);
+    int current = -1;
+    for (size_t i = 0; i < chunks.size(); i++){
+        const size_t firstFace = indexOffset[i] / 3, nfaces = (indexOffset[i + 1] - indexOffset[i]) / 3;
+        size_t face = 0;
+        for (const auto &[start, name] : chunks[i].materialUses){
+            std::fill(mesh.faceMaterials.begin() + firstFace + face, mesh.faceMaterials.begin() + firstFace + start, current);
+            face = start;
+            auto it = byName.find(name);
+            if (it == byName.end()){
+                it = byName.emplace(name, mesh.materials.size()).first;
+                mesh.materials.emplace_back();
+                mesh.materials.back().name = name;
+            }
+            current = it->second;
+        }
+        std::fill(mesh.faceMaterials.begin() + firstFace + face, mesh.faceMaterials.begin() + firstFace + nfaces, current);
+    }
+}
+
+// how many elements the parts of a file before the one being parsed had, its relative indices are shifted by them
+struct ObjCounts {
+    size_t verts = 0, normals = 0, uvs = 0;
+};
+
+// parses a part of a file made of whole lines into a mesh of the elements it defines, whose face indices already
+// point into the whole file; the chunks it was parsed in and where their faces start are left for the materials
+static bool parse_part(const char *data, const size_t size, const ObjCounts &before, Mesh &mesh,
+                       std::vector<ObjChunk> &chunks, std::vector<size_t> &indexOffset){
+    // cut the part in chunks of at least 256KB, moving every cut to the start of the next line
+    const size_t minChunk = 1 << 18;
+    const int nchunks = std::max<size_t>(1, std::min<size_t>(size / minChunk, omp_get_max_threads() * 8));
+    std::vector<const char *> cuts(nchunks + 1, data + size);
+    for (int i = 0; i < nchunks; i++){
+        const char *cut = data + size * i / nchunks;
+        if (i > 0){
+            const char *eol = static_cast<const char *>(std::memchr(cut, '\n', data + size - cut));
+            cut = eol ? eol + 1 : data + size;
+        }
+        cuts[i] = cut;
+    }
+
+    chunks.assign(nchunks, ObjChunk());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < nchunks; i++)
+        if (cuts[i] < cuts[i + 1]) parse_chunk(cuts[i], cuts[i + 1], chunks[i]);
+
+    // concatenate the chunks, relative indices are shifted by the number of elements before their chunk
+    std::vector<size_t> vertOffset(nchunks + 1, 0), normalOffset(nchunks + 1, 0), uvOffset(nchunks + 1, 0);
+    indexOffset.assign(nchunks + 1, 0);
+    for (int i = 0; i < nchunks; i++){
+        if (!chunks[i].ok) return false;
+        vertOffset[i + 1] = vertOffset[i] + chunks[i].mesh.x.size();
+        normalOffset[i + 1] = normalOffset[i] + chunks[i].mesh.nx.size();
+        uvOffset[i + 1] = uvOffset[i] + chunks[i].mesh.u.size();
+        indexOffset[i + 1] = indexOffset[i] + chunks[i].positions.indices.size();
+    }
+    for (auto *v : {&mesh.x, &mesh.y, &mesh.z}) v->resize(vertOffset[nchunks]);
+    for (auto *v : {&mesh.nx, &mesh.ny, &mesh.nz}) v->resize(normalOffset[nchunks]);
+    for (auto *v : {&mesh.u, &mesh.v}) v->resize(uvOffset[nchunks]);
+    for (auto *v : index_arrays(mesh)) v->resize(indexOffset[nchunks]);
+
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(&&: ok)
+    for (int i = 0; i < nchunks; i++){
+        ObjChunk &chunk = chunks[i];
+        ok = ok && resolve_indices(chunk.positions, before.verts + vertOffset[i], before.verts + vertOffset[nchunks], false) &&
+             resolve_indices(chunk.normals, before.normals + normalOffset[i], before.normals + normalOffset[nchunks], true) &&
+             resolve_indices(chunk.uvs, before.uvs + uvOffset[i], before.uvs + uvOffset[nchunks], true);
+        copy_at(chunk.mesh.x, mesh.x, vertOffset[i]);
+        copy_at(chunk.mesh.y, mesh.y, vertOffset[i]);
+        copy_at(chunk.mesh.z, mesh.z, vertOffset[i]);
+        copy_at(chunk.mesh.nx, mesh.nx, normalOffset[i]);
+        copy_at(chunk.mesh.ny, mesh.ny, normalOffset[i]);
+        copy_at(chunk.mesh.nz, mesh.nz, normalOffset[i]);
+        copy_at(chunk.mesh.u, mesh.u, uvOffset[i]);
+        copy_at(chunk.mesh.v, mesh.v, uvOffset[i]);
+        std::copy(chunk.positions.indices.begin(), chunk.positions.indices.end(), mesh.indices.begin() + indexOffset[i]);
+        std::copy(chunk.normals.indices.begin(), chunk.normals.indices.end(), mesh.normalIndices.begin() + indexOffset[i]);
+        std::copy(chunk.uvs.indices.begin(), chunk.uvs.indices.end(), mesh.uvIndices.begin() + indexOffset[i]);
+    }
+
+    // attribute indices are only kept if the file has that attribute at all
+    if (!before.normals && mesh.nx.empty()) mesh.normalIndices.clear();
+    if (!before.uvs && mesh.u.empty()) mesh.uvIndices.clear();
+    return ok;
+}
+
+static bool parse_obj(const char *data, const size_t size, const std::string &directory, Mesh &mesh,
+                      std::vector<std::string> &mtllibs){
+    std::vector<ObjChunk> chunks;
+    std::vector<size_t> indexOffset;
+    if (!parse_part(data, size, ObjCounts(), mesh, chunks, indexOffset)) return false;
+    resolve_materials(chunks, indexOffset, directory, mesh, mtllibs);
+    return true;
+}
+
+bool load_obj(const std::string &filename, Mesh &mesh, const bool useCache){
+    PROFILE_STAGE("obj parse");
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)){
+        std::cerr << "can't open file " << filename << "\n";
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    // the .mtl files are small, so they are read again even when the mesh comes from the cache
+    const std::string cachePath = filename + ".meshcache";
+    std::vector<std::string> mtllibs;
+    if (useCache && read_cache(cachePath, st, mesh, mtllibs)){
+        close(fd);
+        for (const std::string &lib : mtllibs) read_mtl(lib, mesh.materials);
+        build_clusters(mesh);
+        return true;
+    }
+
+    mesh = Mesh();
+    mtllibs.clear();
+    bool ok = true;
+    if (st.st_size > 0){
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED){
+            std::cerr << "can't map file " << filename << "\n";
+            close(fd);
+            return false;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        ok = parse_obj(static_cast<const char *>(data), st.st_size, directory_of(filename), mesh, mtllibs);
+        munmap(data, st.st_size);
+    }
+    close(fd);
+
+    if (!ok){
+        std::cerr << "an error occured while parsing " << filename << "\n";
+        mesh = Mesh();
+        return false;
+    }
+    if (useCache && !write_cache(cachePath, st, mesh, mtllibs))
+        std::cerr << "can't write the mesh cache " << cachePath << "\n";
+    for (const std::string &lib : mtllibs) read_mtl(lib, mesh.materials);
+    build_clusters(mesh);
+    return true;
+}
+
+bool stream_obj(const std::string &filename, const std::function<bool(const Mesh &part)> &consume, const size_t partBytes){
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st)){
+        std::cerr << "can't open file " << filename << "\n";
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void *map = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (map == MAP_FAILED){
+        std::cerr << "can't map file " << filename << "\n";
+        return false;
+    }
+    const char *data = static_cast<const char *>(map);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // parts end at the end of a line, and the pages of the file are let go once their part is parsed
+    ObjCounts counts;
+    bool ok = true;
+    size_t begin = 0;
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    while (ok && begin < (size_t)st.st_size){
+        size_t end = std::min<size_t>(st.st_size, begin + partBytes);
+        if (end < (size_t)st.st_size){
+            const char *eol = static_cast<const char *>(std::memchr(data + end, '\n', st.st_size - end));
+            end = eol ? eol + 1 - data : st.st_size;
+        }
+        Mesh part;
+        std::vector<ObjChunk> chunks;
+        std::vector<size_t> indexOffset;
+        if (!parse_part(data + begin, end - begin, counts, part, chunks, indexOffset)){
+            std::cerr << "an error occured while parsing " << filename << "\n";
+            ok = false;
+            break;
+        }
+        chunks.clear();
+        counts.verts += part.x.size();
+        counts.normals += part.nx.size();
+        counts.uvs += part.u.size();
+        ok = consume(part);
+        const size_t release = end / pageSize * pageSize;
+        madvise(map, release, MADV_DONTNEED);
+        begin = end;
+    }
+    if (map) munmap(map, st.st_size);
+    return ok;
+}
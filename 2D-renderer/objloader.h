@@ -0,0 +1,18 @@
+#pragma once
+#include <functional>
+#include <string>
+
+#include "mesh.h"
+
+// loads the vertices and faces of a wavefront .obj file, polygons are split into triangle fans and grouped in clusters
+// the file is memory mapped and parsed in place, in parallel chunks
+// with useCache set, a binary copy of the mesh is kept in <filename>.meshcache and used
+// instead of the .obj for as long as the size and modification time of the .obj do not change
+bool load_obj(const std::string &filename, Mesh &mesh, const bool useCache = false);
+
+// reads an .obj too large to be held whole, part after part of about partBytes of text: every part is handed to
+// consume() as a mesh of the vertices, normals and uvs it defines and of its faces, whose indices point into the
+// whole file (so they can refer to earlier parts); materials are ignored
+// stops at the first part consume() returns false for
+bool stream_obj(const std::string &filename, const std::function<bool(const Mesh &part)> &consume,
+                const size_t partBytes = 64 << 20);
@@ -0,0 +1,596 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <omp.h>
+
+#include "pipeline.h"
+#include "profiler.h"
+
+// how far (in pixels) triangles may reach beyond the viewport before they are clipped, it keeps
+// screen coordinates small enough for the rasterizer's edge functions
+constexpr double GUARD_BAND = 8192;
+// vertices closer than this to the plane of the eye (w = 0) are clipped away
+constexpr double MIN_W = 1e-5;
+
+// the planes of clip space, the inner side of each is where plane_distance() >= 0
+enum ClipPlane { PLANE_W, PLANE_NEAR, PLANE_FAR, PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, NPLANES };
+
+// gx and gy scale the side planes, 1 for the viewport and more for the guard band
+static double plane_distance(const int plane, const Vec4 &p, const double gx, const double gy){
+    switch (plane){
+        case PLANE_W:      return p[3] - MIN_W;
+        case PLANE_NEAR:   return p[3] - p[2];
+        case PLANE_FAR:    return p[3] + p[2];
+        case PLANE_LEFT:   return gx * p[3] + p[0];
+        case PLANE_RIGHT:  return gx * p[3] - p[0];
+        case PLANE_BOTTOM: return gy * p[3] + p[1];
+        default:           return gy * p[3] - p[1];
+    }
+}
+
+// one bit per plane the point is outside of
+static unsigned outcode(const Vec4 &p, const double gx, const double gy){
+    unsigned code = 0;
+    for (int plane = 0; plane < NPLANES; plane++)
+        if (plane_distance(plane, p, gx, gy) < 0) code |= 1 << plane;
+    return code;
+}
+
+// maps a clip space point to pixel coordinates (in 1/subpixel of a pixel) and a depth in [0, 1]
+static Vec3 viewport(const Vec4 &p, const int width, const int height, const int subpixel){
+    return {std::floor((p[0] / p[3] + 1.) * width / 2 * subpixel),
+            std::floor((p[1] / p[3] + 1.) * height / 2 * subpixel),
+            (p[2] / p[3] + 1.) / 2};
+}
+
+// Sutherland-Hodgman clipping of a convex polygon against the planes in mask, returns the new vertex count
+// bary holds where every vertex lies in the face (the weights of its corners 1 and 2), new vertices get theirs by
+// the same interpolation as their position
+static int clip_polygon(Vec4 *poly, float (*bary)[2], int n, const unsigned mask, const double gx, const double gy){
+    Vec4 tmp[3 + NPLANES];
+    float tmpBary[3 + NPLANES][2];
+    for (int plane = 0; plane < NPLANES && n > 0; plane++){
+        if (!(mask & (1 << plane))) continue;
+        int m = 0;
+        for (int i = 0; i < n; i++){
+            const int j = (i + 1) % n;
+            const Vec4 &a = poly[i], &b = poly[j];
+            double da = plane_distance(plane, a, gx, gy), db = plane_distance(plane, b, gx, gy);
+            if (da >= 0){
+                tmpBary[m][0] = bary[i][0], tmpBary[m][1] = bary[i][1];
+                tmp[m++] = a;
+            }
+            if ((da >= 0) != (db >= 0)){
+                double t = da / (da - db);
+                tmpBary[m][0] = bary[i][0] + t * (bary[j][0] - bary[i][0]);
+                tmpBary[m][1] = bary[i][1] + t * (bary[j][1] - bary[i][1]);
+                tmp[m++] = {a[0] + t * (b[0] - a[0]), a[1] + t * (b[1] - a[1]),
+                            a[2] + t * (b[2] - a[2]), a[3] + t * (b[3] - a[3])};
+            }
+        }
+        std::copy(tmp, tmp + m, poly);
+        for (int i = 0; i < m; i++) bary[i][0] = tmpBary[i][0], bary[i][1] = tmpBary[i][1];
+        n = m;
+    }
+    return n;
+}
+
+static long long doubled_area(const Vec3 &a, const Vec3 &b, const Vec3 &c){
+    return (long long)(b[0] - a[0]) * (long long)(c[1] - a[1]) - (long long)(c[0] - a[0]) * (long long)(b[1] - a[1]);
+}
+
+// culls the triangle by its winding or makes it counter-clockwise for the rasterizer, returns false if it is dropped
+static bool orient(ScreenTriangle &t, const CullMode cull, bool &backfacing){
+    long long area = doubled_area(t.p[0], t.p[1], t.p[2]);
+    if (std::abs(area) < 2){
+        backfacing = false;
+        return false;
+    }
+    backfacing = (area < 0 && cull == CullMode::BACK) || (area > 0 && cull == CullMode::FRONT);
+    if (backfacing) return false;
+    if (area < 0){
+        std::swap(t.p[1], t.p[2]);
+        std::swap(t.invW[1], t.invW[2]);
+        std::swap(t.bary[1], t.bary[2]);
+    }
+    return true;
+}
+
+// primitive assembly for faces [first, last) of the mesh, appending the resulting triangles to out
+// triangles get the color of their face, if there are face colors
+static void assemble(const Mesh &mesh, const TGAColor *faceColors, const DrawCache &cache,
+                     const int first, const int last, const int width, const int height, const int subpixel,
+                     const double gx, const double gy, const CullMode cull, std::vector<ScreenTriangle> &out, DrawStats &stats){
+    for (int f = first; f < last; f++){
+        const int *idx = &mesh.indices[f * 3];
+        const std::uint16_t c0 = cache.outcodes[idx[0]], c1 = cache.outcodes[idx[1]], c2 = cache.outcodes[idx[2]];
+        if (c0 & c1 & c2 & 0xff){
+            stats.clipped++; // all three vertices are outside the same plane of the view volume
+            continue;
+        }
+
+        // the side planes only need clipping if a vertex is beyond the guard band
+        const unsigned mask = (c0 | c1 | c2) >> 8;
+
+        ScreenTriangle t;
+        if (faceColors) t.color = faceColors[f];
+        t.face = f;
+        bool backfacing = false;
+        if (!mask){
+            for (int k = 0; k < 3; k++){
+                t.p[k] = cache.vertices[idx[k]];
+                t.invW[k] = 1 / cache.clip[idx[k]][3];
+            }
+            if (orient(t, cull, backfacing)) out.push_back(t), stats.rasterized++;
+            else if (backfacing) stats.backfaceCulled++;
+            else stats.degenerate++;
+            continue;
+        }
+
+        Vec4 poly[3 + NPLANES] = {cache.clip[idx[0]], cache.clip[idx[1]], cache.clip[idx[2]]};
+        float bary[3 + NPLANES][2] = {{0, 0}, {1, 0}, {0, 1}};
+        int n = clip_polygon(poly, bary, 3, mask, gx, gy);
+        if (n < 3){
+            stats.clipped++;
+            continue;
+        }
+
+        // the clipped polygon is split into a fan, its pieces all share the winding of the face
+        bool emitted = false, culled = false;
+        Vec3 screen[3 + NPLANES];
+        for (int i = 0; i < n; i++) screen[i] = viewport(poly[i], width, height, subpixel);
+        for (int i = 2; i < n; i++){
+            const int corners[3] = {0, i - 1, i};
+            for (int k = 0; k < 3; k++){
+                t.p[k] = screen[corners[k]];
+                t.invW[k] = 1 / poly[corners[k]][3];
+                t.bary[k][0] = bary[corners[k]][0], t.bary[k][1] = bary[corners[k]][1];
+            }
+            if (orient(t, cull, backfacing)) out.push_back(t), stats.rasterized++, emitted = true;
+            culled |= backfacing;
+        }
+        if (!emitted) (culled ? stats.backfaceCulled : stats.degenerate)++;
+    }
+}
+
+bool box_outside(const float min[3], const float max[3], const Mat4 &transform){
+    unsigned code = ~0u;
+    for (int corner = 0; corner < 8; corner++){
+        Vec4 p = transform.apply(corner & 1 ? max[0] : min[0], corner & 2 ? max[1] : min[1], corner & 4 ? max[2] : min[2]);
+        code &= outcode(p, 1, 1);
+    }
+    return code != 0;
+}
+
+// runs the vertex stage and primitive assembly, leaving the triangles to rasterize in cache.triangles
+// (in 1/SUBPIXEL of a pixel when multisampling)
+static DrawStats assemble_triangles(const Mesh &mesh, const Mat4 &transform, const TGAColor *faceColors, const int width,
+                                    const int height, DrawCache &cache, const DrawOptions &options){
+    const int nverts = mesh.nverts(), nfaces = mesh.nfaces();
+    const int subpixel = options.samples > 1 ? SUBPIXEL : 1;
+    const double gx = 1 + 2 * GUARD_BAND / width, gy = 1 + 2 * GUARD_BAND / height;
+    cache.clip.resize(nverts);
+    cache.vertices.resize(nverts);
+    cache.outcodes.resize(nverts);
+
+    // vertex stage: shared vertices are transformed once instead of once per face using them
+    {
+        PROFILE_STAGE("vertex projection");
+        #pragma omp parallel for schedule(static)
+        for (int v = 0; v < nverts; v++){
+            const Vec4 p = transform.apply(mesh.x[v], mesh.y[v], mesh.z[v]);
+            cache.clip[v] = p;
+            cache.outcodes[v] = outcode(p, 1, 1) | outcode(p, gx, gy) << 8;
+            if (p[3] > MIN_W) cache.vertices[v] = viewport(p, width, height, subpixel);
+        }
+    }
+
+    // the faces are assembled by cluster, whole clusters outside the view volume are skipped
+    std::vector<MeshCluster> whole;
+    const std::vector<MeshCluster> *clusters = &mesh.clusters;
+    if (clusters->empty()){
+        whole.push_back({0, nfaces});
+        clusters = &whole;
+    }
+    const int nclusters = clusters->size();
+    const bool cullClusters = !mesh.clusters.empty();
+
+    // every thread assembles a contiguous range of clusters into its own list, and the lists are then
+    // concatenated in order, so the triangles reach the rasterizer in the same order as the faces
+    const int nthreads = omp_get_max_threads();
+    cache.threadTriangles.resize(nthreads);
+    std::vector<DrawStats> threadStats(nthreads);
+    #pragma omp parallel num_threads(nthreads)
+    {
+        PROFILE_STAGE("primitive assembly");
+        const int tid = omp_get_thread_num();
+        std::vector<ScreenTriangle> &out = cache.threadTriangles[tid];
+        DrawStats &stats = threadStats[tid];
+        out.clear();
+        for (int c = (long long)nclusters * tid / nthreads; c < (long long)nclusters * (tid + 1) / nthreads; c++){
+            const MeshCluster &cluster = (*clusters)[c];
+            stats.faces += cluster.nfaces;
+            if (cullClusters && box_outside(cluster.min, cluster.max, transform)){
+                stats.frustumCulled += cluster.nfaces;
+                continue;
+            }
+            assemble(mesh, faceColors, cache, cluster.firstFace, cluster.firstFace + cluster.nfaces,
+                     width, height, subpixel, gx, gy, options.cull, out, stats);
+        }
+    }
+
+    DrawStats stats;
+    cache.triangles.clear();
+    for (int tid = 0; tid < nthreads; tid++){
+        cache.triangles.insert(cache.triangles.end(), cache.threadTriangles[tid].begin(), cache.threadTriangles[tid].end());
+        const DrawStats &s = threadStats[tid];
+        stats.faces += s.faces;
+        stats.frustumCulled += s.frustumCulled;
+        stats.clipped += s.clipped;
+        stats.backfaceCulled += s.backfaceCulled;
+        stats.degenerate += s.degenerate;
+        stats.rasterized += s.rasterized;
+    }
+
+    return stats;
+}
+
+// the fragment of the mesh at pixel (x, y) of a triangle, which has the screen space barycentric coordinates (l1, l2)
+static Fragment fragment(const Mesh &mesh, const ScreenTriangle &t, const int x, const int y, const float l1, const float l2){
+    Fragment frag;
+    frag.x = x, frag.y = y, frag.face = t.face;
+
+    // the screen space weights divided by w are proportional to the weights in clip space (and in the face)
+    const float w0 = (1 - l1 - l2) * t.invW[0], w1 = l1 * t.invW[1], w2 = l2 * t.invW[2];
+    const float sum = w0 + w1 + w2;
+    const float b1 = (w0 * t.bary[0][0] + w1 * t.bary[1][0] + w2 * t.bary[2][0]) / sum;
+    const float b2 = (w0 * t.bary[0][1] + w1 * t.bary[1][1] + w2 * t.bary[2][1]) / sum;
+    frag.bary[0] = 1 - b1 - b2, frag.bary[1] = b1, frag.bary[2] = b2;
+
+    const int corner = t.face * 3;
+    const int *idx = &mesh.indices[corner];
+    double n[3] = {0, 0, 0};
+    const int *nidx = mesh.has_normals() ? &mesh.normalIndices[corner] : nullptr;
+    if (nidx && nidx[0] >= 0 && nidx[1] >= 0 && nidx[2] >= 0){
+        for (int k = 0; k < 3; k++){
+            n[0] += frag.bary[k] * mesh.nx[nidx[k]];
+            n[1] += frag.bary[k] * mesh.ny[nidx[k]];
+            n[2] += frag.bary[k] * mesh.nz[nidx[k]];
+        }
+    }
+    else {
+        // the normal of the face, for meshes without normals
+        const double e1[3] = {mesh.x[idx[1]] - mesh.x[idx[0]], mesh.y[idx[1]] - mesh.y[idx[0]], mesh.z[idx[1]] - mesh.z[idx[0]]};
+        const double e2[3] = {mesh.x[idx[2]] - mesh.x[idx[0]], mesh.y[idx[2]] - mesh.y[idx[0]], mesh.z[idx[2]] - mesh.z[idx[0]]};
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    }
+    const double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0) frag.normal = {n[0] / length, n[1] / length, n[2] / length};
+
+    const int *uvidx = mesh.has_uvs() ? &mesh.uvIndices[corner] : nullptr;
+    if (uvidx && uvidx[0] >= 0 && uvidx[1] >= 0 && uvidx[2] >= 0){
+        const float u[3] = {mesh.u[uvidx[0]], mesh.u[uvidx[1]], mesh.u[uvidx[2]]};
+        const float v[3] = {mesh.v[uvidx[0]], mesh.v[uvidx[1]], mesh.v[uvidx[2]]};
+        for (int k = 0; k < 3; k++){
+            frag.u += frag.bary[k] * u[k];
+            frag.v += frag.bary[k] * v[k];
+        }
+
+        // derivatives by finite differences: the uvs are interpolated again (perspective correct) one pixel away,
+        // with the screen space barycentric coordinates moved by their gradients
+        const float e1x = t.p[1][0] - t.p[0][0], e1y = t.p[1][1] - t.p[0][1];
+        const float e2x = t.p[2][0] - t.p[0][0], e2y = t.p[2][1] - t.p[0][1];
+        const float area = e1x * e2y - e1y * e2x;
+        if (area != 0){
+            auto uv_at = [&](const float s1, const float s2, float &uu, float &vv){
+                const float a0 = (1 - s1 - s2) * t.invW[0], a1 = s1 * t.invW[1], a2 = s2 * t.invW[2];
+                const float total = a0 + a1 + a2;
+                const float c1 = (a0 * t.bary[0][0] + a1 * t.bary[1][0] + a2 * t.bary[2][0]) / total;
+                const float c2 = (a0 * t.bary[0][1] + a1 * t.bary[1][1] + a2 * t.bary[2][1]) / total;
+                uu = (1 - c1 - c2) * u[0] + c1 * u[1] + c2 * u[2];
+                vv = (1 - c1 - c2) * v[0] + c1 * v[1] + c2 * v[2];
+            };
+            float ux, vx, uy, vy;
+            uv_at(l1 + e2y / area, l2 - e1y / area, ux, vx);
+            uv_at(l1 - e2x / area, l2 + e1x / area, uy, vy);
+            frag.dudx = ux - frag.u, frag.dvdx = vx - frag.v;
+            frag.dudy = uy - frag.u, frag.dvdy = vy - frag.v;
+        }
+    }
+    return frag;
+}
+
+// deferred shading: every pixel of the G-buffer where a triangle was drawn is shaded once, returns how many were
+static long long shade_gbuffer(const Mesh &mesh, const std::vector<ScreenTriangle> &triangles, const GBuffer &gbuffer,
+                               const FragmentShader &shader, TGAImage &image){
+    PROFILE_STAGE("deferred shading");
+    const int width = gbuffer.width(), height = gbuffer.height(), bpp = image.bytespp();
+    long long shaded = 0;
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:shaded)
+    for (int y = 0; y < height; y++){
+        for (int x = 0; x < width; x++){
+            const int p = x + y * width, id = gbuffer.triangle[p];
+            if (id < 0) continue;
+            const TGAColor color = shader(fragment(mesh, triangles[id], x, y, gbuffer.l1[p], gbuffer.l2[p]));
+            std::memcpy(image.pixel(x, y), color.bgra, bpp);
+            shaded++;
+        }
+    }
+    return shaded;
+}
+
+// draw() with more than one sample per pixel, color(i, x, y, l1, l2) giving the color of triangle i at pixel (x, y)
+static DrawStats draw_multisampled(const Mesh &mesh, const Mat4 &transform, const TGAColor *faceColors, const PixelShader &color,
+                                   TGAImage &image, DepthBuffer &depth, DrawCache &cache, const DrawOptions &options){
+    DrawStats stats = assemble_triangles(mesh, transform, faceColors, image.width(), image.height(), cache, options);
+    const int ntris = cache.triangles.size();
+    cache.planes.resize(ntris);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < ntris; i++) cache.planes[i] = DepthPlane(cache.triangles[i]);
+
+    cache.samples.begin_draw(depth, options.samples);
+    stats.pixelsWritten = rasterize_multisampled(cache.triangles, cache.planes, options.scissor, cache.samples, depth);
+    stats.pixelsShaded = resolve_multisampled(cache.triangles, cache.planes, cache.samples, color, image, depth);
+    PROFILE_COUNT("msaa expanded bytes", cache.samples.expanded_memory());
+    return stats;
+}
+
+void add(DrawStats &sum, const DrawStats &s){
+    sum.faces += s.faces;
+    sum.frustumCulled += s.frustumCulled;
+    sum.clipped += s.clipped;
+    sum.backfaceCulled += s.backfaceCulled;
+    sum.degenerate += s.degenerate;
+    sum.rasterized += s.rasterized;
+    sum.pixelsWritten += s.pixelsWritten;
+    sum.pixelsShaded += s.pixelsShaded;
+}
+
+DrawStats draw(const Mesh &mesh, const Mat4 &transform, const std::vector<TGAColor> &faceColors,
+               TGAImage &image, DepthBuffer &depth, DrawCache &cache, const DrawOptions &options){
+    if (options.samples > 1){
+        return draw_multisampled(mesh, transform, faceColors.data(), [&](const int i, int, int, float, float){
+            return cache.triangles[i].color;
+        }, image, depth, cache, options);
+    }
+    DrawStats stats = assemble_triangles(mesh, transform, faceColors.data(), image.width(), image.height(), cache, options);
+    stats.pixelsWritten = rasterize_binned(cache.triangles, options.scissor, image, depth);
+    return stats;
+}
+
+DrawStats draw(const Mesh &mesh, const Mat4 &transform, const FragmentShader &shader,
+               TGAImage &image, DepthBuffer &depth, DrawCache &cache, const DrawOptions &options){
+    if (options.samples > 1){
+        return draw_multisampled(mesh, transform, nullptr, [&](const int i, const int x, const int y, const float l1, const float l2){
+            // the fragment works out its texture footprint in pixels
+            ScreenTriangle t = cache.triangles[i];
+            for (int k = 0; k < 3; k++) t.p[k][0] /= SUBPIXEL, t.p[k][1] /= SUBPIXEL;
+            return shader(fragment(mesh, t, x, y, l1, l2));
+        }, image, depth, cache, options);
+    }
+    DrawStats stats = assemble_triangles(mesh, transform, nullptr, image.width(), image.height(), cache, options);
+    if (options.shading == ShadingMode::FORWARD){
+        stats.pixelsWritten = rasterize_binned(cache.triangles, options.scissor, image, depth,
+            [&](const int i, const int x, const int y, const float l1, const float l2){
+                return shader(fragment(mesh, cache.triangles[i], x, y, l1, l2));
+            });
+        stats.pixelsShaded = stats.pixelsWritten;
+        return stats;
+    }
+
+    // the G-buffer only gets the pixels where this draw is visible, the others keep their color
+    cache.gbuffer.reset(image.width(), image.height());
+    stats.pixelsWritten = rasterize_binned(cache.triangles, options.scissor, cache.gbuffer, depth);
+    stats.pixelsShaded = shade_gbuffer(mesh, cache.triangles, cache.gbuffer, shader, image);
+    return stats;
+}
+
+// a fingerprint of what the shader sees of a face besides its triangles: its material and the normals and texture
+// coordinates of its corners
+static std::uint64_t face_key(const Mesh &mesh, const int f){
+    std::uint64_t h = mesh.material(f) + 2;
+    auto mix = [&](const float value){
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, 4);
+        h = (h ^ bits) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 29;
+    };
+    for (int k = 0; k < 3; k++){
+        const int n = mesh.has_normals() ? mesh.normalIndices[f * 3 + k] : -1;
+        if (n >= 0) mix(mesh.nx[n]), mix(mesh.ny[n]), mix(mesh.nz[n]);
+        else mix(-2);
+        const int uv = mesh.has_uvs() ? mesh.uvIndices[f * 3 + k] : -1;
+        if (uv >= 0) mix(mesh.u[uv]), mix(mesh.v[uv]);
+        else mix(-2);
+    }
+    return h;
+}
+
+static bool same_geometry(const ScreenTriangle &a, const ScreenTriangle &b){
+    for (int k = 0; k < 3; k++){
+        if (a.p[k][0] != b.p[k][0] || a.p[k][1] != b.p[k][1] || a.p[k][2] != b.p[k][2] || a.invW[k] != b.invW[k] ||
+            a.bary[k][0] != b.bary[k][0] || a.bary[k][1] != b.bary[k][1]) return false;
+    }
+    return true;
+}
+
+static bool same_material(const Material &a, const Material &b){
+    return a.diffuse[0] == b.diffuse[0] && a.diffuse[1] == b.diffuse[1] && a.diffuse[2] == b.diffuse[2] &&
+           a.diffuseMap == b.diffuseMap;
+}
+
+// clears the image to black and the depth buffer, as draw_incremental() draws frames
+static void clear_frame(TGAImage &image, DepthBuffer &depth){
+    std::memset(image.buffer(), 0, (size_t)image.width() * image.height() * image.bytespp());
+    depth.clear();
+}
+
+// multisampled frames are drawn whole: the samples of the frame are not kept
+static void begin_whole_frame(TGAImage &image, DepthBuffer &depth, FrameState &frame, IncrementalStats &incremental){
+    frame.invalidate();
+    clear_frame(image, depth);
+    incremental.tiles = incremental.dirtyTiles =
+        (image.width() + TILE_SIZE - 1) / TILE_SIZE * ((image.height() + TILE_SIZE - 1) / TILE_SIZE);
+    incremental.full = true;
+}
+
+// draw_incremental() without multisampling, color(i, x, y, l1, l2) giving the color of triangle i at pixel (x, y)
+static DrawStats draw_frame(const Mesh &mesh, const Mat4 &transform, const TGAColor *faceColors, const PixelShader &color,
+                            TGAImage &image, DepthBuffer &depth, DrawCache &cache, FrameState &frame,
+                            IncrementalStats &incremental, const DrawOptions &options){
+    const int width = image.width(), height = image.height(), nfaces = mesh.nfaces();
+    DrawStats stats = assemble_triangles(mesh, transform, faceColors, width, height, cache, options);
+    const std::vector<ScreenTriangle> &triangles = cache.triangles;
+    const int ntris = triangles.size();
+    const Rect clamped = {std::max(options.scissor.x0, 0), std::max(options.scissor.y0, 0),
+                          std::min(options.scissor.x1, width - 1), std::min(options.scissor.y1, height - 1)};
+    const int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE, tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    const int ntiles = tilesX * tilesY;
+
+    std::vector<std::uint64_t> keys(nfaces);
+    #pragma omp parallel for schedule(static)
+    for (int f = 0; f < nfaces; f++) keys[f] = face_key(mesh, f);
+
+    bool sameView = true;
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++) sameView &= frame.transform.m[i][j] == transform.m[i][j];
+    const Rect &before = frame.scissor;
+    const bool full = !frame.valid || !sameView || frame.width != width || frame.height != height ||
+                      frame.cull != options.cull || before.x0 != options.scissor.x0 || before.y0 != options.scissor.y0 ||
+                      before.x1 != options.scissor.x1 || before.y1 != options.scissor.y1 || frame.depth != &depth ||
+                      frame.depthGeneration != depth.generation();
+
+    // the tiles to draw again, and the triangles of the others to shade again; the pixels of the others get the
+    // numbers of their triangles in this frame
+    std::vector<char> dirty(ntiles, full), reshade(ntris, 0);
+    std::vector<int> remap(frame.triangles.size(), -1);
+    if (!full){
+        PROFILE_STAGE("frame diff");
+        std::vector<char> changed(mesh.materials.size(), 1);
+        for (size_t m = 0; m < std::min(mesh.materials.size(), frame.materials.size()); m++)
+            changed[m] = !same_material(frame.materials[m], mesh.materials[m]);
+        auto mark = [&](const ScreenTriangle &t){
+            int tx0, ty0, tx1, ty1;
+            if (!tile_range(t, clamped, 1, tx0, ty0, tx1, ty1)) return;
+            for (int ty = ty0; ty <= ty1; ty++)
+                for (int tx = tx0; tx <= tx1; tx++) dirty[tx + ty * tilesX] = 1;
+        };
+
+        // the triangles of both frames come in the order of their faces, so they are walked side by side, face by face
+        // (faces removed by the edit are past nfaces, and only found in the old frame)
+        const std::vector<ScreenTriangle> &old = frame.triangles;
+        const int nold = old.size();
+        int i = 0, j = 0;
+        while (i < nold || j < ntris){
+            const int face = std::min(i < nold ? old[i].face : INT_MAX, j < ntris ? triangles[j].face : INT_MAX);
+            int i1 = i, j1 = j;
+            while (i1 < nold && old[i1].face == face) i1++;
+            while (j1 < ntris && triangles[j1].face == face) j1++;
+            bool same = i1 - i == j1 - j;
+            for (int k = 0; same && k < i1 - i; k++) same = same_geometry(old[i + k], triangles[j + k]);
+            if (same){
+                const int m = mesh.material(face);
+                bool shading = frame.faceKeys[face] != keys[face] || (m >= 0 && changed[m]);
+                for (int k = 0; k < i1 - i; k++){
+                    const TGAColor &a = old[i + k].color, &b = triangles[j + k].color;
+                    shading |= std::memcmp(a.bgra, b.bgra, 4) != 0;
+                }
+                for (int k = 0; k < i1 - i; k++) remap[i + k] = j + k, reshade[j + k] = shading;
+            }
+            else {
+                for (int k = i; k < i1; k++) mark(old[k]);
+                for (int k = j; k < j1; k++) mark(triangles[k]);
+            }
+            i = i1, j = j1;
+        }
+    }
+    incremental.tiles = ntiles;
+    incremental.full = full;
+    incremental.dirtyTiles = std::count(dirty.begin(), dirty.end(), 1);
+
+    GBuffer &gbuffer = frame.gbuffer;
+    const int bpp = image.bytespp();
+    if (full){
+        clear_frame(image, depth);
+        gbuffer.reset(width, height);
+    }
+    else {
+        for (int t = 0; t < ntiles; t++){
+            if (!dirty[t]) continue;
+            const int x0 = t % tilesX * TILE_SIZE, y0 = t / tilesX * TILE_SIZE;
+            const int x1 = std::min(x0 + TILE_SIZE, width), y1 = std::min(y0 + TILE_SIZE, height);
+            for (int ty = y0 / DepthBuffer::TILE; ty * DepthBuffer::TILE < y1; ty++)
+                for (int tx = x0 / DepthBuffer::TILE; tx * DepthBuffer::TILE < x1; tx++) depth.clear_tile(tx, ty);
+            for (int y = y0; y < y1; y++){
+                std::fill(&gbuffer.triangle[x0 + y * width], &gbuffer.triangle[x1 + y * width], -1);
+                std::memset(image.pixel(x0, y), 0, (size_t)(x1 - x0) * bpp);
+            }
+        }
+    }
+    stats.pixelsWritten = rasterize_binned(triangles, options.scissor, gbuffer, depth, dirty);
+
+    // deferred shading of the tiles drawn again, and of the pixels of the others whose shading changed
+    long long shaded = 0, reshaded = 0;
+    {
+        PROFILE_STAGE("deferred shading");
+        #pragma omp parallel for schedule(dynamic, 16) reduction(+:shaded, reshaded)
+        for (int y = 0; y < height; y++){
+            for (int x = 0; x < width; x++){
+                const int p = x + y * width;
+                int &id = gbuffer.triangle[p];
+                if (id < 0) continue;
+                const bool drawn = dirty[x / TILE_SIZE + y / TILE_SIZE * tilesX];
+                if (!drawn){
+                    id = remap[id];
+                    if (!reshade[id]) continue;
+                    reshaded++;
+                }
+                const TGAColor c = color(id, x, y, gbuffer.l1[p], gbuffer.l2[p]);
+                std::memcpy(image.pixel(x, y), c.bgra, bpp);
+                shaded++;
+            }
+        }
+    }
+    stats.pixelsShaded = shaded;
+    incremental.reshaded = reshaded;
+
+    frame.valid = true;
+    frame.width = width, frame.height = height;
+    frame.transform = transform;
+    frame.cull = options.cull, frame.scissor = options.scissor;
+    frame.depth = &depth, frame.depthGeneration = depth.generation();
+    frame.triangles.swap(cache.triangles);
+    frame.faceKeys.swap(keys);
+    frame.materials = mesh.materials;
+    return stats;
+}
+
+DrawStats draw_incremental(const Mesh &mesh, const Mat4 &transform, const std::vector<TGAColor> &faceColors,
+                           TGAImage &image, DepthBuffer &depth, DrawCache &cache, FrameState &frame,
+                           IncrementalStats &incremental, const DrawOptions &options){
+    incremental = IncrementalStats();
+    if (options.samples > 1){
+        begin_whole_frame(image, depth, frame, incremental);
+        return draw(mesh, transform, faceColors, image, depth, cache, options);
+    }
+    return draw_frame(mesh, transform, faceColors.data(), [&](const int i, int, int, float, float){
+        return cache.triangles[i].color;
+    }, image, depth, cache, frame, incremental, options);
+}
+
+DrawStats draw_incremental(const Mesh &mesh, const Mat4 &transform, const FragmentShader &shader,
+                           TGAImage &image, DepthBuffer &depth, DrawCache &cache, FrameState &frame,
+                           IncrementalStats &incremental, const DrawOptions &options){
+    incremental = IncrementalStats();
+    if (options.samples > 1){
+        begin_whole_frame(image, depth, frame, incremental);
+        return draw(mesh, transform, shader, image, depth, cache, options);
+    }
+    return draw_frame(mesh, transform, nullptr, [&](const int i, const int x, const int y, const float l1, const float l2){
+        return shader(fragment(mesh, cache.triangles[i], x, y, l1, l2));
+    }, image, depth, cache, frame, incremental, options);
+}
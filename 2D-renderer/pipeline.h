@@ -0,0 +1,122 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "geometry.h"
+#include "gbuffer.h"
+#include "mesh.h"
+#include "msaa.h"
+#include "rasterizer.h"
+
+// which triangles are dropped depending on their winding on screen (counter-clockwise is front-facing)
+enum class CullMode { NONE, BACK, FRONT };
+
+// when the shader of draw() runs: on every pixel that passes the depth test (forward), or once per visible pixel
+// after all the triangles went through the depth test (deferred), which skips the pixels that get overdrawn
+enum class ShadingMode { FORWARD, DEFERRED };
+
+struct DrawOptions {
+    CullMode cull = CullMode::BACK;
+    Rect scissor = {0, 0, 1 << 30, 1 << 30}; // only pixels inside it are drawn, it is clamped to the image
+    ShadingMode shading = ShadingMode::DEFERRED;
+    // samples per pixel (1, 2, 4 or 8): with more than one, depth and coverage are resolved per sample and the
+    // shader runs once per pixel and triangle seen in it, whatever the shading mode
+    int samples = 1;
+};
+
+// the surface of a mesh seen at a pixel, with the vertex attributes interpolated (perspective correct) to it
+struct Fragment {
+    int x = 0, y = 0;
+    int face = -1;
+    float bary[3] = {1, 0, 0}; // barycentric coordinates of the pixel in the face
+    Vec3 normal;               // unit normal in model space: interpolated from the vertex normals, or the normal of the face
+    float u = 0, v = 0;        // texture coordinates, 0 if the mesh has none
+    float dudx = 0, dvdx = 0;  // how much they change from one pixel to the next along x,
+    float dudy = 0, dvdy = 0;  // and along y: the footprint of the pixel in the texture, for choosing a mipmap level
+};
+
+// the color of a fragment
+typedef std::function<TGAColor(const Fragment &)> FragmentShader;
+
+// what happened to the triangles of a draw call
+struct DrawStats {
+    long long faces = 0;          // triangles submitted
+    long long frustumCulled = 0;  // dropped with their whole cluster, which was outside the view volume
+    long long clipped = 0;        // entirely outside the view volume
+    long long backfaceCulled = 0; // facing the wrong way for the cull mode
+    long long degenerate = 0;     // no area left once on screen
+    long long rasterized = 0;     // triangles sent to the rasterizer, clipping can split a face in several
+    long long pixelsWritten = 0;  // pixels that passed the depth test, counted again every time they are overdrawn
+    long long pixelsShaded = 0;   // fragments that went through the shader
+};
+
+// adds up the stats of several draw calls
+void add(DrawStats &sum, const DrawStats &s);
+
+// true when the box, transformed to clip space, lies entirely outside one plane of the view volume
+bool box_outside(const float min[3], const float max[3], const Mat4 &transform);
+
+// buffers reused from one draw call to the next, so rendering many frames of a mesh allocates nothing
+struct DrawCache {
+    std::vector<Vec4> clip;                // post-transform cache: every mesh vertex in clip space
+    std::vector<Vec3> vertices;            // ... and in screen space (only meaningful for vertices with w > 0)
+    std::vector<std::uint16_t> outcodes;   // planes each vertex is outside of, of the view volume and of the guard band
+    std::vector<ScreenTriangle> triangles;
+    std::vector<std::vector<ScreenTriangle>> threadTriangles;
+    GBuffer gbuffer;                       // visibility of the deferred shading mode
+    SampleBuffer samples;                  // visibility with multisampling
+    std::vector<DepthPlane> planes;        // ... and the depth of its triangles
+};
+
+// draws a mesh: every vertex is transformed exactly once by 'transform' into clip space, where the view volume
+// is -w <= x, y, z <= w (greater z is closer), and then mapped to the pixels of the image with a depth in [0, 1]
+// between the vertex stage and the rasterizer, triangles go through primitive assembly: clusters of the mesh
+// outside the view volume are culled, triangles are culled by winding, clipped against the near and far planes
+// (and against a guard band around the viewport when they reach very far off-screen)
+// with multisampling, a pixel gets the average of its samples, and the depth of its closest sample
+// triangle f is filled with faceColors[f]
+DrawStats draw(const Mesh &mesh, const Mat4 &transform, const std::vector<TGAColor> &faceColors,
+               TGAImage &image, DepthBuffer &depth, DrawCache &cache, const DrawOptions &options = {});
+// same, but the pixels get the color the shader returns for them, in the shading mode of the options
+// (both modes give the same image, as long as the shader only depends on the fragment)
+DrawStats draw(const Mesh &mesh, const Mat4 &transform, const FragmentShader &shader,
+               TGAImage &image, DepthBuffer &depth, DrawCache &cache, const DrawOptions &options = {});
+
+// what draw_incremental() keeps of the frame it drew, so the next one only redraws what changed
+struct FrameState {
+    bool valid = false;
+    int width = 0, height = 0;
+    Mat4 transform;
+    CullMode cull = CullMode::BACK;
+    Rect scissor;
+    const DepthBuffer *depth = nullptr; // the depth buffer of the frame, as it was when it was drawn
+    std::uint64_t depthGeneration = 0;
+    std::vector<ScreenTriangle> triangles; // what was rasterized, in the order of their faces
+    std::vector<std::uint64_t> faceKeys;   // per face, see face_key() in pipeline.cpp
+    std::vector<Material> materials;
+    GBuffer gbuffer;                       // the triangle seen at every pixel
+
+    void invalidate() { valid = false; }
+};
+
+struct IncrementalStats {
+    int tiles = 0, dirtyTiles = 0; // the screen tiles, and the ones cleared and rasterized again
+    bool full = false;             // all of them were, the frame could not be reused
+    long long reshaded = 0;        // pixels of the other tiles shaded again, their face only changed its shading
+};
+
+// draws a whole frame of the mesh, as draw() would into a black image and a cleared depth buffer, but the image and
+// the depth buffer hold the previous frame, which 'frame' describes: only the tiles overlapped by a triangle that
+// changed (where it was or where it is now) are cleared and rasterized again, and the pixels of the other tiles
+// are only shaded again if their face changed its color, its material, or the normals or uvs of its corners
+// faces are told apart by their index, so edits should keep the numbering of the faces
+// the frame is drawn whole when it is empty, the image size, the transform or the options changed, or the depth
+// buffer was touched since; multisampled frames are always drawn whole, and leave the frame empty
+DrawStats draw_incremental(const Mesh &mesh, const Mat4 &transform, const std::vector<TGAColor> &faceColors,
+                           TGAImage &image, DepthBuffer &depth, DrawCache &cache, FrameState &frame,
+                           IncrementalStats &incremental, const DrawOptions &options = {});
+// same with a shader, which must only depend on the fragment and the material of its face
+DrawStats draw_incremental(const Mesh &mesh, const Mat4 &transform, const FragmentShader &shader,
+                           TGAImage &image, DepthBuffer &depth, DrawCache &cache, FrameState &frame,
+                           IncrementalStats &incremental, const DrawOptions &options = {});
@@ -0,0 +1,148 @@
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "profiler.h"
+
+namespace profiler {
+
+struct Event {
+    int stage;
+    std::int64_t start, end;
+};
+
+// what one thread has recorded
+struct ThreadData {
+    int thread;
+    std::vector<std::int64_t> stageTime, stageCalls, counters;
+    std::vector<Event> events;
+};
+
+static std::mutex lock;
+static std::vector<std::string> stageNames, counterNames;
+// owned here rather than by the threads, so the data of threads that have exited is still reported
+static std::vector<std::unique_ptr<ThreadData>> threads;
+static const auto startTime = std::chrono::steady_clock::now();
+
+static ThreadData &thread_data(){
+    static thread_local ThreadData *data = nullptr;
+    if (!data){
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(std::make_unique<ThreadData>());
+        data = threads.back().get();
+        data->thread = threads.size() - 1;
+    }
+    return *data;
+}
+
+// groups of counters are registered under the name of their first counter
+static int find_or_add(std::vector<std::string> &names, const char *name, const int size){
+    std::lock_guard<std::mutex> guard(lock);
+    const std::string key = size == 1 ? std::string(name) : std::string(name) + " 0";
+    for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == key) return i;
+    const int id = names.size();
+    if (size == 1) names.push_back(name);
+    else for (int i = 0; i < size; i++) names.push_back(std::string(name) + " " + std::to_string(i));
+    return id;
+}
+
+bool enabled(){
+#ifdef PROFILE
+    return true;
+#else
+    return false;
+#endif
+}
+
+int stage_id(const char *name){
+    return find_or_add(stageNames, name, 1);
+}
+
+int counter_id(const char *name, const int size){
+    return find_or_add(counterNames, name, size);
+}
+
+std::int64_t now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+void count(const int id, const std::int64_t n){
+    ThreadData &data = thread_data();
+    if ((int)data.counters.size() <= id) data.counters.resize(id + 1);
+    data.counters[id] += n;
+}
+
+void record(const int stage, const std::int64_t start, const std::int64_t end, const bool traced){
+    ThreadData &data = thread_data();
+    if ((int)data.stageTime.size() <= stage) data.stageTime.resize(stage + 1), data.stageCalls.resize(stage + 1);
+    data.stageTime[stage] += end - start;
+    data.stageCalls[stage]++;
+    if (traced) data.events.push_back({stage, start, end});
+}
+
+// names are plain identifiers and phrases, only quotes and backslashes would need escaping
+static std::string quoted(const std::string &s){
+    std::string out = "\"";
+    for (char c : s){
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static bool write_file(const std::string &filename, const std::string &contents){
+    std::ofstream out(filename);
+    if (!out.is_open()){
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out << contents;
+    if (!out.good()){
+        std::cerr << "can't write the profile\n";
+        return false;
+    }
+    return true;
+}
+
+bool write_json(const std::string &filename){
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<std::int64_t> time(stageNames.size()), calls(stageNames.size()), counters(counterNames.size());
+    for (const auto &data : threads){
+        for (size_t i = 0; i < data->stageTime.size(); i++) time[i] += data->stageTime[i], calls[i] += data->stageCalls[i];
+        for (size_t i = 0; i < data->counters.size(); i++) counters[i] += data->counters[i];
+    }
+
+    // stage times are summed over the threads, so stages running in parallel can add up to more than the wall time
+    std::string json = "{\n  \"wall seconds\": " + std::to_string(now() * 1e-9) + ",\n  \"threads\": " +
+                       std::to_string(threads.size()) + ",\n  \"stages\": {";
+    for (size_t i = 0; i < stageNames.size(); i++){
+        json += (i ? ",\n    " : "\n    ") + quoted(stageNames[i]) + ": {\"seconds\": " + std::to_string(time[i] * 1e-9) +
+                ", \"calls\": " + std::to_string(calls[i]) + "}";
+    }
+    json += "\n  },\n  \"counters\": {";
+    for (size_t i = 0; i < counterNames.size(); i++)
+        json += (i ? ",\n    " : "\n    ") + quoted(counterNames[i]) + ": " + std::to_string(counters[i]);
+    json += "\n  }\n}\n";
+    return write_file(filename, json);
+}
+
+bool write_chrome_trace(const std::string &filename){
+    std::lock_guard<std::mutex> guard(lock);
+    std::string json = "{\"traceEvents\": [";
+    bool first = true;
+    for (const auto &data : threads){
+        for (const Event &e : data->events){
+            json += first ? "\n  " : ",\n  ";
+            first = false;
+            json += "{\"name\": " + quoted(stageNames[e.stage]) + ", \"ph\": \"X\", \"pid\": 1, \"tid\": " + std::to_string(data->thread) +
+                    ", \"ts\": " + std::to_string(e.start / 1000.) + ", \"dur\": " + std::to_string((e.end - e.start) / 1000.) + "}";
+        }
+    }
+    json += "\n], \"displayTimeUnit\": \"ms\"}\n";
+    return write_file(filename, json);
+}
+
+}
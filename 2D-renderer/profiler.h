@@ -0,0 +1,71 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// lightweight instrumentation of the stages and hot paths of both renderers, compiled in only when PROFILE
+// is defined (make PROFILE=1), otherwise the macros below expand to nothing
+//   PROFILE_STAGE("name")       times the rest of the scope as a stage, and records it in the trace
+//   PROFILE_TIMER("name")       times the rest of the scope without tracing it, for code that runs very often
+//   PROFILE_COUNT("name", n)    adds n to a counter
+//   PROFILE_COUNT_AT("name", i, size, n) adds n to counter i of a group of size counters named "name i"
+// every thread keeps its own timings and counters, they are only added up when the report is written
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+#ifdef PROFILE
+#define PROFILE_STAGE(name) \
+    static const int PROFILE_CONCAT(profileId, __LINE__) = profiler::stage_id(name); \
+    profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileId, __LINE__), true)
+#define PROFILE_TIMER(name) \
+    static const int PROFILE_CONCAT(profileId, __LINE__) = profiler::stage_id(name); \
+    profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileId, __LINE__), false)
+#define PROFILE_COUNT(name, n) do { \
+        static const int profileId = profiler::counter_id(name); \
+        profiler::count(profileId, n); \
+    } while (0)
+#define PROFILE_COUNT_AT(name, i, size, n) do { \
+        static const int profileId = profiler::counter_id(name, size); \
+        profiler::count(profileId + (i), n); \
+    } while (0)
+#else
+#define PROFILE_STAGE(name) ((void)0)
+#define PROFILE_TIMER(name) ((void)0)
+// the values are still referenced, so variables only kept for counting do not trigger warnings (nor cost anything)
+#define PROFILE_COUNT(name, n) ((void)(n))
+#define PROFILE_COUNT_AT(name, i, size, n) ((void)(i), (void)(n))
+#endif
+
+namespace profiler {
+
+// true when the program was built with PROFILE
+bool enabled();
+
+// registers a stage or a group of counters by name (the same name always gives the same id)
+int stage_id(const char *name);
+int counter_id(const char *name, const int size = 1);
+
+void count(const int id, const std::int64_t n);
+void record(const int stage, const std::int64_t start, const std::int64_t end, const bool traced);
+
+// nanoseconds since the program started
+std::int64_t now();
+
+// times a scope
+class Scope {
+public:
+    Scope(const int stage, const bool traced) : stage(stage), traced(traced), start(now()) {}
+    ~Scope() { record(stage, start, now(), traced); }
+private:
+    int stage;
+    bool traced;
+    std::int64_t start;
+};
+
+// total time and number of calls of every stage (summed over the threads) and the value of every counter, as JSON
+bool write_json(const std::string &filename);
+// every traced stage as a complete event of the Chrome trace format (chrome://tracing or ui.perfetto.dev)
+bool write_chrome_trace(const std::string &filename);
+
+}
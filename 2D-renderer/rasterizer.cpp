@@ -0,0 +1,381 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <omp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "profiler.h"
+#include "rasterizer.h"
+
+// side (in pixels) of the square blocks that are tested against the triangle as a whole,
+// they match the blocks of the hierarchical z-buffer so a block can also be rejected by depth
+constexpr int BLOCK_SIZE = DepthBuffer::BLOCK;
+
+// a worker owns whole depth tiles, otherwise two threads could update the same tile of the pyramid
+static_assert(TILE_SIZE % DepthBuffer::TILE == 0, "screen tiles must be made of whole depth tiles");
+
+// twice the signed area of the triangle, positive when its vertices are in counter-clockwise order
+static long long doubled_area(const ScreenTriangle &t){
+    long long x0 = t.p[0][0], y0 = t.p[0][1], x1 = t.p[1][0], y1 = t.p[1][1], x2 = t.p[2][0], y2 = t.p[2][1];
+    return (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+}
+
+// coverage of one BLOCK_SIZE x BLOCK_SIZE block, bit (x + y * BLOCK_SIZE) is set when the pixel is inside all three edges
+// e holds the edge functions at the top-left pixel of the block, a and b their increments along x and y
+typedef std::uint64_t (*BlockCoverage)(const int e[3], const int a[3], const int b[3]);
+
+static std::uint64_t block_coverage_scalar(const int e[3], const int a[3], const int b[3]){
+    std::uint64_t mask = 0;
+    int row[3] = {e[0], e[1], e[2]};
+    for (int y = 0; y < BLOCK_SIZE; y++){
+        int w0 = row[0], w1 = row[1], w2 = row[2];
+        for (int x = 0; x < BLOCK_SIZE; x++){
+            if ((w0 | w1 | w2) >= 0) mask |= std::uint64_t(1) << (x + y * BLOCK_SIZE);
+            w0 += a[0], w1 += a[1], w2 += a[2];
+        }
+        row[0] += b[0], row[1] += b[1], row[2] += b[2];
+    }
+    return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// a pixel is covered when no edge function is negative, i.e. when the sign bit of (w0 | w1 | w2) is clear
+
+__attribute__((target("sse2")))
+static std::uint64_t block_coverage_sse2(const int e[3], const int a[3], const int b[3]){
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i lo[3], hi[3], step[3];
+    for (int i = 0; i < 3; i++){
+        __m128i da = _mm_set1_epi32(a[i]);
+        // no 32-bit multiply in SSE2, but 0..3 times a is just a couple of additions
+        __m128i offs = _mm_add_epi32(_mm_and_si128(_mm_cmpgt_epi32(lanes, _mm_setzero_si128()), da),
+                                     _mm_add_epi32(_mm_and_si128(_mm_cmpgt_epi32(lanes, _mm_set1_epi32(1)), da),
+                                                   _mm_and_si128(_mm_cmpgt_epi32(lanes, _mm_set1_epi32(2)), da)));
+        lo[i] = _mm_add_epi32(_mm_set1_epi32(e[i]), offs);
+        hi[i] = _mm_add_epi32(lo[i], _mm_slli_epi32(da, 2));
+        step[i] = _mm_set1_epi32(b[i]);
+    }
+    std::uint64_t mask = 0;
+    for (int y = 0; y < BLOCK_SIZE; y++){
+        __m128i l = _mm_or_si128(_mm_or_si128(lo[0], lo[1]), lo[2]);
+        __m128i h = _mm_or_si128(_mm_or_si128(hi[0], hi[1]), hi[2]);
+        unsigned bits = (~(_mm_movemask_ps(_mm_castsi128_ps(l)) | (_mm_movemask_ps(_mm_castsi128_ps(h)) << 4))) & 0xff;
+        mask |= std::uint64_t(bits) << (y * BLOCK_SIZE);
+        for (int i = 0; i < 3; i++){
+            lo[i] = _mm_add_epi32(lo[i], step[i]);
+            hi[i] = _mm_add_epi32(hi[i], step[i]);
+        }
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static std::uint64_t block_coverage_avx2(const int e[3], const int a[3], const int b[3]){
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i w[3], step[3];
+    for (int i = 0; i < 3; i++){
+        w[i] = _mm256_add_epi32(_mm256_set1_epi32(e[i]), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(a[i])));
+        step[i] = _mm256_set1_epi32(b[i]);
+    }
+    std::uint64_t mask = 0;
+    for (int y = 0; y < BLOCK_SIZE; y++){
+        __m256i any = _mm256_or_si256(_mm256_or_si256(w[0], w[1]), w[2]);
+        unsigned bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(any)) & 0xff;
+        mask |= std::uint64_t(bits) << (y * BLOCK_SIZE);
+        for (int i = 0; i < 3; i++) w[i] = _mm256_add_epi32(w[i], step[i]);
+    }
+    return mask;
+}
+#endif
+
+// picks the widest instruction set the cpu supports, RASTER_SIMD=scalar|sse2|avx2 overrides the choice
+static BlockCoverage pick_block_coverage(){
+    const char *forced = std::getenv("RASTER_SIMD");
+    std::string isa = forced ? forced : "";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((isa.empty() || isa == "avx2") && __builtin_cpu_supports("avx2")) return block_coverage_avx2;
+    if ((isa.empty() || isa == "avx2" || isa == "sse2") && __builtin_cpu_supports("sse2")) return block_coverage_sse2;
+#endif
+    return block_coverage_scalar;
+}
+
+static const BlockCoverage block_coverage = pick_block_coverage();
+
+// rasterizes the triangle and calls write(x, y, l1, l2) for every pixel passing the depth test, with its screen space
+// barycentric coordinates (which cost nothing to writers that do not use them), returns the number of pixels written
+template<typename Write>
+static long long rasterize(const ScreenTriangle &t, int x0, int y0, int x1, int y1, DepthBuffer &depth, Write write){
+    long long area = doubled_area(t);
+    if (area < 2) return 0; // degenerate or back-facing
+
+    long long vx[3], vy[3];
+    for (int i = 0; i < 3; i++) vx[i] = t.p[i][0], vy[i] = t.p[i][1];
+    int xmin = std::max<long long>(x0, std::min(std::min(vx[0], vx[1]), vx[2]));
+    int ymin = std::max<long long>(y0, std::min(std::min(vy[0], vy[1]), vy[2]));
+    int xmax = std::min<long long>(x1, std::max(std::max(vx[0], vx[1]), vx[2]));
+    int ymax = std::min<long long>(y1, std::max(std::max(vy[0], vy[1]), vy[2]));
+    if (xmin > xmax || ymin > ymax) return 0;
+
+    // the whole triangle is hidden if it is behind everything drawn so far in the depth tile
+    const double zminTri = std::min(std::min(t.p[0][2], t.p[1][2]), t.p[2][2]);
+    const double zmaxTri = std::max(std::max(t.p[0][2], t.p[1][2]), t.p[2][2]);
+    if (xmin / DepthBuffer::TILE == xmax / DepthBuffer::TILE && ymin / DepthBuffer::TILE == ymax / DepthBuffer::TILE &&
+        zmaxTri <= depth.tile_min(xmin / DepthBuffer::TILE, ymin / DepthBuffer::TILE)){
+        PROFILE_COUNT("triangles rejected by depth tile", 1);
+        return 0;
+    }
+    PROFILE_COUNT("triangles rasterized", 1);
+
+    // edge function i is twice the area of the triangle formed by the point and the edge opposite to vertex i,
+    // so dividing it by the total area gives the barycentric coordinate of that vertex:
+    //      w_i(x, y) = a_i * x + b_i * y + c_i
+    int a[3], b[3];
+    long long c[3];
+    for (int i = 0; i < 3; i++){
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        a[i] = vy[j] - vy[k];
+        b[i] = vx[k] - vx[j];
+        c[i] = vx[j] * vy[k] - vx[k] * vy[j];
+    }
+
+    // depth is a plane over the screen as well: z(x, y) = za * x + zb * y + zc
+    double za = (a[0] * t.p[0][2] + a[1] * t.p[1][2] + a[2] * t.p[2][2]) / area;
+    double zb = (b[0] * t.p[0][2] + b[1] * t.p[1][2] + b[2] * t.p[2][2]) / area;
+
+    // offsets from the top-left pixel of a block to the corner where each edge function is largest / smallest
+    long long maxCorner[3], minCorner[3];
+    for (int i = 0; i < 3; i++){
+        long long ax = (long long)a[i] * (BLOCK_SIZE - 1), by = (long long)b[i] * (BLOCK_SIZE - 1);
+        maxCorner[i] = std::max(ax, 0LL) + std::max(by, 0LL);
+        minCorner[i] = std::min(ax, 0LL) + std::min(by, 0LL);
+    }
+    // same thing for the depth plane
+    const double zmaxCorner = std::max(za, 0.) * (BLOCK_SIZE - 1) + std::max(zb, 0.) * (BLOCK_SIZE - 1);
+    const double zminCorner = std::min(za, 0.) * (BLOCK_SIZE - 1) + std::min(zb, 0.) * (BLOCK_SIZE - 1);
+
+    // walk the blocks overlapping the bounding box
+    const float invArea = 1.f / area;
+    const int bx0 = xmin - xmin % BLOCK_SIZE, by0 = ymin - ymin % BLOCK_SIZE;
+    long long depthRejected = 0, tested = 0, shaded = 0; // for the profile
+    for (int by = by0; by <= ymax; by += BLOCK_SIZE){
+        for (int bx = bx0; bx <= xmax; bx += BLOCK_SIZE){
+            long long e[3];
+            bool outside = false, inside = true;
+            for (int i = 0; i < 3; i++){
+                e[i] = a[i] * (long long)bx + b[i] * (long long)by + c[i];
+                outside |= e[i] + maxCorner[i] < 0;
+                inside &= e[i] + minCorner[i] >= 0;
+            }
+            if (outside) continue; // the whole block lies outside one of the edges
+
+            // skip the block if the triangle is behind all of it, and skip the depth reads if it is in front of all of it
+            double zblock = (e[0] * t.p[0][2] + e[1] * t.p[1][2] + e[2] * t.p[2][2]) / area;
+            // the depth of every pixel gets clamped to [zlo, zhi], which only absorbs rounding errors of the plane
+            // but guarantees the per-pixel depth test can never disagree with these per-block decisions
+            double zhi = std::min(zblock + zmaxCorner, zmaxTri);
+            double zlo = std::min(std::max(zblock + zminCorner, zminTri), zhi);
+            if (zhi <= depth.block_min(bx / BLOCK_SIZE, by / BLOCK_SIZE)){
+                depthRejected++;
+                continue;
+            }
+            const bool allVisible = float(zlo) > depth.block_max(bx / BLOCK_SIZE, by / BLOCK_SIZE);
+
+            // blocks straddling an edge are tested pixel by pixel, there the edge functions are small enough for 32 bits
+            std::uint64_t mask = ~std::uint64_t(0);
+            if (!inside){
+                int e32[3] = {(int)e[0], (int)e[1], (int)e[2]};
+                mask = block_coverage(e32, a, b);
+            }
+
+            bool written = false;
+            double zrow = zblock;
+            for (int y = by; y < by + BLOCK_SIZE; y++, zrow += zb){
+                if (y < ymin || y > ymax) continue;
+                unsigned bits = (mask >> ((y - by) * BLOCK_SIZE)) & 0xff;
+                float *drow = depth.row(y);
+                for (; bits; bits &= bits - 1){
+                    int x = bx + __builtin_ctz(bits);
+                    if (x < xmin || x > xmax) continue;
+                    tested++;
+
+                    float z = std::clamp(zrow + za * (x - bx), zlo, zhi);
+
+                    // if the pixel is behind something, dont paint it
+                    if (!allVisible && z <= drow[x]) continue;
+
+                    drow[x] = z;
+                    const long long ex = x - bx, ey = y - by;
+                    write(x, y, (e[1] + a[1] * ex + b[1] * ey) * invArea, (e[2] + a[2] * ex + b[2] * ey) * invArea);
+                    written = true;
+                    shaded++;
+                }
+            }
+            if (written) depth.update_block(bx / BLOCK_SIZE, by / BLOCK_SIZE);
+        }
+    }
+    PROFILE_COUNT("blocks rejected by depth", depthRejected);
+    PROFILE_COUNT("pixels tested", tested);
+    PROFILE_COUNT("pixels shaded", shaded);
+    return shaded;
+}
+
+long long rasterize_triangle(const ScreenTriangle &t, int x0, int y0, int x1, int y1, TGAImage &image, DepthBuffer &depth){
+    const int bpp = image.bytespp();
+    return rasterize(t, x0, y0, x1, y1, depth, [&](const int x, const int y, float, float){
+        std::memcpy(image.pixel(x, y), t.color.bgra, bpp);
+    });
+}
+
+bool tile_range(const ScreenTriangle &t, const Rect &scissor, const int subpixel, int &tx0, int &ty0, int &tx1, int &ty1){
+    // degenerate and back-facing triangles would be rejected by the rasterizer anyway
+    if (doubled_area(t) < 2) return false;
+
+    int xmin = std::floor(std::min(std::min(t.p[0][0], t.p[1][0]), t.p[2][0]) / subpixel);
+    int ymin = std::floor(std::min(std::min(t.p[0][1], t.p[1][1]), t.p[2][1]) / subpixel);
+    int xmax = std::floor(std::max(std::max(t.p[0][0], t.p[1][0]), t.p[2][0]) / subpixel);
+    int ymax = std::floor(std::max(std::max(t.p[0][1], t.p[1][1]), t.p[2][1]) / subpixel);
+    if (xmax < scissor.x0 || ymax < scissor.y0 || xmin > scissor.x1 || ymin > scissor.y1) return false;
+
+    tx0 = std::max(scissor.x0, xmin) / TILE_SIZE;
+    ty0 = std::max(scissor.y0, ymin) / TILE_SIZE;
+    tx1 = std::min(scissor.x1, xmax) / TILE_SIZE;
+    ty1 = std::min(scissor.y1, ymax) / TILE_SIZE;
+    return true;
+}
+
+void bin_triangles(const std::vector<ScreenTriangle> &triangles, int width, int height, const Rect &scissor, TileBins &bins,
+                   const int subpixel){
+    bins.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    bins.tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    const int ntiles = bins.tilesX * bins.tilesY;
+    const int ntris = triangles.size();
+
+    // every thread bins a contiguous chunk of triangles: first counting how many land in each tile,
+    // then writing them at offsets laid out tile by tile and chunk by chunk, so the order is deterministic
+    const int nchunks = omp_get_max_threads();
+    std::vector<int> counts((size_t)ntiles * nchunks, 0);
+
+    #pragma omp parallel num_threads(nchunks)
+    {
+        const int chunk = omp_get_thread_num();
+        const int begin = (long long)ntris * chunk / nchunks;
+        const int end = (long long)ntris * (chunk + 1) / nchunks;
+        int *count = &counts[(size_t)chunk * ntiles];
+
+        for (int i = begin; i < end; i++){
+            int tx0, ty0, tx1, ty1;
+            if (!tile_range(triangles[i], scissor, subpixel, tx0, ty0, tx1, ty1)) continue;
+            for (int ty = ty0; ty <= ty1; ty++)
+                for (int tx = tx0; tx <= tx1; tx++)
+                    count[tx + ty * bins.tilesX]++;
+        }
+
+        #pragma omp barrier
+        #pragma omp single
+        {
+            // turn the counts into write cursors
+            bins.offsets.assign(ntiles + 1, 0);
+            int total = 0;
+            for (int t = 0; t < ntiles; t++){
+                bins.offsets[t] = total;
+                for (int c = 0; c < nchunks; c++){
+                    int n = counts[(size_t)c * ntiles + t];
+                    counts[(size_t)c * ntiles + t] = total;
+                    total += n;
+                }
+            }
+            bins.offsets[ntiles] = total;
+            bins.faces.resize(total);
+        }
+
+        for (int i = begin; i < end; i++){
+            int tx0, ty0, tx1, ty1;
+            if (!tile_range(triangles[i], scissor, subpixel, tx0, ty0, tx1, ty1)) continue;
+            for (int ty = ty0; ty <= ty1; ty++)
+                for (int tx = tx0; tx <= tx1; tx++)
+                    bins.faces[count[tx + ty * bins.tilesX]++] = i;
+        }
+    }
+}
+
+// bins the triangles over a width x height screen and calls raster(i, x0, y0, x1, y1) for every triangle i
+// overlapping the tile [x0, x1] x [y0, y1], adding up what it returns; only the tiles set in 'only' if given
+template<typename Raster>
+static long long rasterize_tiles(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, const int width,
+                                 const int height, Raster raster, const std::vector<char> *only = nullptr){
+    Rect clamped = {std::max(scissor.x0, 0), std::max(scissor.y0, 0),
+                    std::min(scissor.x1, width - 1), std::min(scissor.y1, height - 1)};
+    if (clamped.x0 > clamped.x1 || clamped.y0 > clamped.y1) return 0;
+
+    PROFILE_STAGE("rasterization");
+    TileBins bins;
+    {
+        PROFILE_STAGE("binning");
+        bin_triangles(triangles, width, height, clamped, bins);
+    }
+    const int ntiles = bins.tilesX * bins.tilesY;
+
+    // tiles have very different amounts of work, so they are handed out dynamically
+    long long written = 0;
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:written)
+    for (int t = 0; t < ntiles; t++){
+        if (bins.offsets[t] == bins.offsets[t + 1] || (only && !(*only)[t])) continue;
+        PROFILE_STAGE("raster tile");
+        int x0 = std::max((t % bins.tilesX) * TILE_SIZE, clamped.x0);
+        int y0 = std::max((t / bins.tilesX) * TILE_SIZE, clamped.y0);
+        int x1 = std::min((t % bins.tilesX + 1) * TILE_SIZE - 1, clamped.x1);
+        int y1 = std::min((t / bins.tilesX + 1) * TILE_SIZE - 1, clamped.y1);
+
+        for (int i = bins.offsets[t]; i < bins.offsets[t + 1]; i++)
+            written += raster(bins.faces[i], x0, y0, x1, y1);
+    }
+    return written;
+}
+
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, TGAImage &image, DepthBuffer &depth){
+    return rasterize_tiles(triangles, scissor, image.width(), image.height(), [&](const int i, int x0, int y0, int x1, int y1){
+        return rasterize_triangle(triangles[i], x0, y0, x1, y1, image, depth);
+    });
+}
+
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, TGAImage &image, DepthBuffer &depth){
+    return rasterize_binned(triangles, {0, 0, image.width() - 1, image.height() - 1}, image, depth);
+}
+
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, TGAImage &image, DepthBuffer &depth,
+                           const PixelShader &shader){
+    const int bpp = image.bytespp();
+    return rasterize_tiles(triangles, scissor, image.width(), image.height(), [&](const int i, int x0, int y0, int x1, int y1){
+        return rasterize(triangles[i], x0, y0, x1, y1, depth, [&](const int x, const int y, const float l1, const float l2){
+            const TGAColor color = shader(i, x, y, l1, l2);
+            std::memcpy(image.pixel(x, y), color.bgra, bpp);
+        });
+    });
+}
+
+// rasterize_binned() into a G-buffer, of the tiles set in 'only' if given
+static long long rasterize_gbuffer(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, GBuffer &gbuffer,
+                                   DepthBuffer &depth, const std::vector<char> *only){
+    const int width = gbuffer.width();
+    return rasterize_tiles(triangles, scissor, width, gbuffer.height(), [&](const int i, int x0, int y0, int x1, int y1){
+        return rasterize(triangles[i], x0, y0, x1, y1, depth, [&](const int x, const int y, const float l1, const float l2){
+            const int p = x + y * width;
+            gbuffer.triangle[p] = i;
+            gbuffer.l1[p] = l1;
+            gbuffer.l2[p] = l2;
+        });
+    }, only);
+}
+
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, GBuffer &gbuffer, DepthBuffer &depth){
+    return rasterize_gbuffer(triangles, scissor, gbuffer, depth, nullptr);
+}
+
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, GBuffer &gbuffer, DepthBuffer &depth,
+                           const std::vector<char> &tiles){
+    return rasterize_gbuffer(triangles, scissor, gbuffer, depth, &tiles);
+}
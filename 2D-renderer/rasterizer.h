@@ -0,0 +1,68 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+#include "geometry.h"
+#include "tgaimage.h"
+#include "depthbuffer.h"
+#include "gbuffer.h"
+
+// side (in pixels) of the square screen tiles used for binning
+constexpr int TILE_SIZE = 64;
+
+// rectangle of pixels, bounds included
+struct Rect {
+    int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+};
+
+// a triangle that has already been projected to screen space
+struct ScreenTriangle {
+    Vec3 p[3];
+    TGAColor color;
+    int face = -1;                          // the mesh face it is (a part of)
+    float invW[3] = {1, 1, 1};              // 1 / w of the vertices in clip space, for perspective correct interpolation
+    float bary[3][2] = {{0, 0}, {1, 0}, {0, 1}}; // where the vertices are in the face: weights of its corners 1 and 2
+};
+
+// color of the pixel (x, y) of triangle number 'triangle', at the screen space barycentric coordinates
+// (1 - l1 - l2, l1, l2); called for every pixel that passes the depth test, so for hidden ones too
+typedef std::function<TGAColor(int triangle, int x, int y, float l1, float l2)> PixelShader;
+
+// for every screen tile, the indices of the triangles overlapping it (in submission order)
+struct TileBins {
+    int tilesX = 0, tilesY = 0;
+    std::vector<int> offsets; // triangles of tile t are faces[offsets[t]] .. faces[offsets[t+1]-1]
+    std::vector<int> faces;
+};
+
+// rasterizes a single triangle with its color, only touching the pixels inside the rectangle [x0, x1] x [y0, y1]
+// the bounding box is walked in 8x8 blocks: blocks outside an edge or behind the depth pyramid are skipped, blocks inside
+// all edges are filled without testing, and the rest get their coverage from SIMD edge functions
+// (set RASTER_SIMD=scalar|sse2|avx2 to force an ISA)
+// returns the number of pixels written
+long long rasterize_triangle(const ScreenTriangle &t, int x0, int y0, int x1, int y1, TGAImage &image, DepthBuffer &depth);
+
+// the range of tiles covered by the bounding box of a triangle (in 1/subpixel of a pixel) inside the scissor
+// rectangle, returns false if it draws nothing
+bool tile_range(const ScreenTriangle &t, const Rect &scissor, const int subpixel, int &tx0, int &ty0, int &tx1, int &ty1);
+
+// sorts the triangles into the TILE_SIZE x TILE_SIZE tiles of a width x height screen, leaving out
+// the parts of the screen outside the scissor rectangle; the vertices are in 1/subpixel of a pixel
+void bin_triangles(const std::vector<ScreenTriangle> &triangles, int width, int height, const Rect &scissor, TileBins &bins,
+                   const int subpixel = 1);
+
+// bins the triangles and rasterizes each tile on a single worker, so no two threads ever write the same pixel
+// the triangles of a tile are drawn in submission order, which keeps the result identical to a serial render
+// only the pixels inside the scissor rectangle are drawn, the whole image when it is left out
+// returns the number of pixels written, counting every time a pixel is overwritten
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, TGAImage &image, DepthBuffer &depth);
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, TGAImage &image, DepthBuffer &depth);
+// forward shading: the pixels get the color returned by the shader instead of the color of the triangle
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, TGAImage &image, DepthBuffer &depth,
+                           const PixelShader &shader);
+// visibility only: the pixels get the index of the triangle and their barycentric coordinates in the G-buffer,
+// which must be as large as the depth buffer
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, GBuffer &gbuffer, DepthBuffer &depth);
+// the same, but only into the tiles t (numbered row by row) with tiles[t] set, the others are left as they are
+long long rasterize_binned(const std::vector<ScreenTriangle> &triangles, const Rect &scissor, GBuffer &gbuffer, DepthBuffer &depth,
+                           const std::vector<char> &tiles);
@@ -1,11 +1,21 @@
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <string>
 #include <vector>
-#include <cassert>
 
 #include "tgaimage.h"
+#include "batch.h"
+#include "geometry.h"
+#include "depthbuffer.h"
+#include "lod.h"
+#include "rasterizer.h"
+#include "mesh.h"
+#include "objloader.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "streaming.h"
+#include "texture.h"
 #include "cmath"
 
 constexpr TGAColor white = {255, 255, 255, 255};
@@ -17,38 +27,6 @@ int width = 1300;
 int height = 1300;
 
 
-template<int n> class Vec {
-    double coords[n] = {0};
-public:
-    Vec() = default;
-
-    Vec(std::initializer_list<double> list){
-        assert(list.size() <= n);
-        std::copy(list.begin(), list.end(), coords);
-    }
-
-    template<typename Tuple, std::size_t... Is>
-    Vec(const Tuple& t, std::index_sequence<Is...>){
-        ((coords[Is] = std::get<Is>(t)), ...);
-    }
-
-    template<typename Tuple>
-    Vec(const Tuple t) : Vec(t, std::make_index_sequence<std::tuple_size<Tuple>::value>{}) {}
-
-
-    double &operator[](const int i){
-        assert (i >= 0 && i < n);
-        return coords[i];
-    }
-
-    double operator[](const int i) const{
-        assert (i >= 0 && i < n);
-        return coords[i];
-    }
-};
-
-typedef Vec<3> Vec3;
-
 // this function implements the Bresenham's line drawing algorithm
 void line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color){
     // parameterization of the segment [A, B] where A = (x0, y0), B = (x1, y1):
@@ -82,99 +60,330 @@ void line(int x0, int y0, int x1, int y1, TGAImage &image, TGAColor color){
     }
 }
 
-double signed_triangle_area(int x0, int y0, int x1, int y1, int x2, int y2){
-    return ((y1 - y0) * (x1 + x0) + (y2 - y1) * (x2 + x1) + (y0 - y2) * (x0 + x2)) / 2;
+// draws a single triangle straight into the image, see rasterize_binned() for drawing many at once
+void triangle(Vec3 p1, Vec3 p2, Vec3 p3, TGAImage &image, DepthBuffer &zbuffer, TGAColor color){
+    rasterize_triangle({{p1, p2, p3}, color}, 0, 0, image.width() - 1, image.height() - 1, image, zbuffer);
 }
 
-void triangle(Vec3 p1, Vec3 p2, Vec3 p3, TGAImage &image, TGAImage &zbuffer, TGAColor color){
-    int xmin = std::min(std::min(p1[0], p2[0]), p3[0]);
-    int ymin = std::min(std::min(p1[1], p2[1]), p3[1]);
-    int xmax = std::max(std::max(p1[0], p2[0]), p3[0]);
-    int ymax = std::max(std::max(p1[1], p2[1]), p3[1]);
-    double total_area = signed_triangle_area(p1[0], p1[1], p2[0], p2[1], p3[0], p3[1]);
-    if (total_area < 1) return;
+// what to render and how, as given on the command line
+struct Settings {
+    std::string objFilename;
+    bool dumpZbuffer = false;
+    bool useCache = false;
+    bool printStats = false;
+    bool flat = false; // random face colors instead of lighting
+    float lodPixels = 0; // with levels of detail, the largest error allowed on screen (in pixels)
+    std::uint64_t streamBudget = 0; // when streaming the mesh from its chunk file, the bytes of it allowed in memory
+    std::string textureFile; // texture of the faces whose material has none
+    std::string profileFile, traceFile; // with a PROFILE build, where the profile and the chrome trace are written
+    // batch mode: the views come from a rotation sweep or from a file of transforms, and are written to files named
+    // after the pattern
+    int turntable = 0;
+    std::string viewsFile;
+    std::string outputPattern = "view_###.tga";
+    DrawOptions draw;
+};
 
-    // each pixel is drawn separately so we can take advantage of parallelism
-    #pragma omp parallel for
-    for (int x = xmin; x <= xmax; x++){
-        for (int y = ymin; y <= ymax; y++){
-            // these are the barycentric coordinates of the point (x, y)
-            double alpha = signed_triangle_area(x, y, p2[0], p2[1], p3[0], p3[1]) / total_area;
-            double beta = signed_triangle_area(x, y, p3[0], p3[1], p1[0], p1[1]) / total_area;
-            double gamma = signed_triangle_area(x, y, p1[0], p1[1], p2[0], p2[1]) / total_area;
+// the direction of the mesh that the transform turns towards the viewer (0, 0, 1): it is perpendicular to the
+// directions that end up along x and y, which the first two rows of the matrix measure
+static Vec3 view_axis(const Mat4 &transform){
+    const auto &m = transform.m;
+    double axis[3] = {m[0][1] * m[1][2] - m[0][2] * m[1][1],
+                      m[0][2] * m[1][0] - m[0][0] * m[1][2],
+                      m[0][0] * m[1][1] - m[0][1] * m[1][0]};
+    const double facing = axis[0] * m[2][0] + axis[1] * m[2][1] + axis[2] * m[2][2];
+    const double length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]) * (facing < 0 ? -1 : 1);
+    if (length == 0) return {0, 0, 1};
+    return {axis[0] / length, axis[1] / length, axis[2] / length};
+}
 
-            // check if the point falls outside the triangle
-            if (alpha < 0 || beta < 0 || gamma < 0) continue;
+// diffuse lighting by a directional light shining from the viewer (light is its direction in model space),
+// with a little ambient light
+static TGAColor lambert(const Fragment &frag, const Vec3 &light){
+    const double diffuse = std::max(0., frag.normal[0] * light[0] + frag.normal[1] * light[1] + frag.normal[2] * light[2]);
+    const std::uint8_t level = std::min(255., 20 + 235 * diffuse);
+    TGAColor color = {level, level, level, 255};
+    return color;
+}
 
-            unsigned char z = alpha * p1[2] + beta * p2[2] + gamma * p3[2];
+// the lighting, times the diffuse color of the material and its texture (or the default texture), sampled with
+// trilinear filtering
+static TGAColor textured(const Fragment &frag, const Vec3 &light, const Material *material, const Texture *texture){
+    TGAColor color = lambert(frag, light);
+    if (!material && !texture) return color;
+    TexColor texel = {1, 1, 1, 1};
+    if (texture) texel = texture->sample(frag.u, frag.v, texture->lod(frag.dudx, frag.dvdx, frag.dudy, frag.dvdy));
+    const float rgb[3] = {texel.r, texel.g, texel.b};
+    for (int c = 0; c < 3; c++)
+        color[2 - c] = color[2 - c] * rgb[c] * (material ? material->diffuse[c] : 1.f);
+    return color;
+}
 
-            // if the pixel is behind something, dont paint it
-            if (z <= zbuffer.get(x, y)[0]) continue;
+// a loaded mesh and what it is drawn with: random face colors, or the lighting and the textures of its materials
+struct Model {
+    Mesh mesh;
+    MeshLODs lods;
+    std::vector<TGAColor> colors;
+    std::vector<std::vector<TGAColor>> lodColors; // the colors of the faces of every level of detail
+    TextureCache textures;
+    const Texture *fallback = nullptr;
+    std::vector<const Texture *> maps; // per material
+};
 
-            zbuffer.set(x, y, {z});
-            image.set(x, y, color);
+bool loadModel(const Settings &settings, Model &model){
+    Mesh &mesh = model.mesh;
+    if (!load_obj(settings.objFilename, mesh, settings.useCache)) return false;
+    if (settings.lodPixels > 0 && !load_lods(settings.objFilename, mesh, model.lods, settings.useCache)) return false;
+    if (settings.flat){
+        // render triangles with random colors, a simplified face gets the color of the face it comes from
+        model.colors.resize(mesh.nfaces());
+        for (TGAColor &color : model.colors)
+            for (int c = 0; c < 3; c++) color[c] = std::rand() % 255;
+        for (const LODLevel &level : model.lods.levels){
+            model.lodColors.emplace_back(level.sourceFaces.size());
+            for (size_t f = 0; f < level.sourceFaces.size(); f++) model.lodColors.back()[f] = model.colors[level.sourceFaces[f]];
         }
+        return true;
     }
+    // textures are looked up once per material, not per pixel
+    model.fallback = settings.textureFile.empty() ? nullptr : model.textures.get(settings.textureFile);
+    model.maps.assign(mesh.materials.size(), model.fallback);
+    for (size_t m = 0; m < mesh.materials.size(); m++)
+        if (!mesh.materials[m].diffuseMap.empty()) model.maps[m] = model.textures.get(mesh.materials[m].diffuseMap);
+    return true;
 }
 
-std::tuple<int, int, int> projection(Vec3 p){
-    return {(p[0] + 1.) * width/2, 
-            (p[1] + 1.) * height/2, 
-            (p[2] + 1.) * 255/2};
-}
-
-void renderModel(std::string filename, TGAImage &image, TGAImage &zbuffer){
-    std::ifstream objFile;
-    std::string fline;
-    std::vector<Vec3> points;
-    
-    objFile.open(filename);
-    while (std::getline(objFile, fline)){
-        std::istringstream iss(fline);
-        std::vector<std::string> components;
-        std::string token;
-
-        // split line by whitespace
-        while (iss >> token){
-            std::istringstream tokenStream(token);
-            std::string component;
-            
-            std::getline(tokenStream, component, '/');
-            components.push_back(component);
-        }
+// the lighting and textures of the model, for one of its meshes
+FragmentShader modelShader(const Model &model, const Mesh &mesh, const Vec3 &light){
+    return [&model, &mesh, light](const Fragment &frag){
+        const int m = mesh.material(frag.face);
+        return m < 0 ? textured(frag, light, nullptr, model.fallback)
+                     : textured(frag, light, &mesh.materials[m], model.maps[m]);
+    };
+}
 
-        if (!components.size()) continue;
+// the level of detail the model is drawn at with the transform, -1 for the full mesh
+int modelLOD(const Settings &settings, const Model &model, const Mat4 &transform, const TGAImage &image){
+    return select_lod(model.lods, transform, image.width(), image.height(), settings.lodPixels);
+}
+
+DrawStats drawModel(const Settings &settings, const Model &model, const Mat4 &transform, TGAImage &image,
+                    DepthBuffer &zbuffer, DrawCache &cache){
+    const int lod = modelLOD(settings, model, transform, image);
+    const Mesh &mesh = lod < 0 ? model.mesh : model.lods.levels[lod].mesh;
+    if (settings.flat)
+        return draw(mesh, transform, lod < 0 ? model.colors : model.lodColors[lod], image, zbuffer, cache, settings.draw);
+    return draw(mesh, transform, modelShader(model, mesh, view_axis(transform)), image, zbuffer, cache, settings.draw);
+}
 
-        if (components[0] == "v") { // parse a point
-            Vec3 point = {stof(components[1]), stof(components[2]), stof(components[3])};
-            points.push_back(point);
-        } else if (components[0] == "f") { // parse a face (3 vertices)
-            Vec3 p1 = projection(points[stoi(components[1]) - 1]);
-            Vec3 p2 = projection(points[stoi(components[2]) - 1]);
-            Vec3 p3 = projection(points[stoi(components[3]) - 1]);
+void printStats(const DrawStats &stats){
+    std::cerr << "faces: " << stats.faces << "\n"
+              << "frustum culled: " << stats.frustumCulled << "\n"
+              << "clipped away: " << stats.clipped << "\n"
+              << "backface culled: " << stats.backfaceCulled << "\n"
+              << "degenerate: " << stats.degenerate << "\n"
+              << "rasterized: " << stats.rasterized << "\n"
+              << "pixels written: " << stats.pixelsWritten << "\n"
+              << "pixels shaded: " << stats.pixelsShaded << "\n";
+}
+
+// renders every view of the batch, the mesh is loaded once for all of them
+bool renderBatch(const Settings &settings, const std::vector<View> &views){
+    Model model;
+    if (!loadModel(settings, model)) return false;
+    auto start = std::chrono::steady_clock::now();
+    const BatchStats stats = render_batch(views, width, height, [&](const Mat4 &transform, Framebuffer &framebuffer){
+        return drawModel(settings, model, transform, framebuffer.image, framebuffer.depth, framebuffer.cache);
+    });
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << stats.views << " views rendered in " << seconds << " s" << std::endl;
+    if (settings.printStats) printStats(stats.draw);
+    return stats.failed == 0;
+}
 
-            // render triangles with random colors
-            TGAColor randColor;
-            for (int c = 0; c < 3; c++) randColor[c] = std::rand() % 255;
-            triangle(p1, p2, p3, image, zbuffer, randColor);
+// writes the image to output.tga (and the depth buffer to zbuffer.tga if asked to)
+void writeOutput(const Settings &settings, TGAImage &image, const DepthBuffer &zbuffer){
+    {
+        PROFILE_STAGE("tga write");
+        image.write_tga_file("output.tga");
+    }
+    // the depth buffer is only dumped for debugging
+    if (settings.dumpZbuffer) zbuffer.write_tga_file("zbuffer.tga");
+}
+
+// renders the single view of the mesh to output.tga, reading it chunk by chunk from its chunk file with at most
+// settings.streamBudget bytes of it in memory (the materials of the .obj are not kept in chunks)
+bool renderStreamed(const Settings &settings){
+    ChunkedMesh chunked;
+    if (!open_chunked_obj(settings.objFilename, chunked)) return false;
+    TGAImage image(width, height, TGAImage::RGB);
+    DepthBuffer zbuffer(width, height);
+    DrawCache cache;
+    TextureCache textures;
+    const Texture *texture = settings.textureFile.empty() ? nullptr : textures.get(settings.textureFile);
+    const Vec3 light = view_axis(Mat4());
+    std::vector<TGAColor> colors;
+    DrawStats stats;
+    StreamStats streamStats;
+    const bool ok = draw_streamed(chunked, Mat4(), settings.streamBudget, [&](const Mesh &mesh, int){
+        if (settings.flat){
+            colors.resize(mesh.nfaces());
+            for (TGAColor &color : colors)
+                for (int c = 0; c < 3; c++) color[c] = std::rand() % 255;
+            add(stats, draw(mesh, Mat4(), colors, image, zbuffer, cache, settings.draw));
+            return;
         }
+        auto shader = [&](const Fragment &frag){ return textured(frag, light, nullptr, texture); };
+        add(stats, draw(mesh, Mat4(), shader, image, zbuffer, cache, settings.draw));
+    }, streamStats);
+    if (!ok) return false;
+    if (settings.printStats){
+        std::cerr << "chunks: " << streamStats.chunks << ", culled " << streamStats.culled << ", "
+                  << streamStats.bytesRead / 1e6 << " MB read, at most " << streamStats.peakResident / 1e6
+                  << " MB in memory\n";
+        printStats(stats);
     }
-    objFile.close();
+    writeOutput(settings, image, zbuffer);
+    return true;
 }
 
-int main(int argc, char const *argv[]){
-	TGAImage image(width, height, TGAImage::RGB);
-    TGAImage zbuffer(width, height, TGAImage::GRAYSCALE);
+// renders the single view of the mesh to output.tga
+bool renderModel(const Settings &settings){
+    Model model;
+    if (!loadModel(settings, model)) return false;
+    TGAImage image(width, height, TGAImage::RGB);
+    DepthBuffer zbuffer(width, height);
+    DrawCache cache;
+    const DrawStats stats = drawModel(settings, model, Mat4(), image, zbuffer, cache);
+    if (settings.printStats){
+        const int lod = modelLOD(settings, model, Mat4(), image);
+        if (lod >= 0) std::cerr << "level of detail " << lod + 1 << " of " << model.lods.levels.size() << ", error "
+                                << model.lods.levels[lod].error << "\n";
+        printStats(stats);
+    }
+    writeOutput(settings, image, zbuffer);
+    return true;
+}
 
-    if (argc != 2){
-        std::cout << "Usage: " << argv[0] << " objmodel.obj" << std::endl;
+// renders the mesh to output.tga, then every edit of it (an .obj with the same faces, some of them moved or shaded
+// differently) to output_1.tga, output_2.tga...: the frame is kept from one to the next, so an edit only redraws
+// what changed
+bool renderEdits(const Settings &settings, const std::vector<std::string> &edits){
+    TGAImage image(width, height, TGAImage::RGB);
+    DepthBuffer zbuffer(width, height);
+    DrawCache cache;
+    FrameState frame;
+    std::vector<TGAColor> colors;
+    for (size_t k = 0; k <= edits.size(); k++){
+        Settings current = settings;
+        if (k > 0) current.objFilename = edits[k - 1];
+        Model model;
+        if (!loadModel(current, model)) return false;
+        // the faces keep their random colors from one edit to the next
+        if (settings.flat){
+            for (size_t f = 0; f < std::min(colors.size(), model.colors.size()); f++) model.colors[f] = colors[f];
+            colors = model.colors;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        IncrementalStats incremental;
+        const DrawStats stats = settings.flat
+            ? draw_incremental(model.mesh, Mat4(), model.colors, image, zbuffer, cache, frame, incremental, settings.draw)
+            : draw_incremental(model.mesh, Mat4(), modelShader(model, model.mesh, view_axis(Mat4())), image, zbuffer, cache,
+                               frame, incremental, settings.draw);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << current.objFilename << ": " << incremental.dirtyTiles << " of " << incremental.tiles
+                  << " tiles redrawn, " << incremental.reshaded << " pixels shaded again, in " << seconds * 1e3
+                  << " ms" << std::endl;
+        if (settings.printStats) printStats(stats);
+
+        const std::string filename = k == 0 ? "output.tga" : view_filename("output.tga", k);
+        PROFILE_STAGE("tga write");
+        if (!image.write_tga_file(filename)) return false;
+    }
+    if (settings.dumpZbuffer) zbuffer.write_tga_file("zbuffer.tga");
+    return true;
+}
+
+int main(int argc, char const *argv[]){
+    Settings settings;
+    std::vector<std::string> edits;
+    bool badOption = false;
+
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--zbuffer") settings.dumpZbuffer = true;
+        else if (arg == "--cache") settings.useCache = true;
+        else if (arg == "--stats") settings.printStats = true;
+        else if (arg == "--profile" && i + 1 < argc) settings.profileFile = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc) settings.traceFile = argv[++i];
+        else if (arg == "--texture" && i + 1 < argc) settings.textureFile = argv[++i];
+        else if (arg == "--turntable" && i + 1 < argc) settings.turntable = std::max(1, atoi(argv[++i]));
+        else if (arg == "--views" && i + 1 < argc) settings.viewsFile = argv[++i];
+        else if (arg == "--output-pattern" && i + 1 < argc) settings.outputPattern = argv[++i];
+        else if (arg == "--lod" && i + 1 < argc) settings.lodPixels = atof(argv[++i]);
+        else if (arg == "--stream" && i + 1 < argc) settings.streamBudget = std::max(1., atof(argv[++i]) * 1e6);
+        else if (arg == "--edit" && i + 1 < argc) edits.push_back(argv[++i]);
+        else if (arg == "--msaa" && i + 1 < argc) settings.draw.samples = supported_samples(atoi(argv[++i]));
+        else if (arg == "--size" && i + 2 < argc){
+            width = std::max(1, atoi(argv[++i]));
+            height = std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--shading" && i + 1 < argc){
+            std::string mode = argv[++i];
+            if (mode != "deferred" && mode != "forward" && mode != "flat"){
+                std::cerr << "unknown shading mode " << mode << "\n";
+                badOption = true;
+            }
+            settings.flat = mode == "flat";
+            settings.draw.shading = mode == "forward" ? ShadingMode::FORWARD : ShadingMode::DEFERRED;
+        }
+        else if (arg == "--cull" && i + 1 < argc){
+            std::string mode = argv[++i];
+            if (mode != "back" && mode != "front" && mode != "none"){
+                std::cerr << "unknown cull mode " << mode << "\n";
+                badOption = true;
+            }
+            settings.draw.cull = mode == "none" ? CullMode::NONE : mode == "front" ? CullMode::FRONT : CullMode::BACK;
+        }
+        else settings.objFilename = arg;
+    }
+    if (settings.objFilename.empty() || badOption){
+        std::cout << "Usage: " << argv[0] << " objmodel.obj [--zbuffer] [--cache] [--stats] [--cull back|front|none]"
+                     " [--shading deferred|forward|flat] [--texture texture.tga]"
+                     " [--turntable n | --views views.txt] [--output-pattern view_###.tga] [--size width height]"
+                     " [--lod pixels] [--msaa 2|4|8] [--stream megabytes] [--edit edited.obj]..."
+                     " [--profile profile.json] [--trace trace.json]" << std::endl;
         return 1;
     }
 
-    renderModel(argv[1], image, zbuffer);
-    image.write_tga_file("output.tga");
-    zbuffer.write_tga_file("zbuffer.tga");
-    return 0;
-}
+    if ((!settings.profileFile.empty() || !settings.traceFile.empty()) && !profiler::enabled())
+        std::cerr << "built without profiling, rebuild with make PROFILE=1\n";
 
+    if (!edits.empty()){
+        if (settings.streamBudget || settings.turntable || !settings.viewsFile.empty() || settings.lodPixels > 0){
+            std::cerr << "--edit renders a single view of the full mesh, without --stream, --turntable, --views or --lod\n";
+            return 1;
+        }
+        if (!renderEdits(settings, edits)) return 1;
+    }
+    else if (settings.streamBudget){
+        if (settings.turntable || !settings.viewsFile.empty() || settings.lodPixels > 0){
+            std::cerr << "--stream renders a single view of the full mesh, without --turntable, --views or --lod\n";
+            return 1;
+        }
+        if (!renderStreamed(settings)) return 1;
+    }
+    else if (settings.turntable || !settings.viewsFile.empty()){
+        std::vector<View> views = turntable_views(settings.turntable, settings.outputPattern);
+        if (!settings.viewsFile.empty() && !read_views(settings.viewsFile, settings.outputPattern, views)) return 1;
+        if (!renderBatch(settings, views)) return 1;
+    }
+    else if (!renderModel(settings)) return 1;
 
+    if (profiler::enabled()){
+        if (!settings.profileFile.empty() && !profiler::write_json(settings.profileFile)) return 1;
+        if (!settings.traceFile.empty() && !profiler::write_chrome_trace(settings.traceFile)) return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "objloader.h"
+#include "pipeline.h"
+#include "profiler.h"
+#include "streaming.h"
+
+// bump whenever the layout of the chunk file changes
+constexpr std::uint32_t CHUNK_FILE_VERSION = 1;
+// chunks start on a page boundary
+constexpr std::uint64_t CHUNK_ALIGNMENT = 4096;
+// bits per axis of the Morton codes of the face centroids, and how many of them pick the bucket chunks are cut along
+constexpr int MORTON_BITS = 10;
+constexpr int BUCKET_BITS = 7;
+
+struct ChunkFileHeader {
+    char magic[4] = {'C', 'H', 'N', 'K'};
+    std::uint32_t version = CHUNK_FILE_VERSION;
+    std::uint64_t sourceSize = 0;
+    std::int64_t  sourceMtime = 0;
+    std::uint64_t nfaces = 0;
+    std::uint32_t nchunks = 0; // followed by their ChunkInfo
+};
+
+static std::int64_t mtime_ns(const struct stat &st){
+    return std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static std::uint64_t align(const std::uint64_t offset){
+    return (offset + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+}
+
+static bool read_at(const int fd, void *data, const std::uint64_t bytes, std::uint64_t &offset){
+    char *p = static_cast<char *>(data);
+    for (std::uint64_t done = 0; done < bytes;){
+        const ssize_t n = pread(fd, p + done, bytes - done, offset + done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    offset += bytes;
+    return true;
+}
+
+static bool write_at(const int fd, const void *data, const std::uint64_t bytes, std::uint64_t &offset){
+    const char *p = static_cast<const char *>(data);
+    for (std::uint64_t done = 0; done < bytes;){
+        const ssize_t n = pwrite(fd, p + done, bytes - done, offset + done);
+        if (n <= 0) return false;
+        done += n;
+    }
+    offset += bytes;
+    return true;
+}
+
+// the arrays of a chunk in the order they are stored, with their sizes
+template<typename MeshT, typename Visit>
+static void chunk_arrays(MeshT &mesh, const ChunkInfo &info, Visit visit){
+    for (auto *v : {&mesh.x, &mesh.y, &mesh.z}) visit(*v, info.nverts);
+    for (auto *v : {&mesh.nx, &mesh.ny, &mesh.nz}) visit(*v, info.nnormals);
+    for (auto *v : {&mesh.u, &mesh.v}) visit(*v, info.nuvs);
+    visit(mesh.indices, info.nfaces * 3);
+    visit(mesh.normalIndices, info.hasNormalIndices ? info.nfaces * 3 : 0);
+    visit(mesh.uvIndices, info.hasUVIndices ? info.nfaces * 3 : 0);
+    visit(mesh.clusters, info.nclusters);
+}
+
+ChunkedMesh::~ChunkedMesh(){
+    if (fd >= 0) close(fd);
+}
+
+bool ChunkedMesh::open(const std::string &path){
+    if (fd >= 0) close(fd);
+    chunks.clear();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    ChunkFileHeader header, expected;
+    std::uint64_t offset = 0;
+    if (!read_at(fd, &header, sizeof(header), offset) || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) ||
+        header.version != CHUNK_FILE_VERSION) return false;
+    faces = header.nfaces;
+    sourceSize = header.sourceSize;
+    sourceMtime = header.sourceMtime;
+
+    // the counts come from the file: a damaged one must not make us allocate (or read) past its end
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+    const std::uint64_t size = st.st_size;
+    if (header.nchunks > (size - offset) / sizeof(ChunkInfo)) return false;
+    chunks.resize(header.nchunks);
+    if (!read_at(fd, chunks.data(), chunks.size() * sizeof(ChunkInfo), offset)) return false;
+    const Mesh empty;
+    for (const ChunkInfo &info : chunks){
+        std::uint64_t bytes = 0;
+        chunk_arrays(empty, info, [&](const auto &v, const std::uint64_t n){ bytes += n * sizeof(v[0]); });
+        if (bytes != info.bytes || info.offset > size || bytes > size - info.offset) return false;
+    }
+    return true;
+}
+
+bool ChunkedMesh::load(const int i, Mesh &mesh) const {
+    PROFILE_STAGE("chunk read");
+    const ChunkInfo &info = chunks[i];
+    mesh = Mesh();
+    std::uint64_t offset = info.offset;
+    bool ok = true;
+    chunk_arrays(mesh, info, [&](auto &v, const std::uint64_t n){
+        v.resize(n);
+        ok = ok && read_at(fd, v.data(), n * sizeof(v[0]), offset);
+    });
+    if (!ok){
+        std::cerr << "can't read chunk " << i << " of the mesh\n";
+        return false;
+    }
+    // the indices and clusters are drawn as they are, so a damaged file must not make them point outside the chunk
+    if (!valid_mesh(mesh)){
+        std::cerr << "chunk " << i << " of the mesh is damaged\n";
+        return false;
+    }
+    return true;
+}
+
+// a file next to the output that is unlinked as soon as it is created, so it is gone whatever happens; it is
+// written in order through a buffer, and read back through a map whose pages can be let go after use
+class TempFile {
+public:
+    explicit TempFile(const std::string &path){
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd >= 0) unlink(path.c_str());
+        failed = fd < 0;
+    }
+    ~TempFile(){
+        if (mapping) munmap(mapping, size);
+        if (fd >= 0) close(fd);
+    }
+    bool ok() const { return !failed; }
+
+    void append(const void *data, const size_t bytes){
+        const char *p = static_cast<const char *>(data);
+        buffer.insert(buffer.end(), p, p + bytes);
+        if (buffer.size() >= (1 << 20)) flush();
+    }
+    void flush(){
+        failed = failed || !write_at(fd, buffer.data(), buffer.size(), size);
+        buffer.clear();
+    }
+    void write(const void *data, const size_t bytes, std::uint64_t offset){
+        failed = failed || !write_at(fd, data, bytes, offset);
+        size = std::max(size, offset);
+    }
+    bool read(void *data, const size_t bytes, std::uint64_t offset) const { return read_at(fd, data, bytes, offset); }
+
+    // the whole file, after the last flush()
+    char *map(){
+        if (size && !mapping){
+            void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) failed = true;
+            else mapping = static_cast<char *>(p);
+        }
+        return mapping;
+    }
+    // drops the pages of the map from the memory of the process, they stay in the page cache (and changes are kept)
+    void release(){
+        if (mapping) madvise(mapping, size, MADV_DONTNEED);
+    }
+
+private:
+    int fd = -1;
+    bool failed = false;
+    std::uint64_t size = 0;
+    std::vector<char> buffer;
+    char *mapping = nullptr;
+};
+
+// a face of the .obj while the chunk file is built
+struct FaceRecord {
+    std::int32_t v[3], n[3], t[3]; // position, normal and uv indices in the whole file, -1 for none
+    std::uint32_t key = 0;         // Morton code of its centroid
+};
+
+// spreads the bits of a 10-bit number three bits apart
+static std::uint32_t spread_bits(std::uint32_t x){
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+// gives every face of a chunk indices into arrays of its own: the elements it uses, in the order of the file
+static void localize(std::vector<FaceRecord> &faces, std::int32_t (FaceRecord::*field)[3], std::vector<std::int32_t> &used){
+    used.clear();
+    for (const FaceRecord &f : faces)
+        for (int k = 0; k < 3; k++)
+            if ((f.*field)[k] >= 0) used.push_back((f.*field)[k]);
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+    for (FaceRecord &f : faces)
+        for (int k = 0; k < 3; k++)
+            if ((f.*field)[k] >= 0) (f.*field)[k] = std::lower_bound(used.begin(), used.end(), (f.*field)[k]) - used.begin();
+}
+
+bool build_chunk_file(const std::string &objFilename, const std::string &path, const int facesPerChunk){
+    PROFILE_STAGE("chunk file build");
+    struct stat st;
+    if (stat(objFilename.c_str(), &st)){
+        std::cerr << "can't open file " << objFilename << "\n";
+        return false;
+    }
+    TempFile positions(path + ".v.tmp"), normals(path + ".vn.tmp"), uvs(path + ".vt.tmp"), records(path + ".f.tmp");
+    TempFile sorted(path + ".sorted.tmp");
+    if (!positions.ok() || !normals.ok() || !uvs.ok() || !records.ok() || !sorted.ok()){
+        std::cerr << "can't create the temporary files of " << path << "\n";
+        return false;
+    }
+
+    // the vertex data and the faces go to their own files, part by part
+    std::uint64_t nverts = 0, nnormals = 0, nuvs = 0, nfaces = 0;
+    float min[3] = {INFINITY, INFINITY, INFINITY}, max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    const size_t partBytes = 16 << 20;
+    const bool parsed = stream_obj(objFilename, [&](const Mesh &part){
+        for (int v = 0; v < part.nverts(); v++){
+            const float p[3] = {part.x[v], part.y[v], part.z[v]};
+            positions.append(p, sizeof(p));
+            for (int k = 0; k < 3; k++) min[k] = std::min(min[k], p[k]), max[k] = std::max(max[k], p[k]);
+        }
+        for (size_t n = 0; n < part.nx.size(); n++){
+            const float p[3] = {part.nx[n], part.ny[n], part.nz[n]};
+            normals.append(p, sizeof(p));
+        }
+        for (size_t t = 0; t < part.u.size(); t++){
+            const float p[2] = {part.u[t], part.v[t]};
+            uvs.append(p, sizeof(p));
+        }
+        for (int f = 0; f < part.nfaces(); f++){
+            FaceRecord r;
+            for (int k = 0; k < 3; k++){
+                r.v[k] = part.indices[f * 3 + k];
+                r.n[k] = part.has_normals() ? part.normalIndices[f * 3 + k] : -1;
+                r.t[k] = part.has_uvs() ? part.uvIndices[f * 3 + k] : -1;
+            }
+            records.append(&r, sizeof(r));
+        }
+        nverts += part.nverts(), nnormals += part.nx.size(), nuvs += part.u.size(), nfaces += part.nfaces();
+        return true;
+    }, partBytes);
+    if (!parsed) return false;
+    for (TempFile *file : {&positions, &normals, &uvs, &records}) file->flush();
+    if (!nfaces){
+        std::cerr << objFilename << " has no faces\n";
+        return false;
+    }
+    const float *vertexData = reinterpret_cast<const float *>(positions.map());
+    const float *normalData = reinterpret_cast<const float *>(normals.map());
+    const float *uvData = reinterpret_cast<const float *>(uvs.map());
+    FaceRecord *faceData = reinterpret_cast<FaceRecord *>(records.map());
+    if (!positions.ok() || !normals.ok() || !uvs.ok() || !records.ok()){
+        std::cerr << "can't map the temporary files of " << path << "\n";
+        return false;
+    }
+
+    // every face gets the Morton code of its centroid, and the faces are counted per bucket of the curve
+    std::vector<std::uint32_t> buckets(std::size_t(1) << (3 * BUCKET_BITS), 0);
+    const std::uint64_t releaseEvery = 1 << 20;
+    for (std::uint64_t f = 0; f < nfaces; f++){
+        FaceRecord &r = faceData[f];
+        std::uint32_t q[3];
+        for (int k = 0; k < 3; k++){
+            const float c = (vertexData[(size_t)r.v[0] * 3 + k] + vertexData[(size_t)r.v[1] * 3 + k] +
+                             vertexData[(size_t)r.v[2] * 3 + k]) / 3;
+            const float extent = max[k] - min[k];
+            q[k] = extent > 0 ? std::min<float>((1 << MORTON_BITS) - 1, (c - min[k]) / extent * (1 << MORTON_BITS)) : 0;
+        }
+        r.key = spread_bits(q[0]) | spread_bits(q[1]) << 1 | spread_bits(q[2]) << 2;
+        buckets[r.key >> (3 * (MORTON_BITS - BUCKET_BITS))]++;
+        if (f % releaseEvery == releaseEvery - 1) positions.release(), records.release();
+    }
+
+    // consecutive buckets make a chunk until it would get more than facesPerChunk faces, the count of a bucket
+    // is then replaced by its chunk
+    std::vector<std::uint64_t> chunkFaces;
+    for (std::uint32_t &bucket : buckets){
+        if (!bucket) continue;
+        if (chunkFaces.empty() || chunkFaces.back() + bucket > (std::uint64_t)facesPerChunk) chunkFaces.push_back(0);
+        chunkFaces.back() += bucket;
+        bucket = chunkFaces.size() - 1;
+    }
+    const int nchunks = chunkFaces.size();
+
+    // the faces are sorted by chunk into another file, through a small buffer per chunk
+    std::vector<std::uint64_t> firstFace(nchunks + 1, 0);
+    for (int c = 0; c < nchunks; c++) firstFace[c + 1] = firstFace[c] + chunkFaces[c];
+    {
+        const size_t bufferFaces = 64;
+        std::vector<std::uint64_t> cursor(firstFace.begin(), firstFace.end() - 1);
+        std::vector<std::vector<FaceRecord>> pending(nchunks);
+        auto flush = [&](const int c){
+            sorted.write(pending[c].data(), pending[c].size() * sizeof(FaceRecord), cursor[c] * sizeof(FaceRecord));
+            cursor[c] += pending[c].size();
+            pending[c].clear();
+        };
+        for (std::uint64_t f = 0; f < nfaces; f++){
+            const int c = buckets[faceData[f].key >> (3 * (MORTON_BITS - BUCKET_BITS))];
+            pending[c].push_back(faceData[f]);
+            if (pending[c].size() == bufferFaces) flush(c);
+            if (f % releaseEvery == releaseEvery - 1) records.release();
+        }
+        for (int c = 0; c < nchunks; c++) flush(c);
+    }
+    records.release();
+
+    // every chunk becomes a mesh of its own, written after the header and the directory
+    const std::string tmpPath = path + ".tmp";
+    const int out = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0){
+        std::cerr << "can't write the chunk file " << path << "\n";
+        return false;
+    }
+    std::vector<ChunkInfo> infos(nchunks);
+    std::uint64_t offset = align(sizeof(ChunkFileHeader) + nchunks * sizeof(ChunkInfo));
+    bool ok = sorted.ok();
+    std::vector<FaceRecord> faces;
+    std::vector<std::int32_t> used;
+    for (int c = 0; c < nchunks && ok; c++){
+        faces.resize(chunkFaces[c]);
+        ok = sorted.read(faces.data(), faces.size() * sizeof(FaceRecord), firstFace[c] * sizeof(FaceRecord));
+        // along the curve inside the chunk too, so its clusters are compact
+        std::stable_sort(faces.begin(), faces.end(), [](const FaceRecord &a, const FaceRecord &b){ return a.key < b.key; });
+
+        Mesh mesh;
+        localize(faces, &FaceRecord::v, used);
+        for (const size_t v : used){
+            mesh.x.push_back(vertexData[v * 3]), mesh.y.push_back(vertexData[v * 3 + 1]), mesh.z.push_back(vertexData[v * 3 + 2]);
+        }
+        localize(faces, &FaceRecord::n, used);
+        for (const size_t n : used){
+            mesh.nx.push_back(normalData[n * 3]), mesh.ny.push_back(normalData[n * 3 + 1]), mesh.nz.push_back(normalData[n * 3 + 2]);
+        }
+        localize(faces, &FaceRecord::t, used);
+        for (const size_t t : used) mesh.u.push_back(uvData[t * 2]), mesh.v.push_back(uvData[t * 2 + 1]);
+        for (const FaceRecord &f : faces){
+            for (int k = 0; k < 3; k++){
+                mesh.indices.push_back(f.v[k]);
+                if (nnormals) mesh.normalIndices.push_back(f.n[k]);
+                if (nuvs) mesh.uvIndices.push_back(f.t[k]);
+            }
+        }
+        build_clusters(mesh);
+
+        ChunkInfo &info = infos[c];
+        info.offset = offset;
+        info.nverts = mesh.nverts(), info.nnormals = mesh.nx.size(), info.nuvs = mesh.u.size();
+        info.nfaces = mesh.nfaces(), info.nclusters = mesh.clusters.size();
+        info.hasNormalIndices = mesh.has_normals(), info.hasUVIndices = mesh.has_uvs();
+        for (int k = 0; k < 3; k++){
+            info.min[k] = mesh.clusters[0].min[k], info.max[k] = mesh.clusters[0].max[k];
+            for (const MeshCluster &cluster : mesh.clusters){
+                info.min[k] = std::min(info.min[k], cluster.min[k]);
+                info.max[k] = std::max(info.max[k], cluster.max[k]);
+            }
+        }
+        chunk_arrays(mesh, info, [&](const auto &v, std::uint64_t){
+            ok = ok && write_at(out, v.data(), v.size() * sizeof(v[0]), offset);
+        });
+        info.bytes = offset - info.offset;
+        offset = align(offset);
+        for (TempFile *file : {&positions, &normals, &uvs}) file->release();
+    }
+
+    ChunkFileHeader header;
+    header.sourceSize = st.st_size;
+    header.sourceMtime = mtime_ns(st);
+    header.nfaces = nfaces;
+    header.nchunks = nchunks;
+    std::uint64_t start = 0;
+    ok = ok && write_at(out, &header, sizeof(header), start) && write_at(out, infos.data(), nchunks * sizeof(ChunkInfo), start);
+    // written next to the final file and renamed at the end, so readers never see a partial file
+    ok = close(out) == 0 && ok;
+    if (!ok || std::rename(tmpPath.c_str(), path.c_str())){
+        std::cerr << "can't write the chunk file " << path << "\n";
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool open_chunked_obj(const std::string &objFilename, ChunkedMesh &mesh){
+    struct stat st;
+    if (stat(objFilename.c_str(), &st)){
+        std::cerr << "can't open file " << objFilename << "\n";
+        return false;
+    }
+    const std::string path = objFilename + ".chunks";
+    if (mesh.open(path) && mesh.source_size() == (std::uint64_t)st.st_size && mesh.source_mtime() == mtime_ns(st)) return true;
+    if (!build_chunk_file(objFilename, path)) return false;
+    if (mesh.open(path)) return true;
+    std::cerr << "can't read the chunk file " << path << "\n";
+    return false;
+}
+
+bool draw_streamed(const ChunkedMesh &mesh, const Mat4 &transform, const std::uint64_t budget,
+                   const std::function<void(const Mesh &chunk, int i)> &drawChunk, StreamStats &stats){
+    // the chunks in view, nearest first (greater z is closer), so the depth pyramid can reject more of the later ones;
+    // a chunk reaching behind the eye goes first
+    std::vector<std::pair<double, int>> order;
+    stats.chunks = mesh.nchunks();
+    for (int i = 0; i < mesh.nchunks(); i++){
+        const ChunkInfo &info = mesh.chunk(i);
+        if (box_outside(info.min, info.max, transform)){
+            stats.culled++;
+            continue;
+        }
+        if (info.bytes > budget){
+            std::cerr << "a chunk of the mesh takes " << info.bytes << " bytes, more than the memory budget\n";
+            return false;
+        }
+        const Vec4 p = transform.apply((info.min[0] + info.max[0]) / 2, (info.min[1] + info.max[1]) / 2,
+                                       (info.min[2] + info.max[2]) / 2);
+        order.emplace_back(p[3] > 0 ? -p[2] / p[3] : -INFINITY, i);
+    }
+    std::sort(order.begin(), order.end());
+
+    // the loader hands chunks over in order, and waits when the next one would not fit in the budget
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::pair<int, std::unique_ptr<Mesh>>> ready;
+    std::uint64_t resident = 0;
+    bool failed = false, stop = false;
+    std::thread loader([&]{
+        for (const auto &entry : order){
+            const int i = entry.second;
+            const std::uint64_t bytes = mesh.chunk(i).bytes;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]{ return stop || resident + bytes <= budget; });
+                if (stop) return;
+                resident += bytes;
+                stats.peakResident = std::max(stats.peakResident, resident);
+            }
+            auto chunk = std::make_unique<Mesh>();
+            const bool ok = mesh.load(i, *chunk);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ok){
+                    ready.emplace_back(i, std::move(chunk));
+                    stats.bytesRead += bytes;
+                }
+                failed = !ok;
+            }
+            changed.notify_all();
+            if (!ok) return;
+        }
+    });
+
+    bool ok = true;
+    for (size_t k = 0; k < order.size(); k++){
+        std::pair<int, std::unique_ptr<Mesh>> next;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]{ return failed || !ready.empty(); });
+            if (ready.empty()){
+                ok = false;
+                break;
+            }
+            next = std::move(ready.front());
+            ready.pop_front();
+        }
+        drawChunk(*next.second, next.first);
+        next.second.reset();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            resident -= mesh.chunk(next.first).bytes;
+        }
+        changed.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    changed.notify_all();
+    loader.join();
+    return ok;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+#include "mesh.h"
+
+// one chunk of a chunked mesh: a mesh of its own (with local vertex indices and its clusters), and where it is stored
+struct ChunkInfo {
+    std::uint64_t offset = 0;
+    std::uint64_t bytes = 0; // size of its arrays, in the file and in memory
+    std::uint32_t nverts = 0, nnormals = 0, nuvs = 0, nfaces = 0, nclusters = 0;
+    std::uint8_t  hasNormalIndices = 0, hasUVIndices = 0;
+    float min[3] = {0, 0, 0}, max[3] = {0, 0, 0};
+};
+
+// a mesh kept on disk in spatially coherent chunks (its faces grouped along a Morton curve through their centroids),
+// which are read one at a time so the mesh never has to fit in memory
+class ChunkedMesh {
+public:
+    ChunkedMesh() = default;
+    ChunkedMesh(const ChunkedMesh &) = delete;
+    ChunkedMesh &operator=(const ChunkedMesh &) = delete;
+    ~ChunkedMesh();
+
+    // opens a chunk file, reading only its header and the directory of its chunks
+    bool open(const std::string &path);
+
+    int nchunks() const { return chunks.size(); }
+    const ChunkInfo &chunk(const int i) const { return chunks[i]; }
+    std::uint64_t nfaces() const { return faces; }
+    // the .obj the file was built from, recognized by its size and modification time (in nanoseconds)
+    std::uint64_t source_size() const { return sourceSize; }
+    std::int64_t source_mtime() const { return sourceMtime; }
+
+    // reads chunk i into mesh, from any thread
+    bool load(const int i, Mesh &mesh) const;
+
+private:
+    int fd = -1;
+    std::uint64_t faces = 0, sourceSize = 0;
+    std::int64_t sourceMtime = 0;
+    std::vector<ChunkInfo> chunks;
+};
+
+// writes the chunk file of an .obj (without its materials) with about facesPerChunk faces per chunk: the .obj is
+// parsed part by part and its faces are sorted into chunks through temporary files next to the output, so the
+// whole mesh is never in memory
+bool build_chunk_file(const std::string &objFilename, const std::string &path, const int facesPerChunk = 1 << 16);
+
+// opens <objFilename>.chunks, building it first when it is missing or the .obj changed since
+bool open_chunked_obj(const std::string &objFilename, ChunkedMesh &mesh);
+
+struct StreamStats {
+    int chunks = 0, culled = 0;       // culled chunks were outside the view volume, and never read
+    std::uint64_t bytesRead = 0;
+    std::uint64_t peakResident = 0;   // most bytes of chunks in memory at once
+};
+
+// draws a chunked mesh with at most 'budget' bytes of its chunks in memory: the chunks inside the view volume of the
+// transform are read nearest first by a loader thread, which reads ahead as far as the budget allows while
+// drawChunk(chunk, i) draws the current one
+// returns false if a chunk can't be read, or is larger than the budget by itself
+bool draw_streamed(const ChunkedMesh &mesh, const Mat4 &transform, const std::uint64_t budget,
+                   const std::function<void(const Mesh &chunk, int i)> &drawChunk, StreamStats &stats);
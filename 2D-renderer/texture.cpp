@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "texture.h"
+
+static std::uint32_t pack(const int r, const int g, const int b, const int a){
+    return r | g << 8 | b << 16 | (std::uint32_t)a << 24;
+}
+
+static TexColor unpack(const std::uint32_t c){
+    constexpr float scale = 1.f / 255;
+    return {(c & 0xff) * scale, (c >> 8 & 0xff) * scale, (c >> 16 & 0xff) * scale, (c >> 24) * scale};
+}
+
+static TexColor lerp(const TexColor &a, const TexColor &b, const float t){
+    return {a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t, a.a + (b.a - a.a) * t};
+}
+
+// spreads the 3 low bits of v to the even bits
+static int spread3(const int v){
+    return (v & 1) | (v & 2) << 1 | (v & 4) << 2;
+}
+
+static int wrap(const int x, const int n){
+    const int m = x % n;
+    return m < 0 ? m + n : m;
+}
+
+Texture::Texture(const TGAImage &image){
+    build(image);
+}
+
+bool Texture::load(const std::string &filename){
+    TGAImage image;
+    if (!image.read_tga_file(filename)) return false;
+    build(image);
+    return true;
+}
+
+size_t Texture::offset(const Level &level, const int x, const int y){
+    const size_t tile = (size_t)(y / TILE) * level.tilesX + x / TILE;
+    return tile * TILE * TILE + (spread3(x % TILE) | spread3(y % TILE) << 1);
+}
+
+void Texture::build(const TGAImage &image){
+    levels.clear();
+    int w = image.width(), h = image.height();
+    if (w <= 0 || h <= 0) return;
+
+    // level 0 in plain rows first, flipped so that row 0 is v = 0
+    std::vector<std::uint32_t> rows(w * h);
+    const int bpp = image.bytespp();
+    for (int y = 0; y < h; y++){
+        const std::uint8_t *in = image.row(h - 1 - y);
+        for (int x = 0; x < w; x++, in += bpp)
+            rows[x + y * w] = bpp == 1 ? pack(in[0], in[0], in[0], 255)
+                                       : pack(in[2], in[1], in[0], bpp == 4 ? in[3] : 255);
+    }
+
+    while (true){
+        Level level;
+        level.w = w, level.h = h;
+        level.tilesX = (w + TILE - 1) / TILE;
+        level.texels.assign((size_t)level.tilesX * ((h + TILE - 1) / TILE) * TILE * TILE, 0);
+        for (int y = 0; y < h; y++)
+            for (int x = 0; x < w; x++)
+                level.texels[offset(level, x, y)] = rows[x + y * w];
+        levels.push_back(std::move(level));
+        if (w == 1 && h == 1) break;
+
+        // next level: 2x2 box filter, the last row or column of an odd size is used twice
+        const int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        std::vector<std::uint32_t> next(nw * nh);
+        for (int y = 0; y < nh; y++){
+            const int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+            for (int x = 0; x < nw; x++){
+                const int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                const std::uint32_t c[4] = {rows[x0 + y0 * w], rows[x1 + y0 * w], rows[x0 + y1 * w], rows[x1 + y1 * w]};
+                int sum[4] = {0, 0, 0, 0};
+                for (const std::uint32_t texel : c)
+                    for (int k = 0; k < 4; k++) sum[k] += texel >> (8 * k) & 0xff;
+                next[x + y * nw] = pack((sum[0] + 2) / 4, (sum[1] + 2) / 4, (sum[2] + 2) / 4, (sum[3] + 2) / 4);
+            }
+        }
+        rows.swap(next);
+        w = nw, h = nh;
+    }
+}
+
+TexColor Texture::fetch(const int x, const int y, const int level) const {
+    const Level &l = levels[level];
+    return unpack(l.texels[offset(l, wrap(x, l.w), wrap(y, l.h))]);
+}
+
+TexColor Texture::sample_bilinear(const float u, const float v, const int level) const {
+    if (levels.empty()) return {};
+    const Level &l = levels[level];
+    // texel centers are at half coordinates
+    const float x = u * l.w - .5f, y = v * l.h - .5f;
+    const float fx = std::floor(x), fy = std::floor(y);
+    const int x0 = fx, y0 = fy;
+    const float tx = x - fx, ty = y - fy;
+    const TexColor bottom = lerp(fetch(x0, y0, level), fetch(x0 + 1, y0, level), tx);
+    const TexColor top = lerp(fetch(x0, y0 + 1, level), fetch(x0 + 1, y0 + 1, level), tx);
+    return lerp(bottom, top, ty);
+}
+
+TexColor Texture::sample(const float u, const float v, const float lod) const {
+    if (levels.empty()) return {};
+    const float l = std::clamp(lod, 0.f, (float)levels.size() - 1);
+    const int l0 = l;
+    const float t = l - l0;
+    if (t == 0 || l0 + 1 >= (int)levels.size()) return sample_bilinear(u, v, l0);
+    return lerp(sample_bilinear(u, v, l0), sample_bilinear(u, v, l0 + 1), t);
+}
+
+float Texture::lod(const float dudx, const float dvdx, const float dudy, const float dvdy) const {
+    if (levels.empty()) return 0;
+    // the longest side of the footprint of the pixel, in texels of level 0
+    const float w = levels[0].w, h = levels[0].h;
+    const float x = (dudx * w) * (dudx * w) + (dvdx * h) * (dvdx * h);
+    const float y = (dudy * w) * (dudy * w) + (dvdy * h) * (dvdy * h);
+    const float rho2 = std::max(x, y);
+    return rho2 > 1 ? .5f * std::log2(rho2) : 0;
+}
+
+const Texture *TextureCache::get(const std::string &filename){
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = textures.find(filename);
+    if (it == textures.end()){
+        auto texture = std::make_unique<Texture>();
+        if (!texture->load(filename)){
+            std::cerr << "can't load texture " << filename << "\n";
+            texture.reset();
+        }
+        it = textures.emplace(filename, std::move(texture)).first;
+    }
+    return it->second.get();
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "tgaimage.h"
+
+// a filtered color, channels in [0, 1]
+struct TexColor {
+    float r = 0, g = 0, b = 0, a = 1;
+};
+
+// read-only texture with a full chain of mipmaps, sampled with texture coordinates that wrap around (repeat)
+// every level is stored in 8x8 tiles, with the texels of a tile in Morton (Z) order, so the 2x2 footprint of a
+// bilinear fetch and neighbouring pixels of a triangle mostly fall in the same cache lines, whatever the direction
+// the texture is walked in; v = 0 is the bottom row of the image, like in .obj files
+class Texture {
+public:
+    static constexpr int TILE = 8;
+
+    Texture() = default;
+    explicit Texture(const TGAImage &image);
+    bool load(const std::string &filename);
+
+    int width(const int level = 0) const { return levels[level].w; }
+    int height(const int level = 0) const { return levels[level].h; }
+    int nlevels() const { return levels.size(); }
+
+    // the texel (x, y) of a level, coordinates wrap around
+    TexColor fetch(const int x, const int y, const int level = 0) const;
+    TexColor sample_bilinear(const float u, const float v, const int level = 0) const;
+    // trilinear filtering: bilinear on the two levels around lod, blended
+    TexColor sample(const float u, const float v, const float lod) const;
+    // level of detail of a pixel from the derivatives of the texture coordinates across the screen
+    float lod(const float dudx, const float dvdx, const float dudy, const float dvdy) const;
+
+private:
+    struct Level {
+        int w = 0, h = 0, tilesX = 0;
+        std::vector<std::uint32_t> texels; // RGBA8, tile after tile
+    };
+    static size_t offset(const Level &level, const int x, const int y);
+    void build(const TGAImage &image);
+    std::vector<Level> levels;
+};
+
+// textures shared by everything that renders, each file is read (and its mipmaps built) once
+class TextureCache {
+public:
+    // the texture of a file, or nullptr if it can't be read (which is reported the first time only)
+    const Texture *get(const std::string &filename);
+private:
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<Texture>> textures;
+};
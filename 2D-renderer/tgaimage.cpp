@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include "tgaimage.h"
@@ -33,7 +34,13 @@ bool TGAImage::read_tga_file(const std::string filename) {
             return false;
         }
     } else if (10==header.datatypecode||11==header.datatypecode) {
-        if (!load_rle_data(in)) {
+        // the compressed data is read in one go and decoded from memory
+        std::streampos start = in.tellg();
+        in.seekg(0, std::ios::end);
+        std::vector<std::uint8_t> rle(in.tellg()-start);
+        in.seekg(start);
+        in.read(reinterpret_cast<char *>(rle.data()), rle.size());
+        if (!in.good() || !load_rle_data(rle.data(), rle.size())) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
@@ -49,52 +56,38 @@ bool TGAImage::read_tga_file(const std::string filename) {
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-    size_t pixelcount = w*h;
-    size_t currentpixel = 0;
-    size_t currentbyte  = 0;
-    TGAColor colorbuffer;
-    do {
-        std::uint8_t chunkheader = 0;
-        chunkheader = in.get();
-        if (!in.good()) {
+bool TGAImage::load_rle_data(const std::uint8_t *in, const size_t size) {
+    const size_t nbytes = data.size();
+    const std::uint8_t *end = in+size;
+    size_t currentbyte = 0;
+    while (currentbyte < nbytes) {
+        if (in>=end) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
-        if (chunkheader<128) {
-            chunkheader++;
-            for (int i=0; i<chunkheader; i++) {
-                in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-                if (!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
+        std::uint8_t chunkheader = *in++;
+        bool raw = chunkheader<128;
+        size_t npixels = raw ? chunkheader+1 : chunkheader-127;
+        size_t chunkbytes = npixels*bpp;
+        if (currentbyte+chunkbytes>nbytes) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
+        if (end-in < (raw ? (long)chunkbytes : bpp)) {
+            std::cerr << "an error occured while reading the header\n";
+            return false;
+        }
+        std::uint8_t *out = data.data()+currentbyte;
+        if (raw) {
+            memcpy(out, in, chunkbytes);
+            in += chunkbytes;
         } else {
-            chunkheader -= 127;
-            in.read(reinterpret_cast<char *>(colorbuffer.bgra), bpp);
-            if (!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
-                return false;
-            }
-            for (int i=0; i<chunkheader; i++) {
-                for (int t=0; t<bpp; t++)
-                    data[currentbyte++] = colorbuffer.bgra[t];
-                currentpixel++;
-                if (currentpixel>pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
+            if (bpp==1) memset(out, *in, npixels);
+            else for (size_t i=0; i<npixels; i++) memcpy(out+i*bpp, in, bpp);
+            in += bpp;
         }
-    } while (currentpixel < pixelcount);
+        currentbyte += chunkbytes;
+    }
     return true;
 }
 
@@ -102,49 +95,49 @@ bool TGAImage::write_tga_file(const std::string filename, const bool vflip, cons
     constexpr std::uint8_t developer_area_ref[4] = {0, 0, 0, 0};
     constexpr std::uint8_t extension_area_ref[4] = {0, 0, 0, 0};
     constexpr std::uint8_t footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
-    std::ofstream out;
-    out.open(filename, std::ios::binary);
-    if (!out.is_open()) {
-        std::cerr << "can't open file " << filename << "\n";
-        return false;
-    }
     TGAHeader header = {};
     header.bitsperpixel = bpp<<3;
     header.width  = w;
     header.height = h;
     header.datatypecode = (bpp==GRAYSCALE ? (rle?11:3) : (rle?10:2));
     header.imagedescriptor = vflip ? 0x00 : 0x20; // top-left or bottom-left origin
-    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
-    if (!out.good()) goto err;
-    if (!rle) {
-        out.write(reinterpret_cast<const char *>(data.data()), w*h*bpp);
-        if (!out.good()) goto err;
-    } else if (!unload_rle_data(out)) goto err;
-    out.write(reinterpret_cast<const char *>(developer_area_ref), sizeof(developer_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(extension_area_ref), sizeof(extension_area_ref));
-    if (!out.good()) goto err;
-    out.write(reinterpret_cast<const char *>(footer), sizeof(footer));
-    if (!out.good()) goto err;
+
+    // the whole file is assembled in memory and written at once
+    std::vector<std::uint8_t> file(reinterpret_cast<const std::uint8_t *>(&header),
+                                   reinterpret_cast<const std::uint8_t *>(&header)+sizeof(header));
+    if (!rle) file.insert(file.end(), data.begin(), data.end());
+    else unload_rle_data(file);
+    file.insert(file.end(), developer_area_ref, developer_area_ref+sizeof(developer_area_ref));
+    file.insert(file.end(), extension_area_ref, extension_area_ref+sizeof(extension_area_ref));
+    file.insert(file.end(), footer, footer+sizeof(footer));
+
+    std::ofstream out;
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(file.data()), file.size());
+    if (!out.good()) {
+        std::cerr << "can't dump the tga file\n";
+        return false;
+    }
     return true;
-err:
-    std::cerr << "can't dump the tga file\n";
-    return false;
 }
 
-bool TGAImage::unload_rle_data(std::ofstream &out) const {
+void TGAImage::unload_rle_data(std::vector<std::uint8_t> &out) const {
     const std::uint8_t max_chunk_length = 128;
     size_t npixels = w*h;
     size_t curpix = 0;
+    // worst case: every chunk is raw and 128 pixels long
+    out.reserve(out.size() + data.size() + npixels/max_chunk_length + 1 + 26);
     while (curpix<npixels) {
         size_t chunkstart = curpix*bpp;
         size_t curbyte = curpix*bpp;
         std::uint8_t run_length = 1;
         bool raw = true;
         while (curpix+run_length<npixels && run_length<max_chunk_length) {
-            bool succ_eq = true;
-            for (int t=0; succ_eq && t<bpp; t++)
-                succ_eq = (data[curbyte+t]==data[curbyte+t+bpp]);
+            bool succ_eq = !memcmp(data.data()+curbyte, data.data()+curbyte+bpp, bpp);
             curbyte += bpp;
             if (1==run_length)
                 raw = !succ_eq;
@@ -157,12 +150,9 @@ bool TGAImage::unload_rle_data(std::ofstream &out) const {
             run_length++;
         }
         curpix += run_length;
-        out.put(raw ? run_length-1 : run_length+127);
-        if (!out.good()) return false;
-        out.write(reinterpret_cast<const char *>(data.data()+chunkstart), (raw?run_length*bpp:bpp));
-        if (!out.good()) return false;
+        out.push_back(raw ? run_length-1 : run_length+127);
+        out.insert(out.end(), data.data()+chunkstart, data.data()+chunkstart+(raw?run_length*bpp:bpp));
     }
-    return true;
 }
 
 TGAColor TGAImage::get(const int x, const int y) const {
@@ -179,17 +169,17 @@ void TGAImage::set(int x, int y, const TGAColor &c) {
 }
 
 void TGAImage::flip_horizontally() {
-    for (int i=0; i<w/2; i++)
-        for (int j=0; j<h; j++)
-            for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(w-1-i+j*w)*bpp+b]);
+    for (int j=0; j<h; j++) {
+        std::uint8_t *left = row(j), *right = row(j)+(w-1)*bpp;
+        for (; left<right; left+=bpp, right-=bpp)
+            std::swap_ranges(left, left+bpp, right);
+    }
 }
 
 void TGAImage::flip_vertically() {
-    for (int i=0; i<w; i++)
-        for (int j=0; j<h/2; j++)
-            for (int b=0; b<bpp; b++)
-                std::swap(data[(i+j*w)*bpp+b], data[(i+(h-1-j)*w)*bpp+b]);
+    const size_t bytes_per_line = w*bpp;
+    for (int j=0; j<h/2; j++)
+        std::swap_ranges(row(j), row(j)+bytes_per_line, row(h-1-j));
 }
 
 int TGAImage::width() const {
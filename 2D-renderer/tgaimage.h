@@ -38,9 +38,18 @@ struct TGAImage {
     void set(const int x, const int y, const TGAColor &c);
     int width()  const;
     int height() const;
+    int bytespp() const { return bpp; }
+
+    // unchecked access to the raw pixels, rows are stored one after the other, bytespp() bytes per pixel
+    std::uint8_t *buffer() { return data.data(); }
+    const std::uint8_t *buffer() const { return data.data(); }
+    std::uint8_t *row(const int y) { return data.data() + (size_t)y * w * bpp; }
+    const std::uint8_t *row(const int y) const { return data.data() + (size_t)y * w * bpp; }
+    std::uint8_t *pixel(const int x, const int y) { return row(y) + (size_t)x * bpp; }
+    const std::uint8_t *pixel(const int x, const int y) const { return row(y) + (size_t)x * bpp; }
 private:
-    bool   load_rle_data(std::ifstream &in);
-    bool unload_rle_data(std::ofstream &out) const;
+    bool   load_rle_data(const std::uint8_t *in, const size_t size);
+    void unload_rle_data(std::vector<std::uint8_t> &out) const;
     int w = 0, h = 0;
     std::uint8_t bpp = 0;
     std::vector<std::uint8_t> data = {};
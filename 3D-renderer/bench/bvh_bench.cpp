@@ -0,0 +1,63 @@
+// times BVH construction and rendering on random scenes from 100 to 1M spheres,
+// and checks that the BVH renders exactly the same image as testing every sphere (on the smaller scenes)
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include "random_scene.h"
+#include "../tracer.h"
+
+static double seconds_since(const std::chrono::steady_clock::time_point &start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+    RenderSettings settings;
+    settings.width = 320, settings.height = 180;
+    settings.nthreads = omp_get_max_threads();
+    int maxSpheres = 1000000, maxBruteForce = 1000;
+
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) settings.nthreads = std::max(1, atoi(argv[++i]));
+        else if (arg == "--max" && i + 1 < argc) maxSpheres = atoi(argv[++i]);
+        else if (arg == "--brute-force" && i + 1 < argc) maxBruteForce = atoi(argv[++i]);
+        else {
+            std::cout << "Usage: " << argv[0] << " [--threads n] [--max spheres] [--brute-force spheres]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Vec3f> image(settings.width * settings.height), reference(image.size());
+    std::cout << "spheres    nodes     build (s)  render (s)  brute force (s)" << std::endl;
+    bool ok = true;
+    for (int n = 100; n <= maxSpheres; n *= 10){
+        Scene scene;
+        random_scene(scene, n);
+
+        auto start = std::chrono::steady_clock::now();
+        scene.prepare(true);
+        double build = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        render(scene, settings, image.data());
+        double traced = seconds_since(start);
+
+        std::printf("%-10d %-9zu %-10.4f %-11.4f", n, scene.bvh.nodes.size(), build, traced);
+        if (n <= maxBruteForce){
+            scene.prepare(false);
+            start = std::chrono::steady_clock::now();
+            render(scene, settings, reference.data());
+            double brute = seconds_since(start);
+            bool same = !std::memcmp(image.data(), reference.data(), image.size() * sizeof(Vec3f));
+            ok &= same;
+            std::printf(" %-10.4f %s", brute, same ? "identical" : "DIFFERENT");
+        }
+        std::printf("\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+#pragma once
+// random sphere scenes of any size for the benchmarks
+#include <cmath>
+#include <random>
+
+#include "../scene.h"
+
+// n spheres scattered in front of the camera, above a ground sphere and under two lights
+// the spheres get smaller as they get more numerous, so the scene covers about the same part of the image
+inline void random_scene(Scene &scene, const int n){
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0, 1);
+    scene.spheres.clear();
+    scene.spheres.push_back(Sphere(Vec3f(0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0.0, 0));
+    const float radius = 2.f / std::cbrt(float(n));
+    for (int i = 0; i < n; i++){
+        Vec3f center(-12 + 24 * unit(rng), -4 + 12 * unit(rng), -18 - 30 * unit(rng));
+        float kind = unit(rng);
+        scene.spheres.push_back(Sphere(center, radius * (0.5f + unit(rng)), Vec3f(unit(rng), unit(rng), unit(rng)),
+                                       kind < 0.1f ? 0.5f : 0.f, kind < 0.3f ? 1.f : 0.f));
+    }
+    scene.spheres.push_back(Sphere(Vec3f(10, 20, -10), 3, Vec3f(0.00, 0.00, 0.00), 0.0, 0, Vec3f(5)));
+    scene.spheres.push_back(Sphere(Vec3f(-3, 20, -5), 3, Vec3f(0.00, 0.00, 0.00), 0.0, 0, Vec3f(3)));
+}
@@ -0,0 +1,90 @@
+// measures the throughput of the ray tracer on random scenes from 10 to 1M spheres at several resolutions and
+// thread counts, and checks every image against its golden reference so that an optimization cannot change
+// pixels unnoticed
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+#include "random_scene.h"
+#include "../framebuffer.h"
+#include "../tracer.h"
+#include "../../2D-renderer/bench/bench_common.h"
+
+static double seconds_since(const std::chrono::steady_clock::time_point &start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+    std::vector<int> threads = {1}, widths = {320, 1280};
+    if (omp_get_max_threads() > 1) threads.push_back(omp_get_max_threads());
+    int maxSpheres = 1000000, runs = 3;
+    std::string goldenDir = "bench/golden";
+    bool update = false;
+
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) threads = parse_list(argv[++i]);
+        else if (arg == "--widths" && i + 1 < argc) widths = parse_list(argv[++i]);
+        else if (arg == "--max" && i + 1 < argc) maxSpheres = atoi(argv[++i]);
+        else if (arg == "--runs" && i + 1 < argc) runs = std::max(1, atoi(argv[++i]));
+        else if (arg == "--golden" && i + 1 < argc) goldenDir = argv[++i];
+        else if (arg == "--update-golden") update = true;
+        else {
+            std::cout << "Usage: " << argv[0] << " [--threads 1,2,4] [--widths 320,1280] [--max spheres] [--runs n]"
+                         " [--golden dir] [--update-golden]" << std::endl;
+            std::cout << "images are 16:9, given by their width" << std::endl;
+            return 1;
+        }
+    }
+    if (update && !make_directory(goldenDir)){
+        std::cerr << "can't create " << goldenDir << "\n";
+        return 1;
+    }
+
+    std::cout << "spheres    size        threads  time (s)           Mrays/s            rays/pixel  golden" << std::endl;
+    bool ok = true;
+    std::vector<Vec3f> image;
+    for (int n = 10; n <= maxSpheres; n *= 10){
+        Scene scene;
+        random_scene(scene, n);
+        scene.prepare();
+
+        for (int width : widths){
+            RenderSettings settings;
+            settings.width = width, settings.height = width * 9 / 16;
+            image.resize(settings.width * settings.height);
+            for (int nthreads : threads){
+                settings.nthreads = nthreads;
+                std::vector<double> times, rates;
+                long long rays = 0;
+                for (int run = 0; run < runs; run++){
+                    auto start = std::chrono::steady_clock::now();
+                    rays = render(scene, settings, image.data());
+                    double t = seconds_since(start);
+                    times.push_back(t);
+                    rates.push_back(rays / t * 1e-6);
+                }
+
+                // the image does not depend on the number of threads, so they all share the same golden
+                // (with --update-golden, it is rewritten by the first thread count and the others are compared to it)
+                std::string golden = goldenDir + "/spheres_" + std::to_string(n) + "_" + std::to_string(width) + ".tga";
+                GoldenCheck check = check_golden(golden, to_tga_image(image.data(), settings.width, settings.height),
+                                                 update && nthreads == threads[0], false);
+                ok &= check.status == GoldenCheck::MATCH || check.status == GoldenCheck::CREATED;
+
+                Summary time = summarize(times), rate = summarize(rates);
+                std::string size = std::to_string(settings.width) + "x" + std::to_string(settings.height);
+                std::printf("%-10d %-11s %-8d %8.4f +- %-7.4f %8.3f +- %-7.3f %-11.2f %s", n, size.c_str(), nthreads,
+                            time.mean, time.stddev, rate.mean, rate.stddev, double(rays) / image.size(), check.name());
+                if (check.status == GoldenCheck::DIFFERENT)
+                    std::printf(" (%lld pixels, max difference %d)", check.differing, check.maxDiff);
+                std::printf("\n");
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
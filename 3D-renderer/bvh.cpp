@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "bvh.h"
+#include "../2D-renderer/profiler.h"
+
+// number of buckets the centroids are sorted in to evaluate split candidates
+constexpr int SAH_BINS = 12;
+// cost of visiting a node, relative to intersecting a sphere
+constexpr float TRAVERSAL_COST = 1.f;
+// nodes with more spheres than this are always split
+constexpr int MAX_LEAF_SIZE = 8;
+// from this depth on, nodes are split at the median of their centroids, which halves them: a tree over an int count of
+// primitives then never gets deeper than BVH_STACK_SIZE - 1
+constexpr int MEDIAN_DEPTH = BVH_STACK_SIZE - 32;
+static_assert(MEDIAN_DEPTH > 0, "the traversal stacks must hold 31 median splits");
+
+struct BuildPrim {
+    AABB box;
+    float centroid[3];
+    int index;
+};
+
+// builds the subtree over prims [begin, end) and appends its nodes depth first, returns the index of its root
+// nodes of up to leafSize primitives are never split, depth is the one of the root of the subtree
+static int build_node(std::vector<BuildPrim> &prims, const int begin, const int end, std::vector<BVHNode> &nodes,
+                      const int leafSize, const int depth){
+    AABB box, centroids;
+    for (int i = begin; i < end; i++){
+        box.grow(prims[i].box);
+        centroids.grow(prims[i].centroid);
+    }
+
+    const int nodeIndex = nodes.size();
+    nodes.emplace_back();
+    for (int k = 0; k < 3; k++){
+        nodes[nodeIndex].bmin[k] = box.bmin[k];
+        nodes[nodeIndex].bmax[k] = box.bmax[k];
+    }
+    nodes[nodeIndex].offset = begin;
+    nodes[nodeIndex].count = end - begin;
+    nodes[nodeIndex].axis = 0;
+    const int n = end - begin;
+    if (n <= leafSize) return nodeIndex;
+
+    // candidate splits are taken along the axis where the centroids are spread the most
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+        if (centroids.bmax[k] - centroids.bmin[k] > centroids.bmax[axis] - centroids.bmin[axis]) axis = k;
+    const float lo = centroids.bmin[axis], extent = centroids.bmax[axis] - lo;
+
+    // the median split, when the surface area heuristic gives none (box areas overflowing to infinity make every
+    // cost NaN) or the tree gets too deep
+    int mid = -1;
+    auto median = [&](){
+        mid = begin + n / 2;
+        std::nth_element(prims.begin() + begin, prims.begin() + mid, prims.begin() + end,
+                         [&](const BuildPrim &a, const BuildPrim &b){ return a.centroid[axis] < b.centroid[axis]; });
+    };
+    if (extent > 0 && depth >= MEDIAN_DEPTH) median();
+    else if (extent > 0){
+        // surface area heuristic: cost = traversal + (area(left) * count(left) + area(right) * count(right)) / area(node)
+        AABB bins[SAH_BINS];
+        int counts[SAH_BINS] = {0};
+        auto bin_of = [&](const BuildPrim &p){ return std::min(SAH_BINS - 1, int((p.centroid[axis] - lo) / extent * SAH_BINS)); };
+        for (int i = begin; i < end; i++){
+            int b = bin_of(prims[i]);
+            bins[b].grow(prims[i].box);
+            counts[b]++;
+        }
+        float rightArea[SAH_BINS];
+        int rightCount[SAH_BINS];
+        AABB acc;
+        int accCount = 0;
+        for (int b = SAH_BINS - 1; b > 0; b--){
+            acc.grow(bins[b]);
+            accCount += counts[b];
+            rightArea[b] = acc.area();
+            rightCount[b] = accCount;
+        }
+        float bestCost = FLT_MAX;
+        int bestBin = -1;
+        acc = AABB();
+        accCount = 0;
+        for (int b = 1; b < SAH_BINS; b++){
+            acc.grow(bins[b - 1]);
+            accCount += counts[b - 1];
+            if (!accCount || !rightCount[b]) continue;
+            float cost = TRAVERSAL_COST + (acc.area() * accCount + rightArea[b] * rightCount[b]) / std::max(box.area(), FLT_MIN);
+            if (cost < bestCost) bestCost = cost, bestBin = b;
+        }
+
+        // small nodes stay leaves when splitting them does not pay off
+        if (n <= MAX_LEAF_SIZE && bestCost >= n) return nodeIndex;
+        if (bestBin < 0) median();
+        else mid = std::partition(prims.begin() + begin, prims.begin() + end,
+                                  [&](const BuildPrim &p){ return bin_of(p) < bestBin; }) - prims.begin();
+    }
+    else if (n <= MAX_LEAF_SIZE) return nodeIndex;
+    else mid = begin + n / 2; // all centroids coincide, any split is as good as the others
+
+    BVHNode &node = nodes[nodeIndex];
+    node.count = 0;
+    node.axis = axis;
+    build_node(prims, begin, mid, nodes, leafSize, depth + 1);
+    const int right = build_node(prims, mid, end, nodes, leafSize, depth + 1);
+    nodes[nodeIndex].offset = right;
+    return nodeIndex;
+}
+
+// builds the tree over the primitives, which are reordered along the way
+static void build_tree(std::vector<BuildPrim> &build, std::vector<BVHNode> &nodes, std::vector<int> &prims,
+                       const int leafSize){
+    nodes.reserve(2 * build.size());
+    build_node(build, 0, build.size(), nodes, leafSize, 0);
+    nodes.shrink_to_fit();
+
+    prims.resize(build.size());
+    for (size_t i = 0; i < build.size(); i++) prims[i] = build[i].index;
+}
+
+void BVH::build(const std::vector<Sphere> &spheres){
+    PROFILE_STAGE("bvh build");
+    nodes.clear();
+    prims.clear();
+    if (spheres.empty()) return;
+
+    std::vector<BuildPrim> build(spheres.size());
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < (int)spheres.size(); i++){
+        const Sphere &s = spheres[i];
+        for (int k = 0; k < 3; k++){
+            float c = k == 0 ? s.center.x : k == 1 ? s.center.y : s.center.z;
+            build[i].box.bmin[k] = c - s.radius;
+            build[i].box.bmax[k] = c + s.radius;
+            build[i].centroid[k] = c;
+        }
+        build[i].index = i;
+    }
+    build_tree(build, nodes, prims, 2);
+}
+
+void BVH::build(const std::vector<AABB> &boxes, const int leafSize){
+    PROFILE_STAGE("bvh build");
+    nodes.clear();
+    prims.clear();
+    if (boxes.empty()) return;
+
+    std::vector<BuildPrim> build(boxes.size());
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < boxes.size(); i++){
+        build[i].box = boxes[i];
+        for (int k = 0; k < 3; k++) build[i].centroid[k] = 0.5f * (boxes[i].bmin[k] + boxes[i].bmax[k]);
+        build[i].index = i;
+    }
+    build_tree(build, nodes, prims, leafSize);
+}
+
+int BVH::closest_hit(const std::vector<Sphere> &spheres, const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear) const {
+    tnear = INFINITY;
+    int hit = -1;
+    if (nodes.empty()) return hit;
+    const SlabRay ray(rayOrig, rayDir);
+    int stack[BVH_STACK_SIZE];
+    int top = 0;
+    if (ray.enter(nodes[0], INFINITY) == INFINITY) return hit;
+    int current = 0;
+    long long tests = 0; // for the profile
+    while (true){
+        const BVHNode &node = nodes[current];
+        if (node.count){
+            for (int i = node.offset; i < node.offset + node.count; i++){
+                const int s = prims[i];
+                tests++;
+                float t0 = INFINITY, t1 = INFINITY;
+                if (!spheres[s].intersect(rayOrig, rayDir, t0, t1)) continue;
+                if (t0 < 0) t0 = t1;
+                // same as the linear search in sphere order, where only a strictly closer sphere replaces a hit
+                if (t0 < tnear || (t0 == tnear && s < hit)){
+                    tnear = t0;
+                    hit = s;
+                }
+            }
+        }
+        else {
+            // both children are tested and the nearer one is visited first
+            int first = current + 1, second = node.offset;
+            if (ray.negative[node.axis]) std::swap(first, second);
+            // boxes entered exactly at tnear can still hold a tie with a lower sphere index
+            float t1 = ray.enter(nodes[first], tnear), t2 = ray.enter(nodes[second], tnear);
+            if (t1 != INFINITY){
+                if (t2 != INFINITY) stack[top++] = second;
+                current = first;
+                continue;
+            }
+            if (t2 != INFINITY){
+                current = second;
+                continue;
+            }
+        }
+        if (!top) break;
+        current = stack[--top];
+    }
+    PROFILE_COUNT("sphere tests", tests);
+    return hit;
+}
+
+int BVH::any_hit(const std::vector<Sphere> &spheres, const Vec3f &rayOrig, const Vec3f &rayDir, const int ignore) const {
+    if (nodes.empty()) return -1;
+    const SlabRay ray(rayOrig, rayDir);
+    int stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top){
+        const BVHNode &node = nodes[stack[--top]];
+        if (ray.enter(node, INFINITY) == INFINITY) continue;
+        if (node.count){
+            PROFILE_COUNT("sphere tests", node.count);
+            for (int i = node.offset; i < node.offset + node.count; i++){
+                float t0, t1;
+                if (prims[i] != ignore && spheres[prims[i]].intersect(rayOrig, rayDir, t0, t1)) return prims[i];
+            }
+        }
+        else {
+            stack[top++] = node.offset;
+            stack[top++] = &node - nodes.data() + 1;
+        }
+    }
+    return -1;
+}
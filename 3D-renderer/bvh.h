@@ -0,0 +1,93 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "geometry.h"
+#include "sphere.h"
+
+// size of the stacks of nodes left to visit when traversing a BVH, build() keeps the trees shallow enough for them
+constexpr int BVH_STACK_SIZE = 64;
+
+// node of a flattened BVH, 32 bytes so two of them fit in a cache line
+// nodes are stored depth first: the left child of an inner node is the node right after it
+struct BVHNode {
+    float bmin[3], bmax[3];
+    std::int32_t offset; // leaves: first entry of BVH::prims, inner nodes: index of the right child
+    std::uint16_t count; // number of spheres in a leaf, 0 for inner nodes
+    std::uint16_t axis;  // split axis of inner nodes, used to visit the nearer child first
+};
+
+struct AABB {
+    float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+    void grow(const AABB &b){
+        for (int k = 0; k < 3; k++){
+            bmin[k] = std::min(bmin[k], b.bmin[k]);
+            bmax[k] = std::max(bmax[k], b.bmax[k]);
+        }
+    }
+    void grow(const float p[3]){
+        for (int k = 0; k < 3; k++){
+            bmin[k] = std::min(bmin[k], p[k]);
+            bmax[k] = std::max(bmax[k], p[k]);
+        }
+    }
+    float area() const {
+        float d[3] = {bmax[0] - bmin[0], bmax[1] - bmin[1], bmax[2] - bmin[2]};
+        if (d[0] < 0) return 0;
+        return 2 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+};
+
+// a ray prepared for slab tests against the nodes
+struct SlabRay {
+    float orig[3], invDir[3];
+    bool negative[3];
+
+    SlabRay(const Vec3f &o, const Vec3f &d){
+        const float dir[3] = {d.x, d.y, d.z};
+        orig[0] = o.x, orig[1] = o.y, orig[2] = o.z;
+        for (int k = 0; k < 3; k++){
+            // a zero component gets a huge but finite inverse, so that 0 * inverse never makes a NaN
+            invDir[k] = 1.f / (dir[k] != 0 ? dir[k] : std::copysign(1e-30f, dir[k]));
+            negative[k] = invDir[k] < 0;
+        }
+    }
+
+    // distance at which the ray enters the box if it reaches it before tmax, or INFINITY
+    float enter(const BVHNode &node, const float tmax) const {
+        float t0 = 0, t1 = tmax;
+        for (int k = 0; k < 3; k++){
+            float near = ((negative[k] ? node.bmax[k] : node.bmin[k]) - orig[k]) * invDir[k];
+            float far = ((negative[k] ? node.bmin[k] : node.bmax[k]) - orig[k]) * invDir[k];
+            // widened by the worst rounding error of the computation, so that boxes are never missed by a hair
+            far *= 1 + 2 * 3 * FLT_EPSILON;
+            t0 = near > t0 ? near : t0;
+            t1 = far < t1 ? far : t1;
+        }
+        return t0 <= t1 ? t0 : INFINITY;
+    }
+};
+
+// bounding volume hierarchy over the spheres of a scene, built with the surface area heuristic
+class BVH {
+public:
+    void build(const std::vector<Sphere> &spheres);
+    // same over any primitives, given by their bounding boxes (prims then refers to the indices of the boxes),
+    // with leaves of at least leafSize primitives where there are enough
+    void build(const std::vector<AABB> &boxes, const int leafSize = 2);
+    bool empty() const { return nodes.empty(); }
+
+    // index of the closest sphere hit by the ray (following the same rules as a linear search over the spheres,
+    // ties go to the lowest index) and its distance in tnear, or -1 if no sphere is hit
+    int closest_hit(const std::vector<Sphere> &spheres, const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear) const;
+
+    // the first sphere other than 'ignore' found on the ray (at any distance, like Sphere::intersect), or -1
+    int any_hit(const std::vector<Sphere> &spheres, const Vec3f &rayOrig, const Vec3f &rayDir, const int ignore) const;
+
+    std::vector<BVHNode> nodes;
+    std::vector<int> prims; // sphere indices, the spheres of a leaf are contiguous
+};
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "framebuffer.h"
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "the framebuffer is converted as a flat array of floats");
+
+void to_rgb8(const Vec3f *image, const size_t npixels, std::uint8_t *out, const ToneMapping &toneMapping){
+    const float *in = &image[0].x;
+    const long long n = npixels * 3;
+    if (!toneMapping.reinhard && toneMapping.gamma == 1){
+        // the common case is a plain clamp, which the compiler turns into simd code
+        #pragma omp parallel for simd schedule(static)
+        for (long long i = 0; i < n; i++)
+            out[i] = std::max(0.f, std::min(1.f, in[i])) * 255;
+        return;
+    }
+    const float exponent = 1 / toneMapping.gamma;
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < n; i++){
+        float c = std::max(0.f, in[i]);
+        if (toneMapping.reinhard) c = c / (1 + c);
+        out[i] = std::pow(std::min(1.f, c), exponent) * 255;
+    }
+}
+
+bool write_ppm(const std::string &filename, const Vec3f *image, const unsigned width, const unsigned height,
+               const ToneMapping &toneMapping){
+    // the whole file is assembled in memory and written at once
+    const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<std::uint8_t> file(header.size() + size_t(width) * height * 3);
+    std::copy(header.begin(), header.end(), file.begin());
+    to_rgb8(image, size_t(width) * height, file.data() + header.size(), toneMapping);
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()){
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(file.data()), file.size());
+    if (!out.good()){
+        std::cerr << "can't dump the ppm file\n";
+        return false;
+    }
+    return true;
+}
+
+TGAImage to_tga_image(const Vec3f *image, const unsigned width, const unsigned height, const ToneMapping &toneMapping){
+    TGAImage tga(width, height, TGAImage::RGB);
+    to_rgb8(image, size_t(width) * height, tga.buffer(), toneMapping);
+    // tga stores blue first
+    std::uint8_t *p = tga.buffer();
+    for (size_t i = 0; i < size_t(width) * height; i++) std::swap(p[i * 3], p[i * 3 + 2]);
+    return tga;
+}
+
+bool write_tga(const std::string &filename, const Vec3f *image, const unsigned width, const unsigned height,
+               const ToneMapping &toneMapping){
+    // the rows are already top first, so they are written without flipping
+    return to_tga_image(image, width, height, toneMapping).write_tga_file(filename, false);
+}
+
+bool write_image(const std::string &filename, const Vec3f *image, const unsigned width, const unsigned height,
+                 const ToneMapping &toneMapping){
+    if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".tga") == 0)
+        return write_tga(filename, image, width, height, toneMapping);
+    return write_ppm(filename, image, width, height, toneMapping);
+}
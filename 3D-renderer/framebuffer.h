@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "geometry.h"
+#include "../2D-renderer/tgaimage.h"
+
+// how colors are mapped to the displayable range before they are quantized
+struct ToneMapping {
+    bool reinhard = false; // compress bright colors with c / (1 + c) instead of just clipping them at 1
+    float gamma = 1;       // values are raised to 1 / gamma, 2.2 for a typical display
+};
+
+// converts npixels colors to 8-bit rgb triplets in one pass: tone mapped, clamped to [0, 1], scaled to 255 and truncated
+void to_rgb8(const Vec3f *image, const size_t npixels, std::uint8_t *out, const ToneMapping &toneMapping = {});
+
+// the image (width * height colors, top row first) as an 8-bit RGB TGAImage, its first row being the top one
+TGAImage to_tga_image(const Vec3f *image, const unsigned width, const unsigned height, const ToneMapping &toneMapping = {});
+
+// write the image (width * height colors, top row first) as a binary PPM or as a TGA file through TGAImage,
+// each with a single write, and return false with a message on failure
+bool write_ppm(const std::string &filename, const Vec3f *image, const unsigned width, const unsigned height,
+               const ToneMapping &toneMapping = {});
+bool write_tga(const std::string &filename, const Vec3f *image, const unsigned width, const unsigned height,
+               const ToneMapping &toneMapping = {});
+
+// picks the format from the extension of the filename: .tga, or PPM for anything else
+bool write_image(const std::string &filename, const Vec3f *image, const unsigned width, const unsigned height,
+                 const ToneMapping &toneMapping = {});
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include "framestate.h"
+
+int object_of(const Scene &scene, const int hit){
+    const int nspheres = scene.spheres.size();
+    if (hit < nspheres) return hit;
+    const int m = std::upper_bound(scene.meshFirstHit.begin(), scene.meshFirstHit.end(), hit) - scene.meshFirstHit.begin() - 1;
+    return nspheres + m;
+}
+
+bool RayCone::reaches(const Vec3f &center, const float radius) const {
+    const float r = radius + spread;
+    const Vec3f v = center - origin;
+    const float d = std::sqrt(v.dot(v));
+    if (d <= r) return true;
+    if (d - r > tmax) return false;
+    if (angle >= M_PI) return true;
+    // the rays within 'angle' of the axis that pass through the sphere widened by the spread of their origins
+    const float cosine = std::max(-1.f, std::min(1.f, axis.dot(v) / d));
+    return std::acos(cosine) <= angle + std::asin(r / d);
+}
+
+void RayLog::clear(){
+    groups.clear();
+    objects.clear();
+}
+
+void RayLog::add(const int kind, const int from, const Vec3f &orig, const Vec3f &dir, const float tmax){
+    // a tile has few groups
+    size_t g = 0;
+    while (g < groups.size() && (groups[g].kind != kind || groups[g].from != from)) g++;
+    if (g == groups.size()) groups.push_back(Group{kind, from});
+    Group &group = groups[g];
+    const float o[3] = {orig.x, orig.y, orig.z}, d[3] = {dir.x, dir.y, dir.z};
+    group.origins.grow(o);
+    group.directions.grow(d);
+    group.tmax = std::max(group.tmax, tmax);
+}
+
+void RayLog::closest(const int depth, const int from, const Vec3f &orig, const Vec3f &dir, const int object, const float tnear){
+    add(depth, from, orig, dir, object < 0 ? INFINITY : tnear);
+    if (object >= 0 && (objects.empty() || objects.back() != object)) objects.push_back(object);
+}
+
+void RayLog::shadow(const int light, const int from, const Vec3f &orig, const Vec3f &dir){
+    add(-1 - light, from, orig, dir, INFINITY);
+}
+
+// the corners of a box, as vectors
+static Vec3f corner(const AABB &box, const int k){
+    return Vec3f(k & 1 ? box.bmax[0] : box.bmin[0], k & 2 ? box.bmax[1] : box.bmin[1], k & 4 ? box.bmax[2] : box.bmin[2]);
+}
+
+void RayLog::finish(std::vector<RayCone> &cones, std::vector<int> &tileObjects){
+    cones.clear();
+    for (const Group &group : groups){
+        RayCone cone;
+        const Vec3f lo = corner(group.origins, 0), hi = corner(group.origins, 7);
+        cone.origin = (lo + hi) * 0.5f;
+        const Vec3f half = (hi - lo) * 0.5f;
+        cone.spread = std::sqrt(half.dot(half));
+        cone.tmax = group.tmax;
+
+        // a cone around the box of the directions holds all of them, unless the box surrounds the origin
+        const Vec3f center = (corner(group.directions, 0) + corner(group.directions, 7)) * 0.5f;
+        cone.axis = center;
+        cone.axis.normalize();
+        cone.angle = cone.axis.dot(cone.axis) > 0 ? 0 : M_PI;
+        for (int k = 0; k < 8 && cone.angle < M_PI; k++){
+            Vec3f c = corner(group.directions, k);
+            c.normalize();
+            const float cosine = cone.axis.dot(c);
+            cone.angle = cosine <= 0 ? M_PI : std::max(cone.angle, std::acos(std::min(1.f, cosine)));
+        }
+        // widened by the rounding errors of the rays
+        cone.spread += 1e-4f * (1 + cone.spread + std::sqrt(cone.origin.dot(cone.origin)));
+        cone.angle += 1e-4f;
+        cones.push_back(cone);
+    }
+    std::sort(objects.begin(), objects.end());
+    objects.erase(std::unique(objects.begin(), objects.end()), objects.end());
+    tileObjects = objects;
+}
+
+static ObjectRecord record_of(const Sphere &sphere){
+    ObjectRecord record;
+    record.center = sphere.center, record.radius = sphere.radius;
+    record.surfaceColor = sphere.surfaceColor, record.emissionColor = sphere.emissionColor;
+    record.transparency = sphere.transparency, record.reflection = sphere.reflection;
+    return record;
+}
+
+static ObjectRecord record_of(const TriangleMesh &mesh){
+    ObjectRecord record;
+    const AABB box = mesh.bounds();
+    const Vec3f lo = corner(box, 0), hi = corner(box, 7), half = (hi - lo) * 0.5f;
+    record.center = (lo + hi) * 0.5f;
+    record.radius = box.bmin[0] <= box.bmax[0] ? std::sqrt(half.dot(half)) : 0;
+    record.surfaceColor = mesh.surfaceColor, record.emissionColor = mesh.emissionColor;
+    record.transparency = mesh.transparency, record.reflection = mesh.reflection;
+    record.source = mesh.source, record.scale = mesh.scale, record.offset = mesh.offset;
+    record.ntriangles = mesh.ntriangles();
+    return record;
+}
+
+static bool equal(const Vec3f &a, const Vec3f &b){
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool same_shape(const ObjectRecord &a, const ObjectRecord &b){
+    return equal(a.center, b.center) && a.radius == b.radius && a.source == b.source && a.scale == b.scale &&
+           equal(a.offset, b.offset) && a.ntriangles == b.ntriangles;
+}
+
+static bool same_material(const ObjectRecord &a, const ObjectRecord &b){
+    return equal(a.surfaceColor, b.surfaceColor) && equal(a.emissionColor, b.emissionColor) &&
+           a.transparency == b.transparency && a.reflection == b.reflection;
+}
+
+static std::uint64_t shape_key(const ObjectRecord &r){
+    std::uint32_t bits[4];
+    std::memcpy(&bits[0], &r.center.x, 4), std::memcpy(&bits[1], &r.center.y, 4);
+    std::memcpy(&bits[2], &r.center.z, 4), std::memcpy(&bits[3], &r.radius, 4);
+    std::uint64_t h = 0;
+    for (int k = 0; k < 4; k++) h = (h ^ bits[k]) * 0x9e3779b97f4a7c15ull;
+    return h;
+}
+
+// the bounding sphere of an object that moved, appeared or disappeared, a little larger for the rounding of the rays
+static void add_bounds(SceneEdit &edit, const ObjectRecord &r){
+    edit.centers.push_back(r.center);
+    edit.radii.push_back(r.radius * (1 + 1e-4f) + 1e-4f);
+}
+
+SceneEdit diff_scene(const FrameState &frame, const Scene &scene, const RenderSettings &settings){
+    SceneEdit edit;
+    const RenderSettings &before = frame.settings;
+    bool lightsChanged = frame.lights.size() != scene.lights.size();
+    for (size_t l = 0; !lightsChanged && l < scene.lights.size(); l++)
+        lightsChanged = !equal(frame.lights[l].center, scene.lights[l].center) ||
+                        !equal(frame.lights[l].emission, scene.lights[l].emission);
+    if (!frame.valid || lightsChanged || before.width != settings.width || before.height != settings.height ||
+        before.fov != settings.fov || !equal(before.eye, settings.eye) || before.mode != settings.mode ||
+        before.minWeight != settings.minWeight){
+        edit.full = true;
+        return edit;
+    }
+
+    const int nold = frame.objects.size(), nspheres = scene.spheres.size();
+    edit.reshaded.assign(nold, 0);
+    edit.remap.assign(nold, -1);
+    std::vector<char> found(nspheres, 0);
+    std::vector<ObjectRecord> spheres(nspheres);
+    for (int j = 0; j < nspheres; j++) spheres[j] = record_of(scene.spheres[j]);
+
+    // spheres are mostly where they were in the list, the others are looked up by their shape in case some were
+    // inserted or removed before them
+    auto match = [&](const int i, const int j){
+        edit.remap[i] = j;
+        edit.reshaded[i] = !same_material(frame.objects[i], spheres[j]);
+        found[j] = 1;
+    };
+    for (int i = 0; i < std::min(frame.nspheres, nspheres); i++)
+        if (same_shape(frame.objects[i], spheres[i])) match(i, i);
+    std::unordered_map<std::uint64_t, std::vector<int>> missing;
+    for (int i = 0; i < frame.nspheres; i++)
+        if (edit.remap[i] < 0) missing[shape_key(frame.objects[i])].push_back(i);
+    for (int j = 0; j < nspheres && !missing.empty(); j++){
+        if (found[j]) continue;
+        auto it = missing.find(shape_key(spheres[j]));
+        if (it == missing.end()) continue;
+        std::vector<int> &candidates = it->second;
+        for (size_t c = 0; c < candidates.size(); c++){
+            if (!same_shape(frame.objects[candidates[c]], spheres[j])) continue;
+            match(candidates[c], j);
+            candidates.erase(candidates.begin() + c);
+            break;
+        }
+    }
+    for (int i = 0; i < frame.nspheres; i++)
+        if (edit.remap[i] < 0) edit.reshaded[i] = 1, add_bounds(edit, frame.objects[i]);
+    for (int j = 0; j < nspheres; j++)
+        if (!found[j]) add_bounds(edit, spheres[j]);
+
+    // meshes are matched by their place in the list
+    const int nmeshes = scene.meshes.size(), noldMeshes = nold - frame.nspheres;
+    for (int m = 0; m < std::max(nmeshes, noldMeshes); m++){
+        const int i = frame.nspheres + m;
+        if (m < nmeshes && m < noldMeshes){
+            const ObjectRecord mesh = record_of(scene.meshes[m]);
+            if (same_shape(frame.objects[i], mesh)){
+                edit.remap[i] = nspheres + m;
+                edit.reshaded[i] = !same_material(frame.objects[i], mesh);
+                continue;
+            }
+        }
+        if (m < noldMeshes) edit.reshaded[i] = 1, add_bounds(edit, frame.objects[i]);
+        if (m < nmeshes) add_bounds(edit, record_of(scene.meshes[m]));
+    }
+    return edit;
+}
+
+void record_scene(FrameState &frame, const Scene &scene, const RenderSettings &settings){
+    frame.settings = settings;
+    frame.nspheres = scene.spheres.size();
+    frame.objects.resize(scene.spheres.size() + scene.meshes.size());
+    for (int i = 0; i < frame.nspheres; i++) frame.objects[i] = record_of(scene.spheres[i]);
+    for (size_t m = 0; m < scene.meshes.size(); m++) frame.objects[frame.nspheres + m] = record_of(scene.meshes[m]);
+    frame.lights = scene.lights;
+    frame.meshFirstHit = scene.meshFirstHit;
+    frame.valid = true;
+}
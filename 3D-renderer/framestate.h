@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "geometry.h"
+#include "scene.h"
+#include "tracer.h"
+
+// objects are numbered like hits, but a whole mesh is one object: sphere i is object i, and mesh m comes after
+// the spheres as object spheres.size() + m
+int object_of(const Scene &scene, const int hit);
+
+// rays of one tile that share what they are (rays looking for their closest hit at some depth, or shadow rays toward
+// some light) and the object they leave from: they start within 'spread' of 'origin', go within 'angle' radians
+// of 'axis', and end before tmax
+struct RayCone {
+    Vec3f origin, axis;
+    float spread = 0, angle = 0, tmax = INFINITY;
+
+    // true if one of the rays may pass through the sphere
+    bool reaches(const Vec3f &center, const float radius) const;
+};
+
+// collects the rays of one tile while it is traced, see RayCone
+class RayLog {
+public:
+    void clear();
+    // a ray whose closest hit is object 'object' (-1 for none) at tnear, leaving from object 'from' (-1 for the eye)
+    void closest(const int depth, const int from, const Vec3f &orig, const Vec3f &dir, const int object, const float tnear);
+    // a shadow ray toward light l, leaving from object 'from' (it may be blocked at any distance)
+    void shadow(const int light, const int from, const Vec3f &orig, const Vec3f &dir);
+
+    // the cones bounding the rays logged so far, and the objects they hit, without duplicates
+    void finish(std::vector<RayCone> &cones, std::vector<int> &objects);
+private:
+    struct Group {
+        int kind, from;  // kind is the depth of closest hit rays, and -1 - l for the shadow rays toward light l
+        AABB origins, directions;
+        float tmax = 0;
+    };
+    std::vector<Group> groups;
+    std::vector<int> objects;
+    void add(const int kind, const int from, const Vec3f &orig, const Vec3f &dir, const float tmax);
+};
+
+// what an object of the previous frame is, to tell how it changed
+struct ObjectRecord {
+    Vec3f center;    // bounding sphere
+    float radius = 0;
+    Vec3f surfaceColor, emissionColor;
+    float transparency = 0, reflection = 0;
+    std::string source;  // meshes: where they were loaded from and how, empty for spheres
+    float scale = 1;
+    Vec3f offset;
+    int ntriangles = 0;
+};
+
+// what render_incremental() keeps of the frame it rendered, so the next one only re-renders what changed
+struct FrameState {
+    bool valid = false;
+    RenderSettings settings;
+    std::vector<ObjectRecord> objects; // numbered as in object_of()
+    std::vector<Light> lights;
+    int nspheres = 0;
+    std::vector<int> meshFirstHit;
+    // per tile: the rays traced there and the objects they hit
+    std::vector<std::vector<RayCone>> cones;
+    std::vector<std::vector<int>> tileObjects;
+    // per pixel: the closest hit of its primary ray (-1 for none) and its distance
+    std::vector<int> primaryHits;
+    std::vector<float> primaryT;
+
+    void invalidate() { valid = false; }
+};
+
+// how a scene differs from the one of a frame
+struct SceneEdit {
+    bool full = false; // the camera, the image or the lights changed, everything has to be re-rendered
+    // the bounding spheres of the objects that moved, appeared or disappeared, where they were and where they are
+    std::vector<Vec3f> centers;
+    std::vector<float> radii;
+    std::vector<char> reshaded; // per object of the frame: it changed in any way, or is gone
+    std::vector<int> remap;     // per object of the frame: its number in the scene, -1 if gone or moved
+};
+
+// compares the scene (prepared) and its settings with the frame
+SceneEdit diff_scene(const FrameState &frame, const Scene &scene, const RenderSettings &settings);
+
+// remembers the scene and its settings in the frame, to compare the next one with it
+void record_scene(FrameState &frame, const Scene &scene, const RenderSettings &settings);
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "packet.h"
+#include "../2D-renderer/profiler.h"
+#include "tracer.h"
+
+typedef void (*PacketKernel)(const Scene &scene, const Vec3f &rayOrig, const RayPacket &packet, int *hit, float *tnear);
+
+// reference: every ray on its own
+static void closest_hits_scalar(const Scene &scene, const Vec3f &rayOrig, const RayPacket &packet, int *hit, float *tnear){
+    for (int i = 0; i < packet.n; i++)
+        hit[i] = closest_hit(scene, rayOrig, Vec3f(packet.x[i], packet.y[i], packet.z[i]), tnear[i]);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// the lane operations of each instruction set, for packet_kernel.h
+// comparisons are ordered like the scalar code (nlt / ngt are true for unordered lanes, like !(a < b) / !(a > b))
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+namespace sse2 {
+struct Simd {
+    typedef __m128 V;
+    typedef __m128 M;
+    static constexpr int W = 4;
+    static V set1(float a){ return _mm_set1_ps(a); }
+    static V load(const float *p){ return _mm_load_ps(p); }
+    static void store(float *p, V a){ _mm_store_ps(p, a); }
+    static V add(V a, V b){ return _mm_add_ps(a, b); }
+    static V sub(V a, V b){ return _mm_sub_ps(a, b); }
+    static V mul(V a, V b){ return _mm_mul_ps(a, b); }
+    static V sqrt(V a){ return _mm_sqrt_ps(a); }
+    static V min(V a, V b){ return _mm_min_ps(a, b); }
+    static V max(V a, V b){ return _mm_max_ps(a, b); }
+    static M lt(V a, V b){ return _mm_cmplt_ps(a, b); }
+    static M le(V a, V b){ return _mm_cmple_ps(a, b); }
+    static M eq(V a, V b){ return _mm_cmpeq_ps(a, b); }
+    static M nlt(V a, V b){ return _mm_cmpnlt_ps(a, b); }
+    static M ngt(V a, V b){ return _mm_cmpngt_ps(a, b); }
+    static M mand(M a, M b){ return _mm_and_ps(a, b); }
+    static M mor(M a, M b){ return _mm_or_ps(a, b); }
+    static V blend(V a, V b, M m){ return _mm_or_ps(_mm_and_ps(m, b), _mm_andnot_ps(m, a)); }
+    static bool any(M m){ return _mm_movemask_ps(m); }
+};
+#include "packet_kernel.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+struct Simd {
+    typedef __m256 V;
+    typedef __m256 M;
+    static constexpr int W = 8;
+    static V set1(float a){ return _mm256_set1_ps(a); }
+    static V load(const float *p){ return _mm256_load_ps(p); }
+    static void store(float *p, V a){ _mm256_store_ps(p, a); }
+    static V add(V a, V b){ return _mm256_add_ps(a, b); }
+    static V sub(V a, V b){ return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b){ return _mm256_mul_ps(a, b); }
+    static V sqrt(V a){ return _mm256_sqrt_ps(a); }
+    static V min(V a, V b){ return _mm256_min_ps(a, b); }
+    static V max(V a, V b){ return _mm256_max_ps(a, b); }
+    static M lt(V a, V b){ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static M le(V a, V b){ return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static M eq(V a, V b){ return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static M nlt(V a, V b){ return _mm256_cmp_ps(a, b, _CMP_NLT_UQ); }
+    static M ngt(V a, V b){ return _mm256_cmp_ps(a, b, _CMP_NGT_UQ); }
+    static M mand(M a, M b){ return _mm256_and_ps(a, b); }
+    static M mor(M a, M b){ return _mm256_or_ps(a, b); }
+    static V blend(V a, V b, M m){ return _mm256_blendv_ps(a, b, m); }
+    static bool any(M m){ return _mm256_movemask_ps(m); }
+};
+#include "packet_kernel.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// avx512f brings fma, multiplications and additions must stay separate to round like the scalar code
+#pragma GCC optimize("fp-contract=off")
+// gcc 12 warns about the masked builtins used by its own avx512 headers
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+namespace avx512 {
+struct Simd {
+    typedef __m512 V;
+    typedef __mmask16 M;
+    static constexpr int W = 16;
+    static V set1(float a){ return _mm512_set1_ps(a); }
+    static V load(const float *p){ return _mm512_load_ps(p); }
+    static void store(float *p, V a){ _mm512_store_ps(p, a); }
+    static V add(V a, V b){ return _mm512_add_ps(a, b); }
+    static V sub(V a, V b){ return _mm512_sub_ps(a, b); }
+    static V mul(V a, V b){ return _mm512_mul_ps(a, b); }
+    static V sqrt(V a){ return _mm512_sqrt_ps(a); }
+    static V min(V a, V b){ return _mm512_min_ps(a, b); }
+    static V max(V a, V b){ return _mm512_max_ps(a, b); }
+    static M lt(V a, V b){ return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static M le(V a, V b){ return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static M eq(V a, V b){ return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    static M nlt(V a, V b){ return _mm512_cmp_ps_mask(a, b, _CMP_NLT_UQ); }
+    static M ngt(V a, V b){ return _mm512_cmp_ps_mask(a, b, _CMP_NGT_UQ); }
+    static M mand(M a, M b){ return a & b; }
+    static M mor(M a, M b){ return a | b; }
+    static V blend(V a, V b, M m){ return _mm512_mask_blend_ps(m, a, b); }
+    static bool any(M m){ return m; }
+};
+#include "packet_kernel.h"
+}
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+// picks the widest instruction set the cpu supports, TRACE_SIMD=scalar|sse2|avx2|avx512 overrides the choice
+static PacketKernel pick_packet_kernel(){
+    const char *forced = std::getenv("TRACE_SIMD");
+    std::string isa = forced ? forced : "";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ((isa.empty() || isa == "avx512") && __builtin_cpu_supports("avx512f")) return avx512::closest_hits;
+    if ((isa.empty() || isa == "avx512" || isa == "avx2") && __builtin_cpu_supports("avx2")) return avx2::closest_hits;
+    if ((isa.empty() || isa == "avx512" || isa == "avx2" || isa == "sse2") && __builtin_cpu_supports("sse2")) return sse2::closest_hits;
+#endif
+    return closest_hits_scalar;
+}
+
+static const PacketKernel packet_kernel = pick_packet_kernel();
+
+void packet_closest_hit(const Scene &scene, const Vec3f &rayOrig, const RayPacket &packet, int *hit, float *tnear){
+    if (!packet_tracing_enabled(scene)){
+        closest_hits_scalar(scene, rayOrig, packet, hit, tnear);
+        return;
+    }
+    packet_kernel(scene, rayOrig, packet, hit, tnear);
+    // the vector kernels only know spheres, the triangles are then intersected ray by ray
+    if (!scene.meshes.empty())
+        for (int i = 0; i < packet.n; i++)
+            closest_mesh_hit(scene, rayOrig, Vec3f(packet.x[i], packet.y[i], packet.z[i]), tnear[i], hit[i]);
+}
+
+bool packet_tracing_enabled(const Scene &scene){
+    return packet_kernel != closest_hits_scalar && scene.spheres.size() <= PACKET_MAX_SPHERES;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "geometry.h"
+#include "scene.h"
+
+// largest number of rays traced together
+constexpr int PACKET_SIZE = 16;
+
+// directions of up to PACKET_SIZE rays, in structure of arrays layout
+struct RayPacket {
+    int n = 0;
+    alignas(64) float x[PACKET_SIZE], y[PACKET_SIZE], z[PACKET_SIZE];
+};
+
+// finds the closest sphere or triangle hit by each ray of the packet, all starting at rayOrig, with exactly the
+// results of closest_hit(): hit[i] is the index of the sphere or triangle (or -1) and tnear[i] its distance
+// the rays are intersected 16, 8 or 4 at a time with AVX-512, AVX2 or SSE2 depending on the cpu
+// (set TRACE_SIMD=scalar|sse2|avx2|avx512 to force an ISA, with scalar the rays are traced one by one)
+void packet_closest_hit(const Scene &scene, const Vec3f &rayOrig, const RayPacket &packet, int *hit, float *tnear);
+
+// false when the packets of the scene would be traced one ray at a time anyway, so callers can skip building them:
+// on cpus without vector kernels, and for scenes of more than PACKET_MAX_SPHERES spheres
+bool packet_tracing_enabled(const Scene &scene);
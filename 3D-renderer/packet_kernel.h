@@ -0,0 +1,96 @@
+// closest hits of a packet of rays, written once for every instruction set: packet.cpp includes this file
+// in a namespace providing 'Simd', the lane operations of one instruction set, and compiles it for that set
+// no include guard on purpose
+
+// spheres are tested against Simd::W rays at once, the rays share their origin so everything that only
+// depends on the sphere is computed once in scalar, with the same operations as Sphere::intersect
+static void closest_hits(const Scene &scene, const Vec3f &rayOrig, const RayPacket &packet, int *hit, float *tnear){
+    typedef Simd::V V;
+    typedef Simd::M M;
+    constexpr int W = Simd::W;
+    const SphereSoA &soa = scene.packed;
+    const std::vector<BVHNode> &nodes = scene.bvh.nodes;
+    long long tests = 0; // ray-sphere tests done (in every lane) for the profile
+
+    for (int first = 0; first < packet.n; first += W){
+        // lanes past the end of the packet repeat its first ray
+        alignas(64) float lane[3][W], inv[3][W];
+        for (int i = 0; i < W; i++){
+            const int r = first + i < packet.n ? first + i : 0;
+            lane[0][i] = packet.x[r], lane[1][i] = packet.y[r], lane[2][i] = packet.z[r];
+            for (int k = 0; k < 3; k++){
+                // same as the scalar slab test, a zero component gets a huge but finite inverse
+                float d = lane[k][i];
+                inv[k][i] = 1.f / (d != 0 ? d : std::copysign(1e-30f, d));
+            }
+        }
+        const V dx = Simd::load(lane[0]), dy = Simd::load(lane[1]), dz = Simd::load(lane[2]);
+        const V zero = Simd::set1(0);
+        // the sphere index is kept as a float, packet_tracing_enabled() keeps the scenes within PACKET_MAX_SPHERES
+        V best = Simd::set1(INFINITY), bestHit = Simd::set1(-1);
+
+        auto test_sphere = [&](const int i){
+            tests += W;
+            const float lx = soa.x[i] - rayOrig.x, ly = soa.y[i] - rayOrig.y, lz = soa.z[i] - rayOrig.z;
+            const V tca = Simd::add(Simd::add(Simd::mul(Simd::set1(lx), dx), Simd::mul(Simd::set1(ly), dy)),
+                                    Simd::mul(Simd::set1(lz), dz));
+            const V d2 = Simd::sub(Simd::set1(lx * lx + ly * ly + lz * lz), Simd::mul(tca, tca));
+            const V radius2 = Simd::set1(soa.radius2[i]);
+            const M valid = Simd::mand(Simd::nlt(tca, zero), Simd::ngt(d2, radius2));
+            if (!Simd::any(valid)) return;
+            const V thc = Simd::sqrt(Simd::sub(radius2, d2));
+            V t0 = Simd::sub(tca, thc);
+            const V t1 = Simd::add(tca, thc);
+            t0 = Simd::blend(t0, t1, Simd::lt(t0, zero)); // if the ray starts inside the sphere
+            const V index = Simd::set1(float(soa.index[i]));
+            const M closer = Simd::mand(valid, Simd::mor(Simd::lt(t0, best), Simd::mand(Simd::eq(t0, best), Simd::lt(index, bestHit))));
+            best = Simd::blend(best, t0, closer);
+            bestHit = Simd::blend(bestHit, index, closer);
+        };
+
+        if (nodes.empty()){
+            for (int i = 0; i < (int)soa.x.size(); i++) test_sphere(i);
+        }
+        else {
+            const V ix = Simd::load(inv[0]), iy = Simd::load(inv[1]), iz = Simd::load(inv[2]);
+            const V widen = Simd::set1(1 + 2 * 3 * FLT_EPSILON);
+            // true if the node is entered by any ray before its closest hit so far
+            auto visit = [&](const BVHNode &node){
+                const V ox = Simd::set1(rayOrig.x), oy = Simd::set1(rayOrig.y), oz = Simd::set1(rayOrig.z);
+                V ax = Simd::mul(Simd::sub(Simd::set1(node.bmin[0]), ox), ix), bx = Simd::mul(Simd::sub(Simd::set1(node.bmax[0]), ox), ix);
+                V ay = Simd::mul(Simd::sub(Simd::set1(node.bmin[1]), oy), iy), by = Simd::mul(Simd::sub(Simd::set1(node.bmax[1]), oy), iy);
+                V az = Simd::mul(Simd::sub(Simd::set1(node.bmin[2]), oz), iz), bz = Simd::mul(Simd::sub(Simd::set1(node.bmax[2]), oz), iz);
+                V t0 = Simd::max(Simd::max(Simd::max(zero, Simd::min(ax, bx)), Simd::min(ay, by)), Simd::min(az, bz));
+                V t1 = Simd::min(Simd::min(Simd::min(best, Simd::mul(Simd::max(ax, bx), widen)),
+                                           Simd::mul(Simd::max(ay, by), widen)), Simd::mul(Simd::max(az, bz), widen));
+                return Simd::any(Simd::le(t0, t1));
+            };
+
+            int stack[BVH_STACK_SIZE];
+            int top = 0;
+            stack[top++] = 0;
+            while (top){
+                const BVHNode &node = nodes[stack[--top]];
+                if (!visit(node)) continue;
+                if (node.count){
+                    for (int i = node.offset; i < node.offset + node.count; i++) test_sphere(i);
+                    continue;
+                }
+                // the child nearer along the first ray is visited first
+                int near = &node - nodes.data() + 1, far = node.offset;
+                if (lane[node.axis][0] < 0) std::swap(near, far);
+                stack[top++] = far;
+                stack[top++] = near;
+            }
+        }
+
+        alignas(64) float outT[W], outHit[W];
+        Simd::store(outT, best);
+        Simd::store(outHit, bestHit);
+        for (int i = 0; i < W && first + i < packet.n; i++){
+            tnear[first + i] = outT[i];
+            hit[first + i] = outHit[i];
+        }
+    }
+    PROFILE_COUNT("sphere tests", tests);
+}
@@ -0,0 +1,182 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <omp.h>
+
+#include "framebuffer.h"
+#include "framestate.h"
+#include "scene.h"
+#include "sceneloader.h"
+#include "tracer.h"
+#include "../2D-renderer/profiler.h"
+
+// the scene rendered when no scene file is given
+static void default_scene(Scene &scene){
+    std::vector<Sphere> &spheres = scene.spheres;
+    spheres.clear();
+    // first sphere acts as the ground
+    spheres.push_back(Sphere(Vec3f(0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0.0, 0));
+    // red sphere
+    spheres.push_back(Sphere(Vec3f(2, 1, -40), 5, Vec3f(1.00, 0.32, 0.36), 0.2, 1));
+    // yellow sphere
+    spheres.push_back(Sphere(Vec3f(5, -2, -25), 2, Vec3f(0.98, 0.73, 0.01), 0.5, 1));
+    // floating sphere
+    spheres.push_back(Sphere(Vec3f(7, 4, -19), 3, Vec3f(0.98, 0.73, 0.01), 0.2, 1));
+    // light blue sphere
+    spheres.push_back(Sphere(Vec3f(-2, 0, -30), 4, Vec3f(0.30, 0.78, 1.00), 0.2, 1));
+    // dark sphere
+    spheres.push_back(Sphere(Vec3f(-6, 0, -20), 4, Vec3f(0.15, 0.15, 0.15), 0.0, 1));
+    // light sources
+    spheres.push_back(Sphere(Vec3f(10, 20, -10), 3, Vec3f(0.00, 0.00, 0.00), 0.0, 0, Vec3f(5)));
+    spheres.push_back(Sphere(Vec3f(-3, 20, -5), 3, Vec3f(0.00, 0.00, 0.00), 0.0, 0, Vec3f(3)));
+}
+
+// name of the image rendered from a scene file: the name of the file without its directory and extension
+static std::string output_name(const std::string &sceneFile, const std::string &extension){
+    size_t slash = sceneFile.find_last_of('/');
+    std::string base = slash == std::string::npos ? sceneFile : sceneFile.substr(slash + 1);
+    size_t dot = base.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) base.resize(dot);
+    return base + extension;
+}
+
+static double seconds_since(const std::chrono::steady_clock::time_point &start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv){
+    Scene scene;
+    RenderSettings defaults;
+    defaults.nthreads = omp_get_max_threads();
+    bool useBVH = true;
+    bool progressive = false;
+    bool incremental = false;
+    ProgressiveSettings sampling;
+    int previewEvery = 0;
+    std::string output, format = ".ppm", saveFile;
+    std::string profileFile, traceFile; // with a PROFILE build, where the profile and the chrome trace are written
+    ToneMapping toneMapping;
+    std::vector<std::string> sceneFiles;
+
+    for (int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) defaults.nthreads = std::max(1, atoi(argv[++i]));
+        else if (arg == "--no-bvh") useBVH = false;
+        else if (arg == "--mode" && i + 1 < argc && !strcmp(argv[i + 1], "recursive")) defaults.mode = TraceMode::RECURSIVE, i++;
+        else if (arg == "--mode" && i + 1 < argc && !strcmp(argv[i + 1], "iterative")) defaults.mode = TraceMode::ITERATIVE, i++;
+        else if (arg == "--mode" && i + 1 < argc && !strcmp(argv[i + 1], "wavefront")) defaults.mode = TraceMode::WAVEFRONT, i++;
+        else if (arg == "--min-weight" && i + 1 < argc) defaults.minWeight = atof(argv[++i]);
+        else if (arg == "--output" && i + 1 < argc) output = argv[++i];
+        else if (arg == "--tga") format = ".tga";
+        else if (arg == "--save" && i + 1 < argc) saveFile = argv[++i];
+        else if (arg == "--gamma" && i + 1 < argc) toneMapping.gamma = atof(argv[++i]);
+        else if (arg == "--reinhard") toneMapping.reinhard = true;
+        else if (arg == "--progressive") progressive = true;
+        else if (arg == "--incremental") incremental = true;
+        else if (arg == "--spp" && i + 1 < argc) sampling.maxSamples = std::max(1, atoi(argv[++i]));
+        else if (arg == "--min-spp" && i + 1 < argc) sampling.minSamples = std::max(1, atoi(argv[++i]));
+        else if (arg == "--tolerance" && i + 1 < argc) sampling.tolerance = atof(argv[++i]);
+        else if (arg == "--preview" && i + 1 < argc) previewEvery = std::max(0, atoi(argv[++i]));
+        else if (arg == "--profile" && i + 1 < argc) profileFile = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc) traceFile = argv[++i];
+        else if (arg.compare(0, 2, "--")) sceneFiles.push_back(arg);
+        else {
+            std::cout << "Usage: " << argv[0] << " [scene files...] [--output file.ppm|file.tga] [--tga] [--save file.bscene]"
+                " [--gamma g] [--reinhard] [--threads n] [--no-bvh] [--mode recursive|iterative|wavefront] [--min-weight w]"
+                " [--progressive [--spp max] [--min-spp min] [--tolerance t] [--preview every]] [--incremental]"
+                " [--profile profile.json] [--trace trace.json]" << std::endl;
+            return 1;
+        }
+    }
+    if ((!output.empty() || !saveFile.empty()) && sceneFiles.size() > 1){
+        std::cerr << "--output and --save need a single scene\n";
+        return 1;
+    }
+    if (incremental && progressive){
+        std::cerr << "--incremental re-renders the frames of render(), not progressive ones\n";
+        return 1;
+    }
+    if ((!profileFile.empty() || !traceFile.empty()) && !profiler::enabled())
+        std::cerr << "built without profiling, rebuild with make PROFILE=1\n";
+
+    // the scene files are rendered one after the other, reusing the buffers of the previous one
+    // with --incremental, they are taken as edits of one scene: each one only re-renders what changed since the
+    // previous one, over its image
+    std::vector<Vec3f> image;
+    FrameState frame;
+    const int njobs = std::max<int>(1, sceneFiles.size());
+    int failed = 0;
+    for (int job = 0; job < njobs; job++){
+        RenderSettings settings = defaults;
+        auto start = std::chrono::steady_clock::now();
+        std::string imageFile = output;
+        {
+            PROFILE_STAGE("scene load");
+            if (sceneFiles.empty()){
+                default_scene(scene);
+                if (imageFile.empty()) imageFile = "./result" + format;
+            }
+            else {
+                if (!load_scene(sceneFiles[job], scene, settings)){
+                    failed++;
+                    continue;
+                }
+                if (imageFile.empty()) imageFile = output_name(sceneFiles[job], format);
+            }
+        }
+        if (!saveFile.empty() && !save_scene(saveFile, scene, settings)) failed++;
+        scene.prepare(useBVH);
+        double loaded = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        image.resize(settings.width * settings.height);
+        if (progressive){
+            PROFILE_STAGE("render");
+            // with --preview n, the image so far is written every n passes
+            auto preview = [&](int pass, const Vec3f *image){
+                if (!previewEvery || pass % previewEvery) return;
+                std::string filename = output_name(imageFile, "") + "_pass" + std::to_string(pass) + format;
+                write_image(filename, image, settings.width, settings.height, toneMapping);
+            };
+            ProgressiveStats stats = render_progressive(scene, settings, sampling, image.data(), preview);
+            std::cout << stats.passes << " passes, " << double(stats.samples) / (settings.width * settings.height)
+                      << " samples per pixel on average" << std::endl;
+        }
+        else if (incremental){
+            PROFILE_STAGE("render");
+            IncrementalStats stats = render_incremental(scene, settings, frame, image.data());
+            std::cout << stats.dirtyTiles << " of " << stats.tiles << " tiles rendered, " << stats.reusedHits << " of "
+                      << stats.pixels << " pixels kept their primary hit" << std::endl;
+        }
+        else {
+            PROFILE_STAGE("render");
+            render(scene, settings, image.data());
+        }
+        {
+            PROFILE_STAGE("output");
+            if (!write_image(imageFile, image.data(), settings.width, settings.height, toneMapping)) failed++;
+        }
+
+        if (!sceneFiles.empty()){
+            std::cout << sceneFiles[job] << ": " << scene.spheres.size() << " spheres";
+            if (!scene.meshes.empty()){
+                size_t triangles = 0, memory = 0;
+                for (const TriangleMesh &mesh : scene.meshes) triangles += mesh.ntriangles(), memory += mesh.memory();
+                std::cout << " and " << triangles << " triangles (" << memory / (1 << 20) << " MB)";
+            }
+            std::cout << " loaded in " << loaded << " s, rendered in " << seconds_since(start) << " s to " << imageFile << std::endl;
+        }
+    }
+
+    if (profiler::enabled()){
+        if (!profileFile.empty() && !profiler::write_json(profileFile)) failed++;
+        if (!traceFile.empty() && !profiler::write_chrome_trace(traceFile)) failed++;
+    }
+    return failed ? 1 : 0;
+}
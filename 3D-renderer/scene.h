@@ -0,0 +1,64 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "bvh.h"
+#include "sphere.h"
+#include "trimesh.h"
+
+// the packet kernels carry sphere indices in float lanes, which are exact up to 2^24: larger scenes are traced ray
+// by ray, and are not packed
+constexpr int PACKET_MAX_SPHERES = 1 << 24;
+
+// the bounds of the spheres in structure of arrays layout, for the packet tracer
+// they are in the order of bvh.prims when there is a bvh (so the spheres of a leaf are contiguous), else in sphere order
+struct SphereSoA {
+    std::vector<float> x, y, z, radius2;
+    std::vector<int> index; // sphere each entry comes from
+};
+
+// an emissive sphere, lighting the diffuse surfaces
+struct Light {
+    int sphere; // index of the sphere, which does not cast shadows on its own light
+    Vec3f center, emission;
+};
+
+// the spheres and triangle meshes to render, with what is precomputed from them to speed up tracing
+// hits are numbered: sphere i is hit i, and the triangles of the meshes come after the spheres, the slots
+// of mesh m from meshFirstHit[m] on (see TriangleMesh::nslots())
+struct Scene {
+    std::vector<Sphere> spheres;
+    std::vector<TriangleMesh> meshes; // built when they are loaded, they always go through their own BVH
+    std::vector<int> meshFirstHit;
+    std::vector<Light> lights; // the emissive spheres, in order
+    BVH bvh;                 // if empty, rays are tested against every sphere
+    SphereSoA packed;
+
+    // the mesh a hit past the spheres is on, and the triangle in it
+    const TriangleMesh &mesh_hit(const int hit, int &triangle) const {
+        const int m = std::upper_bound(meshFirstHit.begin(), meshFirstHit.end(), hit) - meshFirstHit.begin() - 1;
+        triangle = hit - meshFirstHit[m];
+        return meshes[m];
+    }
+
+    // to be called once the spheres are added, and again whenever they change
+    void prepare(const bool useBVH = true){
+        lights.clear();
+        for (unsigned i = 0; i < spheres.size(); i++)
+            if (spheres[i].emissionColor.x > 0) lights.push_back({int(i), spheres[i].center, spheres[i].emissionColor});
+        if (useBVH) bvh.build(spheres);
+        else bvh = BVH();
+
+        const int n = spheres.size() <= PACKET_MAX_SPHERES ? spheres.size() : 0;
+        packed.x.resize(n), packed.y.resize(n), packed.z.resize(n), packed.radius2.resize(n), packed.index.resize(n);
+        for (int i = 0; i < n; i++){
+            const Sphere &s = spheres[bvh.empty() ? i : bvh.prims[i]];
+            packed.x[i] = s.center.x, packed.y[i] = s.center.y, packed.z[i] = s.center.z;
+            packed.radius2[i] = s.radius * s.radius;
+            packed.index[i] = bvh.empty() ? i : bvh.prims[i];
+        }
+
+        meshFirstHit.resize(meshes.size());
+        for (size_t m = 0, first = spheres.size(); m < meshes.size(); first += meshes[m].nslots(), m++) meshFirstHit[m] = first;
+    }
+};
@@ -0,0 +1,360 @@
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string_view>
+#include <vector>
+
+#include "sceneloader.h"
+
+// bump whenever the layout of the binary format changes
+constexpr std::uint32_t SCENE_FILE_VERSION = 2;
+// text is read this many bytes at a time, no line may be longer
+constexpr size_t TEXT_CHUNK = 1 << 20;
+// binary spheres are read this many at a time
+constexpr size_t SPHERE_CHUNK = 1 << 16;
+// largest image a scene may ask for, 3 GB of pixels
+constexpr std::uint64_t MAX_PIXELS = 1 << 28;
+
+// a resolution the image can be allocated for, and a field of view the camera can open
+static bool valid_resolution(const std::uint64_t width, const std::uint64_t height){
+    return width && height && width * height <= MAX_PIXELS;
+}
+
+static bool valid_fov(const float fov){
+    return fov > 0 && fov < 180;
+}
+
+#pragma pack(push,1)
+struct SceneFileHeader {
+    char magic[4] = {'S', 'C', 'N', 'B'};
+    std::uint32_t version = SCENE_FILE_VERSION;
+    std::uint32_t width = 0, height = 0;
+    float fov = 0;
+    float eye[3] = {0, 0, 0};
+    std::uint32_t nmaterials = 0;
+    std::uint64_t nspheres = 0;
+    std::uint32_t nmeshes = 0;
+};
+
+struct SceneFileMaterial {
+    float surface[3], transparency, reflection, emission[3];
+};
+
+struct SceneFileSphere {
+    float center[3], radius;
+    std::uint32_t material;
+};
+
+// followed by the path of the .obj file, meshes are rebuilt from it when the scene is loaded
+struct SceneFileMesh {
+    std::uint32_t material;
+    float scale, offset[3];
+    std::uint32_t pathLength;
+};
+#pragma pack(pop)
+
+// local to this file, the 2D renderer's mesh.h linked in with the .obj loader has a Material of its own
+namespace {
+struct Material {
+    Vec3f surface, emission = 0;
+    float transparency = 0, reflection = 0;
+};
+}
+
+static bool has_suffix(const std::string &s, const std::string &suffix){
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static const char *skip_blanks(const char *p, const char *end){
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+template<typename T>
+static bool parse_number(const char *&p, const char *end, T &value){
+    p = skip_blanks(p, end);
+    if (p < end && *p == '+') p++; // from_chars does not accept an explicit plus sign
+    auto [next, ec] = std::from_chars(p, end, value);
+    if (ec != std::errc()) return false;
+    p = next;
+    return true;
+}
+
+static bool parse_vec(const char *&p, const char *end, Vec3f &v){
+    return parse_number(p, end, v.x) && parse_number(p, end, v.y) && parse_number(p, end, v.z);
+}
+
+static std::string_view parse_word(const char *&p, const char *end){
+    p = skip_blanks(p, end);
+    const char *begin = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '#') p++;
+    return std::string_view(begin, p - begin);
+}
+
+// true if nothing but blanks or a comment is left on the line
+static bool at_end(const char *p, const char *end){
+    p = skip_blanks(p, end);
+    return p == end || *p == '#';
+}
+
+// state of the text parser, kept from one line to the next
+struct TextScene {
+    Scene &scene;
+    RenderSettings &settings;
+    std::filesystem::path directory; // mesh files are relative to the scene file
+    std::map<std::string, Material, std::less<>> materials;
+    std::string_view lastName; // the material of the previous sphere, spheres often come in runs sharing one
+    const Material *lastMaterial = nullptr;
+};
+
+// parses one statement, returns an error message or nullptr
+static const char *parse_line(const char *p, const char *end, TextScene &text){
+    std::string_view keyword = parse_word(p, end);
+    if (keyword.empty()) return at_end(p, end) ? nullptr : "unexpected character";
+
+    if (keyword == "sphere" || keyword == "light"){
+        Vec3f center;
+        float radius;
+        if (!parse_vec(p, end, center) || !parse_number(p, end, radius)) return "expected a center and a radius";
+        if (keyword == "light"){
+            Vec3f emission;
+            if (!parse_vec(p, end, emission)) return "expected an emission color";
+            text.scene.spheres.push_back(Sphere(center, radius, Vec3f(0), 0, 0, emission));
+        }
+        else {
+            std::string_view name = parse_word(p, end);
+            if (name.empty()) return "expected a material name";
+            if (!text.lastMaterial || name != text.lastName){
+                auto it = text.materials.find(name);
+                if (it == text.materials.end()) return "unknown material";
+                text.lastName = it->first;
+                text.lastMaterial = &it->second;
+            }
+            const Material &m = *text.lastMaterial;
+            text.scene.spheres.push_back(Sphere(center, radius, m.surface, m.transparency, m.reflection, m.emission));
+        }
+    }
+    else if (keyword == "mesh"){
+        std::string_view file = parse_word(p, end), name = parse_word(p, end);
+        if (file.empty() || name.empty()) return "expected a file and a material name";
+        auto it = text.materials.find(name);
+        if (it == text.materials.end()) return "unknown material";
+        float scale = 1;
+        Vec3f offset(0);
+        if (!at_end(p, end) && !parse_number(p, end, scale)) return "expected a scale";
+        if (!at_end(p, end) && !parse_vec(p, end, offset)) return "expected an offset";
+        TriangleMesh mesh;
+        if (!load_obj_mesh((text.directory / file).string(), scale, offset, mesh)) return "can't load the mesh";
+        const Material &m = it->second;
+        mesh.surfaceColor = m.surface, mesh.emissionColor = m.emission;
+        mesh.transparency = m.transparency, mesh.reflection = m.reflection;
+        text.scene.meshes.push_back(std::move(mesh));
+    }
+    else if (keyword == "material"){
+        std::string_view name = parse_word(p, end);
+        Material m;
+        if (name.empty() || !parse_vec(p, end, m.surface) || !parse_number(p, end, m.transparency) ||
+            !parse_number(p, end, m.reflection)) return "expected a name, a color, a transparency and a reflection";
+        if (!at_end(p, end) && !parse_vec(p, end, m.emission)) return "expected an emission color";
+        text.materials[std::string(name)] = m;
+        text.lastMaterial = nullptr; // it may have replaced the cached one
+    }
+    else if (keyword == "resolution"){
+        unsigned width, height;
+        if (!parse_number(p, end, width) || !parse_number(p, end, height) || !valid_resolution(width, height))
+            return "expected a width and a height";
+        text.settings.width = width, text.settings.height = height;
+    }
+    else if (keyword == "fov"){
+        if (!parse_number(p, end, text.settings.fov) || !valid_fov(text.settings.fov)) return "expected an angle";
+    }
+    else if (keyword == "eye"){
+        if (!parse_vec(p, end, text.settings.eye)) return "expected a position";
+    }
+    else return "unknown statement";
+
+    return at_end(p, end) ? nullptr : "unexpected text at the end of the line";
+}
+
+static bool load_text_scene(const std::string &filename, Scene &scene, RenderSettings &settings){
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()){
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    TextScene text{scene, settings, std::filesystem::path(filename).parent_path()};
+    std::vector<char> buffer(TEXT_CHUNK);
+    size_t kept = 0; // bytes of an unfinished line, moved to the front of the buffer
+    long long lineNumber = 0;
+    bool eof = false;
+    while (!eof){
+        in.read(buffer.data() + kept, buffer.size() - kept);
+        size_t size = kept + in.gcount();
+        eof = !in;
+        const char *p = buffer.data(), *end = buffer.data() + size;
+        while (p < end){
+            const char *eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+            if (!eol){
+                if (!eof) break; // the rest of the line comes with the next chunk
+                eol = end;
+            }
+            lineNumber++;
+            if (const char *error = parse_line(p, eol, text)){
+                std::cerr << filename << ":" << lineNumber << ": " << error << "\n";
+                return false;
+            }
+            p = eol + 1;
+        }
+        kept = p < end ? end - p : 0;
+        if (kept == buffer.size()){
+            std::cerr << filename << ":" << lineNumber + 1 << ": line too long\n";
+            return false;
+        }
+        std::memmove(buffer.data(), p, kept);
+    }
+    return true;
+}
+
+static bool load_binary_scene(const std::string &filename, Scene &scene, RenderSettings &settings){
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()){
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    SceneFileHeader header;
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, SceneFileHeader().magic, 4) || header.version != SCENE_FILE_VERSION){
+        std::cerr << filename << ": not a binary scene of version " << SCENE_FILE_VERSION << "\n";
+        return false;
+    }
+    if (!valid_resolution(header.width, header.height) || !valid_fov(header.fov)){
+        std::cerr << filename << ": invalid resolution or field of view\n";
+        return false;
+    }
+    // the counts of a damaged header are caught by the size of the file, before anything is allocated for them
+    std::error_code error;
+    std::uint64_t left = std::filesystem::file_size(filename, error);
+    left = error ? 0 : left - sizeof(header);
+    auto take = [&](const std::uint64_t count, const std::uint64_t bytes){
+        if (count > left / bytes) return false;
+        left -= count * bytes;
+        return true;
+    };
+    if (!take(header.nmaterials, sizeof(SceneFileMaterial)) || !take(header.nspheres, sizeof(SceneFileSphere)) ||
+        !take(header.nmeshes, sizeof(SceneFileMesh))){
+        std::cerr << filename << ": file is truncated\n";
+        return false;
+    }
+    std::vector<SceneFileMaterial> materials(header.nmaterials);
+    in.read(reinterpret_cast<char *>(materials.data()), materials.size() * sizeof(SceneFileMaterial));
+
+    std::vector<SceneFileSphere> chunk(std::min<std::uint64_t>(header.nspheres, SPHERE_CHUNK));
+    for (std::uint64_t done = 0; in && done < header.nspheres; done += chunk.size()){
+        chunk.resize(std::min<std::uint64_t>(header.nspheres - done, SPHERE_CHUNK));
+        in.read(reinterpret_cast<char *>(chunk.data()), chunk.size() * sizeof(SceneFileSphere));
+        if (!in) break;
+        for (const SceneFileSphere &s : chunk){
+            if (s.material >= materials.size()){
+                std::cerr << filename << ": sphere " << done + (&s - chunk.data()) << " has an invalid material\n";
+                return false;
+            }
+            const SceneFileMaterial &m = materials[s.material];
+            scene.spheres.push_back(Sphere(Vec3f(s.center[0], s.center[1], s.center[2]), s.radius,
+                                           Vec3f(m.surface[0], m.surface[1], m.surface[2]), m.transparency, m.reflection,
+                                           Vec3f(m.emission[0], m.emission[1], m.emission[2])));
+        }
+    }
+    for (std::uint32_t i = 0; in && i < header.nmeshes; i++){
+        SceneFileMesh record;
+        in.read(reinterpret_cast<char *>(&record), sizeof(record));
+        if (in && !take(record.pathLength, 1)) in.setstate(std::ios::failbit);
+        std::string path(in ? record.pathLength : 0, '\0');
+        in.read(path.data(), path.size());
+        if (!in) break;
+        if (record.material >= materials.size()){
+            std::cerr << filename << ": mesh " << i << " has an invalid material\n";
+            return false;
+        }
+        TriangleMesh mesh;
+        if (!load_obj_mesh(path, record.scale, Vec3f(record.offset[0], record.offset[1], record.offset[2]), mesh))
+            return false;
+        const SceneFileMaterial &m = materials[record.material];
+        mesh.surfaceColor = Vec3f(m.surface[0], m.surface[1], m.surface[2]);
+        mesh.emissionColor = Vec3f(m.emission[0], m.emission[1], m.emission[2]);
+        mesh.transparency = m.transparency, mesh.reflection = m.reflection;
+        scene.meshes.push_back(std::move(mesh));
+    }
+    if (!in){
+        std::cerr << filename << ": file is truncated\n";
+        return false;
+    }
+    settings.width = header.width, settings.height = header.height, settings.fov = header.fov;
+    settings.eye = Vec3f(header.eye[0], header.eye[1], header.eye[2]);
+    return true;
+}
+
+bool load_scene(const std::string &filename, Scene &scene, RenderSettings &settings){
+    scene.spheres.clear();
+    scene.meshes.clear();
+    if (has_suffix(filename, ".bscene")) return load_binary_scene(filename, scene, settings);
+    return load_text_scene(filename, scene, settings);
+}
+
+bool save_scene(const std::string &filename, const Scene &scene, const RenderSettings &settings){
+    SceneFileHeader header;
+    header.width = settings.width, header.height = settings.height, header.fov = settings.fov;
+    header.eye[0] = settings.eye.x, header.eye[1] = settings.eye.y, header.eye[2] = settings.eye.z;
+    header.nspheres = scene.spheres.size();
+    header.nmeshes = scene.meshes.size();
+
+    std::map<std::array<float, 8>, std::uint32_t> index;
+    std::vector<SceneFileMaterial> materials;
+    // spheres and meshes share the table of materials
+    auto material = [&](const auto &object){
+        const SceneFileMaterial m = {{object.surfaceColor.x, object.surfaceColor.y, object.surfaceColor.z},
+                                     object.transparency, object.reflection,
+                                     {object.emissionColor.x, object.emissionColor.y, object.emissionColor.z}};
+        std::array<float, 8> key;
+        std::memcpy(key.data(), &m, sizeof(m));
+        auto [it, added] = index.emplace(key, materials.size());
+        if (added) materials.push_back(m);
+        return it->second;
+    };
+    std::vector<SceneFileSphere> spheres(scene.spheres.size());
+    for (size_t i = 0; i < scene.spheres.size(); i++){
+        const Sphere &s = scene.spheres[i];
+        spheres[i] = {{s.center.x, s.center.y, s.center.z}, s.radius, material(s)};
+    }
+    // mesh paths are made absolute, the binary scene may be saved anywhere
+    std::vector<SceneFileMesh> meshes(scene.meshes.size());
+    std::vector<std::string> paths(scene.meshes.size());
+    for (size_t i = 0; i < scene.meshes.size(); i++){
+        const TriangleMesh &mesh = scene.meshes[i];
+        paths[i] = std::filesystem::absolute(mesh.source).string();
+        meshes[i] = {material(mesh), mesh.scale, {mesh.offset.x, mesh.offset.y, mesh.offset.z}, std::uint32_t(paths[i].size())};
+    }
+    header.nmaterials = materials.size();
+
+    std::ofstream out(filename, std::ios::binary);
+    if (!out.is_open()){
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(materials.data()), materials.size() * sizeof(SceneFileMaterial));
+    out.write(reinterpret_cast<const char *>(spheres.data()), spheres.size() * sizeof(SceneFileSphere));
+    for (size_t i = 0; i < meshes.size(); i++){
+        out.write(reinterpret_cast<const char *>(&meshes[i]), sizeof(SceneFileMesh));
+        out.write(paths[i].data(), paths[i].size());
+    }
+    if (!out.good()){
+        std::cerr << "can't dump the scene file\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+
+#include "scene.h"
+#include "tracer.h"
+
+// loads the spheres and meshes of a scene description into scene, replacing the previous ones (the buffer of the
+// spheres is reused),
+// and the camera and image settings it gives into settings, the others are left as they are
+// scene.prepare() still has to be called before rendering
+// files ending in .bscene are binary (see save_scene()), anything else is text with one statement per line:
+//   resolution <width> <height>   (at most 2^28 pixels)
+//   fov <degrees>                 (between 0 and 180, exclusive)
+//   eye <x> <y> <z>
+//   material <name> <r> <g> <b> <transparency> <reflection> [<emission r> <g> <b>]
+//   sphere <x> <y> <z> <radius> <material name>
+//   light <x> <y> <z> <radius> <emission r> <g> <b>
+//   mesh <file.obj> <material name> [<scale> [<offset x> <y> <z>]]
+// and # starting a comment; materials must be defined before the spheres and meshes using them, and the path of
+// a mesh is relative to the directory of the scene file
+// both formats are read in fixed-size chunks, so a scene of millions of spheres is never held twice in memory
+bool load_scene(const std::string &filename, Scene &scene, RenderSettings &settings);
+
+// writes the scene and its camera and image settings in the binary format, where the spheres and meshes sharing
+// a material point to a single copy of it, and meshes are kept as the path of their .obj file
+bool save_scene(const std::string &filename, const Scene &scene, const RenderSettings &settings);
@@ -0,0 +1,41 @@
+#include "scheduler.h"
+
+WorkStealingScheduler::WorkStealingScheduler(const int ntasks, const int nthreads) : ranges(nthreads) {
+    for (int t = 0; t < nthreads; t++)
+        ranges[t].bounds = pack((long long)ntasks * t / nthreads, (long long)ntasks * (t + 1) / nthreads);
+}
+
+int WorkStealingScheduler::next(const int thread){
+    std::atomic<std::uint64_t> &bounds = ranges[thread].bounds;
+    do {
+        std::uint64_t b = bounds.load();
+        while (std::uint32_t(b >> 32) < std::uint32_t(b)){
+            std::uint32_t begin = b >> 32, end = b;
+            if (bounds.compare_exchange_weak(b, pack(begin + 1, end))) return begin;
+        }
+    } while (steal(thread));
+    return -1;
+}
+
+bool WorkStealingScheduler::steal(const int thread){
+    for (;;){
+        // pick the victim with the most work left
+        int victim = -1;
+        std::uint64_t vb = 0;
+        std::uint32_t most = 0;
+        for (int t = 0; t < (int)ranges.size(); t++){
+            std::uint64_t b = ranges[t].bounds.load();
+            std::uint32_t left = std::uint32_t(b >> 32) < std::uint32_t(b) ? std::uint32_t(b) - std::uint32_t(b >> 32) : 0;
+            if (t != thread && left > most) victim = t, vb = b, most = left;
+        }
+        if (victim < 0) return false;
+
+        // take the back half, the victim keeps the front
+        std::uint32_t begin = vb >> 32, end = vb, mid = begin + most / 2;
+        if (ranges[victim].bounds.compare_exchange_strong(vb, pack(begin, mid))){
+            // only the owner ever refills its own (empty) range, so a plain store is enough
+            ranges[thread].bounds.store(pack(mid, end));
+            return true;
+        }
+    }
+}
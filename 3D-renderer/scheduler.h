@@ -0,0 +1,25 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// hands out the indices [0, ntasks) to a team of nthreads threads
+// every thread starts with its own contiguous share of the tasks and takes them from the front;
+// once it runs out, it steals the back half of the largest remaining share of another thread
+// so threads that got cheap tasks keep helping the ones that got expensive tasks
+class WorkStealingScheduler {
+public:
+    WorkStealingScheduler(const int ntasks, const int nthreads);
+
+    // the next task for the given thread, or -1 once every task has been handed out
+    int next(const int thread);
+private:
+    // [begin, end) packed into one word, so both ends can be moved with a single compare-and-swap
+    struct alignas(64) Range {
+        std::atomic<std::uint64_t> bounds{0};
+    };
+    static std::uint64_t pack(const std::uint32_t begin, const std::uint32_t end) { return std::uint64_t(begin) << 32 | end; }
+
+    bool steal(const int thread);
+    std::vector<Range> ranges;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include "geometry.h"
+
+class Sphere {
+public:
+    Vec3f center;
+    float radius;
+    Vec3f surfaceColor, emissionColor;
+    float transparency, reflection;
+
+    // constructor
+    Sphere(
+        const Vec3f &c,
+        const float &r,
+        const Vec3f &sc,
+        const float &transp = 0,
+        const float &refl = 0,
+        const Vec3f &ec = 0
+    ) : center(c), radius(r), surfaceColor(sc), emissionColor(ec), transparency(transp), reflection(refl) {}
+
+    // checks if a ray with origin 'rayOrig' and direction 'rayDir' intersects the sphere
+    // the points in the ray where it enters and leaves the sphere are stored in t0 and t1, respectively
+    bool intersect(const Vec3f &rayOrig, const Vec3f &rayDir, float &t0, float &t1) const {
+        Vec3f l = center - rayOrig;
+        float tca = l.dot(rayDir); // distance given by projecting l onto ray
+        if (tca < 0) return false; // ray is pointing away from the sphere
+        float d2 = l.dot(l) - tca * tca; // perpendicular distance from center to ray squared
+        if (d2 > radius * radius) return false; // ray is completely outside the sphere
+        float thc = sqrt(radius * radius - d2); // half of the part of the ray that passes through the sphere
+        // now we find the intersections 
+        t0 = tca - thc; 
+        t1 = tca + thc;
+        return true;
+    }
+};
@@ -0,0 +1,681 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <omp.h>
+
+#include "framestate.h"
+#include "packet.h"
+#include "scheduler.h"
+#include "tracer.h"
+#include "../2D-renderer/profiler.h"
+
+// side (in pixels) of the square tiles the image is split into for rendering
+#define TILE_SIZE 16
+static_assert(TILE_SIZE <= PACKET_SIZE, "a row of a tile is traced as one packet");
+
+static float lerp(const float &a, const float &b, const float &mix){
+    return b * mix + a * (1 - mix);
+}
+
+// rays traced by the calling thread, for the throughput reported by render() and render_progressive()
+static thread_local long long raysTraced = 0;
+
+// where render_incremental() has the rays of the tile of the calling thread logged, null when they are not
+static thread_local RayLog *rayLog = nullptr;
+// the object the rays about to be traced by trace() leave from, -1 for the eye
+static thread_local int rayParent = -1;
+
+// the hit of a primary ray that is not known yet
+constexpr int UNKNOWN_HIT = -2;
+
+static int closest_sphere_hit(const Scene &scene, const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear){
+    const std::vector<Sphere> &spheres = scene.spheres;
+    if (!scene.bvh.empty()) return scene.bvh.closest_hit(spheres, rayOrig, rayDir, tnear);
+
+    tnear = INFINITY;
+    int hit = -1;
+    PROFILE_COUNT("sphere tests", spheres.size());
+    for (unsigned i = 0; i < spheres.size(); i++){
+        float t0 = INFINITY;
+        float t1 = INFINITY;
+
+        if (spheres[i].intersect(rayOrig, rayDir, t0, t1)){
+            if (t0 < 0) t0 = t1; // if the ray starts inside the sphere
+            if (t0 < tnear){ // store closest intersection
+                tnear = t0;
+                hit = i;
+            }
+        }
+    }
+    return hit;
+}
+
+void closest_mesh_hit(const Scene &scene, const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear, int &hit){
+    for (size_t m = 0; m < scene.meshes.size(); m++){
+        const int triangle = scene.meshes[m].closest_hit(rayOrig, rayDir, tnear);
+        if (triangle >= 0) hit = scene.meshFirstHit[m] + triangle;
+    }
+}
+
+int closest_hit(const Scene &scene, const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear){
+    int hit = closest_sphere_hit(scene, rayOrig, rayDir, tnear);
+    if (!scene.meshes.empty()) closest_mesh_hit(scene, rayOrig, rayDir, tnear, hit);
+    return hit;
+}
+
+Vec3f trace(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, const int &depth){
+    float tnear;
+    int hit;
+    {
+        PROFILE_TIMER("secondary rays");
+        hit = closest_hit(scene, rayOrig, rayDir, tnear);
+    }
+    raysTraced++;
+    return shade(rayOrig, rayDir, scene, hit, tnear, depth);
+}
+
+// offset applied to the origin of rays leaving a surface, so they do not hit it again
+constexpr float RAY_BIAS = 1e-4;
+
+// where a ray hits a sphere or a triangle, with the material of the object
+struct SurfaceHit {
+    int object;          // numbered as in object_of()
+    Vec3f point, normal; // the normal faces the incoming ray
+    bool inside;         // the ray comes from inside the object
+    Vec3f surfaceColor, emissionColor;
+    float transparency, reflection;
+};
+
+template<typename Object>
+static void set_material(SurfaceHit &surface, const Object &object){
+    surface.surfaceColor = object.surfaceColor, surface.emissionColor = object.emissionColor;
+    surface.transparency = object.transparency, surface.reflection = object.reflection;
+}
+
+// 'hit' is a sphere, or a triangle of a mesh (see Scene)
+static SurfaceHit surface_hit(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, const int hit, const float tnear){
+    SurfaceHit surface;
+    surface.point = rayOrig + rayDir * tnear; // point (coordinates) of intersection
+    if (hit < (int)scene.spheres.size()){
+        const Sphere &sphere = scene.spheres[hit];
+        surface.object = hit;
+        set_material(surface, sphere);
+        surface.normal = surface.point - sphere.center; // normal at the point of intersection
+        surface.normal.normalize();
+    }
+    else {
+        // meshes are taken to be closed, a ray leaving through the back of a triangle comes from inside
+        int triangle;
+        const TriangleMesh &mesh = scene.mesh_hit(hit, triangle);
+        surface.object = scene.spheres.size() + (&mesh - scene.meshes.data());
+        set_material(surface, mesh);
+        surface.normal = mesh.normal(triangle);
+    }
+    surface.inside = false;
+
+    // if the directions of the ray and normal are not opposite, we are inside the sphere
+    if (rayDir.dot(surface.normal) > 0){
+        surface.normal = -surface.normal;
+        surface.inside = true;
+    }
+    return surface;
+}
+
+// reflective and transparent surfaces spawn secondary rays, until the maximum depth is reached
+static bool spawns_rays(const SurfaceHit &surface, const int depth){
+    return (surface.transparency > 0 || surface.reflection > 0) && depth < MAX_RAY_DEPTH;
+}
+
+// share of the light that is reflected rather than refracted
+static float fresnel(const Vec3f &rayDir, const SurfaceHit &surface){
+    float facingRatio = -rayDir.dot(surface.normal);
+    return lerp(pow(1 - facingRatio, 3), 1, 0.1);
+}
+
+static Vec3f reflected(const Vec3f &rayDir, const SurfaceHit &surface){
+    Vec3f reflDir = rayDir - surface.normal * 2 * rayDir.dot(surface.normal);
+    reflDir.normalize();
+    return reflDir;
+}
+
+static Vec3f refracted(const Vec3f &rayDir, const SurfaceHit &surface){
+    float indexOfRefraction = 1.1;
+    float eta = (surface.inside) ? indexOfRefraction : 1 / indexOfRefraction; // ratio of refractive indices
+    float cosi = -surface.normal.dot(rayDir); // angle between surface normal and incoming ray
+    float k = 1 - eta * eta * (1 - cosi * cosi);
+    Vec3f refrDir = rayDir * eta + surface.normal * (eta * cosi - sqrt(k));
+    refrDir.normalize();
+    return refrDir;
+}
+
+// for every light, the sphere that last blocked a shadow ray of this thread toward it: the next shadow ray
+// tries it before searching the whole scene, since neighbouring points are mostly shadowed by the same sphere
+static thread_local std::vector<int> lastOccluder;
+
+// true if any sphere (but the light itself) is on the ray toward light number l of the scene
+static bool occluded(const Scene &scene, const int l, const Vec3f &rayOrig, const Vec3f &rayDir){
+    PROFILE_TIMER("shadow rays");
+    raysTraced++;
+    const std::vector<Sphere> &spheres = scene.spheres;
+    const Light &light = scene.lights[l];
+    if (lastOccluder.size() < scene.lights.size()) lastOccluder.resize(scene.lights.size(), -1);
+    int &cached = lastOccluder[l];
+    // the cache may come from another scene, so it is only a candidate that is checked like any other sphere
+    if (cached >= 0 && cached < (int)spheres.size() && cached != light.sphere){
+        float t0, t1;
+        PROFILE_COUNT("sphere tests", 1);
+        if (spheres[cached].intersect(rayOrig, rayDir, t0, t1)){
+            PROFILE_COUNT("shadow cache hits", 1);
+            return true;
+        }
+    }
+
+    // any sphere in the way blocks the light, so the search stops at the first one found
+    int occluder = -1;
+    if (!scene.bvh.empty()) occluder = scene.bvh.any_hit(spheres, rayOrig, rayDir, light.sphere);
+    else for (unsigned j = 0; j < spheres.size(); j++){
+        float t0, t1;
+        PROFILE_COUNT("sphere tests", 1);
+        if (int(j) != light.sphere && spheres[j].intersect(rayOrig, rayDir, t0, t1)){
+            occluder = j;
+            break;
+        }
+    }
+    if (occluder < 0){
+        // triangles only block the light when they are in front of it
+        const float distance = (light.center - rayOrig).dot(rayDir);
+        for (const TriangleMesh &mesh : scene.meshes)
+            if (mesh.any_hit(rayOrig, rayDir, distance)) return true;
+        return false;
+    }
+    cached = occluder;
+    return true;
+}
+
+// light received from the light sources by a diffuse surface
+static Vec3f direct_light(const Scene &scene, const SurfaceHit &surface){
+    const Vec3f &pInt = surface.point, &nInt = surface.normal;
+    Vec3f surfaceColor = 0;
+    for (int l = 0; l < (int)scene.lights.size(); l++){
+        // loop through light sources, cast shadow rays and check for objects in the way
+        const Light &light = scene.lights[l];
+        Vec3f transmission = 1;
+        Vec3f lightDir = light.center - pInt;
+        lightDir.normalize();
+        if (rayLog) rayLog->shadow(l, surface.object, pInt + nInt * RAY_BIAS, lightDir);
+        if (occluded(scene, l, pInt + nInt * RAY_BIAS, lightDir)) transmission = 0; // light is blocked
+        surfaceColor += surface.surfaceColor * transmission *
+        std::max(float(0), nInt.dot(lightDir)) * light.emission;
+    }
+    return surfaceColor;
+}
+
+Vec3f shade(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, const int hit, const float tnear, const int depth){
+    PROFILE_COUNT_AT("rays at depth", depth, MAX_RAY_DEPTH + 1, 1);
+    if (hit < 0){
+        if (rayLog) rayLog->closest(depth, rayParent, rayOrig, rayDir, -1, INFINITY);
+        return Vec3f(2); // no intersections --> background color
+    }
+    const SurfaceHit surface = surface_hit(rayOrig, rayDir, scene, hit, tnear);
+    if (rayLog) rayLog->closest(depth, rayParent, rayOrig, rayDir, surface.object, tnear);
+
+    Vec3f surfaceColor = 0; // color of the object
+    if (spawns_rays(surface, depth)){
+        float fresnelEffect = fresnel(rayDir, surface);
+        rayParent = surface.object;
+        Vec3f reflexion = trace(surface.point + surface.normal * RAY_BIAS, reflected(rayDir, surface), scene, depth + 1);
+        Vec3f refraction = 0;
+
+        // compute refraction ray
+        if (surface.transparency){
+            rayParent = surface.object;
+            refraction = trace(surface.point - surface.normal * RAY_BIAS, refracted(rayDir, surface), scene, depth + 1);
+        }
+
+        // final result
+        surfaceColor = (reflexion * fresnelEffect + refraction *
+            (1 - fresnelEffect) * surface.transparency) * surface.surfaceColor;
+    } else {
+        // it's a diffuse object
+        surfaceColor = direct_light(scene, surface);
+    }
+
+    return surfaceColor + surface.emissionColor;
+}
+
+// a ray waiting to be traced, with the share of its light that reaches the pixel
+struct WeightedRay {
+    Vec3f orig, dir, weight;
+    int depth;
+    int from = -1; // the object it leaves from, -1 for the eye
+};
+
+static float max_component(const Vec3f &v){
+    return std::max(v.x, std::max(v.y, v.z));
+}
+
+// shades the hit of a weighted ray: its own light is added to color, and the secondary rays it spawns
+// are passed to 'spawn' unless their weight is below minWeight
+template<typename Spawn>
+static void shade_weighted(const WeightedRay &ray, const Scene &scene, const int hit, const float tnear,
+                           const float minWeight, Vec3f &color, Spawn spawn){
+    PROFILE_COUNT_AT("rays at depth", ray.depth, MAX_RAY_DEPTH + 1, 1);
+    if (hit < 0){
+        if (rayLog) rayLog->closest(ray.depth, ray.from, ray.orig, ray.dir, -1, INFINITY);
+        color += ray.weight * Vec3f(2); // background color
+        return;
+    }
+    const SurfaceHit surface = surface_hit(ray.orig, ray.dir, scene, hit, tnear);
+    if (rayLog) rayLog->closest(ray.depth, ray.from, ray.orig, ray.dir, surface.object, tnear);
+    if (!spawns_rays(surface, ray.depth)){
+        color += ray.weight * (direct_light(scene, surface) + surface.emissionColor);
+        return;
+    }
+    color += ray.weight * surface.emissionColor;
+
+    float fresnelEffect = fresnel(ray.dir, surface);
+    Vec3f reflWeight = ray.weight * surface.surfaceColor * fresnelEffect;
+    if (max_component(reflWeight) > 0 && max_component(reflWeight) >= minWeight)
+        spawn(WeightedRay{surface.point + surface.normal * RAY_BIAS, reflected(ray.dir, surface), reflWeight, ray.depth + 1, surface.object});
+    if (surface.transparency){
+        Vec3f refrWeight = ray.weight * surface.surfaceColor * ((1 - fresnelEffect) * surface.transparency);
+        if (max_component(refrWeight) > 0 && max_component(refrWeight) >= minWeight)
+            spawn(WeightedRay{surface.point - surface.normal * RAY_BIAS, refracted(ray.dir, surface), refrWeight, ray.depth + 1, surface.object});
+    }
+}
+
+// iterative trace() for a primary ray whose closest hit is already known
+static Vec3f trace_stack(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, int hit, float tnear, const float minWeight){
+    // every ray spawns at most two others and one of them is traced right away, so the stack never holds
+    // more than one waiting ray per level of depth
+    WeightedRay stack[MAX_RAY_DEPTH + 2];
+    int top = 0;
+    Vec3f color = 0;
+    auto spawn = [&](const WeightedRay &ray){ stack[top++] = ray; };
+    shade_weighted(WeightedRay{rayOrig, rayDir, Vec3f(1), 0}, scene, hit, tnear, minWeight, color, spawn);
+    while (top){
+        const WeightedRay ray = stack[--top];
+        {
+            PROFILE_TIMER("secondary rays");
+            hit = closest_hit(scene, ray.orig, ray.dir, tnear);
+        }
+        raysTraced++;
+        shade_weighted(ray, scene, hit, tnear, minWeight, color, spawn);
+    }
+    return color;
+}
+
+Vec3f trace_iterative(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, const float minWeight){
+    float tnear;
+    int hit = closest_hit(scene, rayOrig, rayDir, tnear);
+    return trace_stack(rayOrig, rayDir, scene, hit, tnear, minWeight);
+}
+
+// rays of one stage of the wavefront evaluation, with the pixel each one adds its light to
+struct Wavefront {
+    std::vector<WeightedRay> rays;
+    std::vector<int> pixels;
+    std::vector<int> hits;
+    std::vector<float> tnears;
+
+    void clear(){
+        rays.clear(), pixels.clear(), hits.clear(), tnears.clear();
+    }
+};
+
+// wavefront evaluation: each depth is one stage, where all the rays of the stage are intersected, then all their
+// hits are shaded, spawning the rays of the next stage; the first stage comes with its hits already found
+static void trace_wavefront(Wavefront stages[2], const Scene &scene, const float minWeight, Vec3f *colors){
+    for (int stage = 0; !stages[stage & 1].rays.empty(); stage++){
+        Wavefront &current = stages[stage & 1], &next = stages[(stage + 1) & 1];
+        const int n = current.rays.size();
+        if (stage > 0){
+            PROFILE_TIMER("secondary rays");
+            raysTraced += n;
+            current.hits.resize(n), current.tnears.resize(n);
+            for (int r = 0; r < n; r++)
+                current.hits[r] = closest_hit(scene, current.rays[r].orig, current.rays[r].dir, current.tnears[r]);
+        }
+        next.clear();
+        for (int r = 0; r < n; r++){
+            auto spawn = [&](const WeightedRay &ray){ next.rays.push_back(ray), next.pixels.push_back(current.pixels[r]); };
+            shade_weighted(current.rays[r], scene, current.hits[r], current.tnears[r], minWeight, colors[current.pixels[r]], spawn);
+        }
+    }
+}
+
+// maps the points of the image to the directions of primary rays
+struct Camera {
+    unsigned width, height;
+    float aspectRatio, angle;
+
+    Camera(const RenderSettings &settings) : width(settings.width), height(settings.height),
+        aspectRatio(settings.width / float(settings.height)), angle(tan(M_PI / 2 * settings.fov / 180.)) {}
+
+    // direction of the ray through the point (x + dx, y + dy) of the image, with the pixel centers at dx = dy = 0.5
+    Vec3f direction(const unsigned x, const unsigned y, const float dx, const float dy) const {
+        // normalize coordinates
+        float xx = (2 * ((x + double(dx)) / float(width)) - 1) * angle * aspectRatio;
+        float yy = (1 - 2 * ((y + double(dy)) / float(height))) * angle;
+
+        // define direction
+        Vec3f rayDir(xx, yy, -1);
+        rayDir.normalize();
+        return rayDir;
+    }
+};
+
+// a primary ray to trace through the point (x + dx, y + dy) of the image, its color goes to slot 'slot' of the output
+// its closest hit may be known already, else it is found when the sample is traced
+struct PixelSample {
+    unsigned x, y;
+    float dx, dy;
+    int slot;
+    int hit = UNKNOWN_HIT;
+    float tnear = 0;
+};
+
+// traces the samples from the eye in the selected mode; consecutive samples are traced as one packet
+// of coherent primary rays, and in wavefront mode they all go through the stages together
+// the samples get their closest hits, which are only searched for when one of the packet does not know its own
+static void trace_samples(const Scene &scene, const RenderSettings &settings, const Camera &camera,
+                          std::vector<PixelSample> &samples, Vec3f *out, const bool packets, Wavefront stages[2]){
+    stages[0].clear();
+    for (size_t first = 0; first < samples.size(); first += PACKET_SIZE){
+        RayPacket packet;
+        bool known = true;
+        for (size_t i = first; i < std::min(first + PACKET_SIZE, samples.size()); i++){
+            const PixelSample &sample = samples[i];
+            Vec3f rayDir = camera.direction(sample.x, sample.y, sample.dx, sample.dy);
+            packet.x[packet.n] = rayDir.x, packet.y[packet.n] = rayDir.y, packet.z[packet.n] = rayDir.z;
+            packet.n++;
+            known &= sample.hit != UNKNOWN_HIT;
+        }
+
+        // find the closest hits
+        int hit[PACKET_SIZE];
+        float tnear[PACKET_SIZE];
+        if (known){
+            for (int i = 0; i < packet.n; i++) hit[i] = samples[first + i].hit, tnear[i] = samples[first + i].tnear;
+        }
+        else {
+            {
+                PROFILE_TIMER("primary rays");
+                if (packets) packet_closest_hit(scene, settings.eye, packet, hit, tnear);
+                else for (int i = 0; i < packet.n; i++)
+                    hit[i] = closest_hit(scene, settings.eye, Vec3f(packet.x[i], packet.y[i], packet.z[i]), tnear[i]);
+            }
+            raysTraced += packet.n;
+            for (int i = 0; i < packet.n; i++) samples[first + i].hit = hit[i], samples[first + i].tnear = tnear[i];
+        }
+
+        // and shade them
+        for (int i = 0; i < packet.n; i++){
+            Vec3f rayDir(packet.x[i], packet.y[i], packet.z[i]);
+            const int slot = samples[first + i].slot;
+            switch (settings.mode){
+                case TraceMode::RECURSIVE:
+                    rayParent = -1;
+                    out[slot] = shade(settings.eye, rayDir, scene, hit[i], tnear[i], 0);
+                    break;
+                case TraceMode::ITERATIVE:
+                    out[slot] = trace_stack(settings.eye, rayDir, scene, hit[i], tnear[i], settings.minWeight);
+                    break;
+                case TraceMode::WAVEFRONT:
+                    stages[0].rays.push_back(WeightedRay{settings.eye, rayDir, Vec3f(1), 0});
+                    stages[0].pixels.push_back(slot);
+                    stages[0].hits.push_back(hit[i]);
+                    stages[0].tnears.push_back(tnear[i]);
+                    out[slot] = 0;
+                    break;
+            }
+        }
+    }
+    if (settings.mode == TraceMode::WAVEFRONT) trace_wavefront(stages, scene, settings.minWeight, out);
+}
+
+long long render(const Scene &scene, const RenderSettings &settings, Vec3f *image){
+    unsigned width = settings.width, height = settings.height;
+    int nthreads = settings.nthreads;
+    const Camera camera(settings);
+
+    // every pixel is traced independently of the others, so the tiles can be rendered in any order
+    // and by any thread with the same result; tiles behind reflective and refractive spheres cost
+    // much more than the others, so they are handed out by a work-stealing scheduler
+    unsigned tilesX = (width + TILE_SIZE - 1) / TILE_SIZE, tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    WorkStealingScheduler scheduler(tilesX * tilesY, nthreads);
+    const bool packets = packet_tracing_enabled(scene);
+
+    long long rays = 0;
+    #pragma omp parallel num_threads(nthreads) reduction(+:rays)
+    {
+        const long long tracedBefore = raysTraced;
+        int thread = omp_get_thread_num();
+        Wavefront stages[2];
+        std::vector<PixelSample> samples;
+        for (int tile = scheduler.next(thread); tile >= 0; tile = scheduler.next(thread)){
+            PROFILE_STAGE("render tile");
+            unsigned x0 = tile % tilesX * TILE_SIZE, y0 = tile / tilesX * TILE_SIZE;
+
+            // perspective projection through the pixel centers, each row of the tile is one packet
+            samples.clear();
+            for (unsigned y = y0; y < std::min(y0 + TILE_SIZE, height); y++)
+                for (unsigned x = x0; x < std::min(x0 + TILE_SIZE, width); x++)
+                    samples.push_back(PixelSample{x, y, 0.5f, 0.5f, int(y * width + x)});
+            trace_samples(scene, settings, camera, samples, image, packets, stages);
+        }
+        rays += raysTraced - tracedBefore;
+    }
+    return rays;
+}
+
+IncrementalStats render_incremental(const Scene &scene, const RenderSettings &settings, FrameState &frame, Vec3f *image){
+    const unsigned width = settings.width, height = settings.height;
+    const int nthreads = settings.nthreads;
+    const Camera camera(settings);
+    const unsigned tilesX = (width + TILE_SIZE - 1) / TILE_SIZE, tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    const int ntiles = tilesX * tilesY;
+    const SceneEdit edit = diff_scene(frame, scene, settings);
+    IncrementalStats stats;
+    stats.tiles = ntiles;
+    stats.full = edit.full;
+    if (edit.full){
+        frame.cones.assign(ntiles, {});
+        frame.tileObjects.assign(ntiles, {});
+        frame.primaryHits.assign(width * height, UNKNOWN_HIT);
+        frame.primaryT.assign(width * height, 0);
+    }
+
+    // the hits of the frame numbered as in the scene, UNKNOWN_HIT for the ones on objects that moved or are gone
+    auto remap_hit = [&](const int hit){
+        if (hit < 0) return hit;
+        if (hit < frame.nspheres) return edit.remap[hit] >= 0 ? edit.remap[hit] : UNKNOWN_HIT;
+        const int m = std::upper_bound(frame.meshFirstHit.begin(), frame.meshFirstHit.end(), hit) - frame.meshFirstHit.begin() - 1;
+        const int object = edit.remap[frame.nspheres + m];
+        return object >= 0 ? scene.meshFirstHit[object - scene.spheres.size()] + hit - frame.meshFirstHit[m] : UNKNOWN_HIT;
+    };
+    auto tile_pixels = [&](const int tile, const auto &visit){
+        const unsigned x0 = tile % tilesX * TILE_SIZE, y0 = tile / tilesX * TILE_SIZE;
+        for (unsigned y = y0; y < std::min(y0 + TILE_SIZE, height); y++)
+            for (unsigned x = x0; x < std::min(x0 + TILE_SIZE, width); x++)
+                visit(x, y, y * width + x);
+    };
+
+    // a tile is traced again when one of its rays may reach the old or new place of an object that moved, or
+    // hits an object whose material changed: the other tiles would get exactly the rays they had
+    std::vector<char> dirty(ntiles, edit.full);
+    if (!edit.full){
+        PROFILE_STAGE("dirty tiles");
+        bool renumbered = frame.meshFirstHit != scene.meshFirstHit;
+        for (size_t i = 0; i < edit.remap.size() && !renumbered; i++) renumbered = edit.remap[i] != (int)i;
+
+        #pragma omp parallel for schedule(dynamic, 16) num_threads(nthreads)
+        for (int t = 0; t < ntiles; t++){
+            for (const int object : frame.tileObjects[t]) dirty[t] |= edit.reshaded[object];
+            for (size_t c = 0; c < frame.cones[t].size() && !dirty[t]; c++)
+                for (size_t k = 0; k < edit.centers.size() && !dirty[t]; k++)
+                    dirty[t] = frame.cones[t][c].reaches(edit.centers[k], edit.radii[k]);
+            if (dirty[t] || !renumbered) continue;
+            // what the clean tiles keep is renumbered like the scene
+            for (int &object : frame.tileObjects[t]) object = edit.remap[object];
+            tile_pixels(t, [&](unsigned, unsigned, const int p){ frame.primaryHits[p] = remap_hit(frame.primaryHits[p]); });
+        }
+    }
+    std::vector<int> tiles;
+    for (int t = 0; t < ntiles; t++) if (dirty[t]) tiles.push_back(t);
+    stats.dirtyTiles = tiles.size();
+
+    WorkStealingScheduler scheduler(tiles.size(), nthreads);
+    const bool packets = packet_tracing_enabled(scene);
+    long long pixels = 0, reused = 0, rays = 0;
+    #pragma omp parallel num_threads(nthreads) reduction(+:pixels, reused, rays)
+    {
+        const long long tracedBefore = raysTraced;
+        int thread = omp_get_thread_num();
+        Wavefront stages[2];
+        std::vector<PixelSample> samples;
+        RayLog log;
+        rayLog = &log;
+        for (int k = scheduler.next(thread); k >= 0; k = scheduler.next(thread)){
+            PROFILE_STAGE("render tile");
+            const int tile = tiles[k];
+            // a pixel keeps its primary hit when its primary ray does not reach what moved, so only its shading
+            // is traced again
+            samples.clear();
+            tile_pixels(tile, [&](const unsigned x, const unsigned y, const int p){
+                PixelSample sample{x, y, 0.5f, 0.5f, p};
+                const int hit = edit.full ? UNKNOWN_HIT : remap_hit(frame.primaryHits[p]);
+                if (hit != UNKNOWN_HIT){
+                    RayCone ray;
+                    ray.origin = settings.eye, ray.axis = camera.direction(x, y, 0.5f, 0.5f);
+                    ray.tmax = hit < 0 ? INFINITY : frame.primaryT[p];
+                    bool reaches = false;
+                    for (size_t c = 0; c < edit.centers.size() && !reaches; c++) reaches = ray.reaches(edit.centers[c], edit.radii[c]);
+                    if (!reaches) sample.hit = hit, sample.tnear = frame.primaryT[p], reused++;
+                }
+                samples.push_back(sample);
+            });
+            log.clear();
+            trace_samples(scene, settings, camera, samples, image, packets, stages);
+            log.finish(frame.cones[tile], frame.tileObjects[tile]);
+            for (const PixelSample &sample : samples) frame.primaryHits[sample.slot] = sample.hit, frame.primaryT[sample.slot] = sample.tnear;
+            pixels += samples.size();
+        }
+        rayLog = nullptr;
+        rays += raysTraced - tracedBefore;
+    }
+    stats.pixels = pixels;
+    stats.reusedHits = reused;
+    stats.rays = rays;
+    record_scene(frame, scene, settings);
+    return stats;
+}
+
+// sub-pixel position of the k-th sample of pixel (x, y): a low discrepancy sequence (R2), shifted by a hash
+// of the pixel so neighbouring pixels do not sample the same positions; it only depends on the pixel and k,
+// so the image does not depend on the number of threads
+static void sample_position(const unsigned x, const unsigned y, const int k, float &dx, float &dy){
+    std::uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u;
+    h ^= h >> 15, h *= 0x2c1b3c6du, h ^= h >> 12, h *= 0x297a2d39u, h ^= h >> 15;
+    const double shiftX = (h & 0xffff) / 65536., shiftY = (h >> 16) / 65536.;
+    double px = 0.5 + shiftX + k * 0.7548776662466927, py = 0.5 + shiftY + k * 0.5698402909980532;
+    dx = px - std::floor(px), dy = py - std::floor(py);
+}
+
+static float luminance(const Vec3f &c){
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
+ProgressiveStats render_progressive(const Scene &scene, const RenderSettings &settings, const ProgressiveSettings &progressive,
+                                    Vec3f *image, const std::function<void(int pass, const Vec3f *image)> &preview){
+    const unsigned width = settings.width, height = settings.height;
+    const int nthreads = settings.nthreads;
+    const Camera camera(settings);
+    // the first pass needs two samples to estimate the variance, unless the pixels get fewer than that in all
+    const int maxSamples = std::max(1, progressive.maxSamples);
+    const int minSamples = std::min(std::max(2, progressive.minSamples), maxSamples);
+    const int perPass = std::max(1, progressive.samplesPerPass);
+
+    // accumulation buffers: the sum of the samples of every pixel, and the moments of their luminance
+    std::vector<Vec3f> sum(width * height);
+    std::vector<float> lumSum(width * height), lumSquares(width * height);
+    std::vector<int> count(width * height);
+    std::vector<char> active(width * height, 1);
+
+    unsigned tilesX = (width + TILE_SIZE - 1) / TILE_SIZE, tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    const bool packets = packet_tracing_enabled(scene);
+    ProgressiveStats stats;
+    long long remaining = width * height;
+    while (remaining){
+        PROFILE_STAGE("progressive pass");
+        WorkStealingScheduler scheduler(tilesX * tilesY, nthreads);
+        long long traced = 0, converged = 0, rays = 0;
+
+        #pragma omp parallel num_threads(nthreads) reduction(+:traced, converged, rays)
+        {
+            const long long tracedBefore = raysTraced;
+            int thread = omp_get_thread_num();
+            Wavefront stages[2];
+            std::vector<PixelSample> samples;
+            std::vector<Vec3f> colors;
+            for (int tile = scheduler.next(thread); tile >= 0; tile = scheduler.next(thread)){
+                unsigned x0 = tile % tilesX * TILE_SIZE, y0 = tile / tilesX * TILE_SIZE;
+                unsigned x1 = std::min(x0 + TILE_SIZE, width), y1 = std::min(y0 + TILE_SIZE, height);
+
+                // the pixels that have not converged yet get a few more samples, until the first pass they all get minSamples
+                samples.clear();
+                for (unsigned y = y0; y < y1; y++){
+                    for (unsigned x = x0; x < x1; x++){
+                        const int p = y * width + x;
+                        if (!active[p]) continue;
+                        const int n = std::min(count[p] ? perPass : std::max(perPass, minSamples), maxSamples - count[p]);
+                        for (int k = count[p]; k < count[p] + n; k++){
+                            PixelSample sample{x, y, 0, 0, int(samples.size())};
+                            sample_position(x, y, k, sample.dx, sample.dy);
+                            samples.push_back(sample);
+                        }
+                    }
+                }
+                if (samples.empty()) continue;
+                colors.resize(samples.size());
+                trace_samples(scene, settings, camera, samples, colors.data(), packets, stages);
+                traced += samples.size();
+
+                // what is accumulated is the displayed color, clamped like when the image is saved
+                for (size_t i = 0; i < samples.size(); i++){
+                    const int p = samples[i].y * width + samples[i].x;
+                    Vec3f c(std::min(1.f, colors[i].x), std::min(1.f, colors[i].y), std::min(1.f, colors[i].z));
+                    float l = luminance(c);
+                    sum[p] += c;
+                    lumSum[p] += l;
+                    lumSquares[p] += l * l;
+                    count[p]++;
+                }
+
+                // a pixel has converged once the standard error of its mean luminance is within the tolerance,
+                // which happens right after the first pass for flat regions
+                for (unsigned y = y0; y < y1; y++){
+                    for (unsigned x = x0; x < x1; x++){
+                        const int p = y * width + x;
+                        if (!active[p]) continue;
+                        const float n = count[p], mean = lumSum[p] / n;
+                        const float variance = std::max(0.f, (lumSquares[p] - n * mean * mean) / (n - 1));
+                        image[p] = sum[p] * (1 / n);
+                        if (count[p] >= maxSamples || variance / n <= progressive.tolerance * progressive.tolerance){
+                            active[p] = 0;
+                            converged++;
+                        }
+                    }
+                }
+            }
+            rays += raysTraced - tracedBefore;
+        }
+
+        stats.passes++;
+        stats.samples += traced;
+        stats.rays += rays;
+        remaining -= converged;
+        if (preview) preview(stats.passes, image);
+    }
+    return stats;
+}
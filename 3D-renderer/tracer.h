@@ -0,0 +1,80 @@
+#pragma once
+#include <functional>
+
+#include "geometry.h"
+#include "scene.h"
+
+#define MAX_RAY_DEPTH 5 // max recursion depth allowed
+
+// how the secondary rays spawned by reflective and transparent spheres are evaluated
+enum class TraceMode {
+    RECURSIVE, // trace() calls itself for every secondary ray, the reference
+    ITERATIVE, // depth first, with an explicit stack of rays weighted by their share of the pixel color
+    WAVEFRONT  // breadth first, all the rays of a tile at the same depth are intersected and shaded together
+};
+
+struct RenderSettings {
+    unsigned width = 1920, height = 1080;
+    float fov = 30;   // vertical field of view in degrees
+    Vec3f eye = 0;    // position of the camera, which looks down -z
+    int nthreads = 1;
+    TraceMode mode = TraceMode::RECURSIVE;
+    float minWeight = 0; // iterative and wavefront modes drop the secondary rays weighing less than this in every channel
+};
+
+// checks if a given ray intersects any objects in the scene and shades the intersection points accordingly
+Vec3f trace(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, const int &depth);
+
+// same as trace() from depth 0, evaluated with an explicit stack instead of recursion; secondary rays
+// whose weight (their share of the final color) falls below minWeight are not traced
+Vec3f trace_iterative(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, const float minWeight = 0);
+
+// the closest sphere or triangle hit by the ray (numbered as in Scene) and its distance in tnear, or -1 if it hits nothing
+int closest_hit(const Scene &scene, const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear);
+
+// the part of closest_hit() after the spheres: a triangle of the meshes strictly closer than tnear replaces hit
+void closest_mesh_hit(const Scene &scene, const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear, int &hit);
+
+// color seen along a ray that hits sphere or triangle 'hit' (or the background when hit < 0) at distance tnear
+Vec3f shade(const Vec3f &rayOrig, const Vec3f &rayDir, const Scene &scene, const int hit, const float tnear, const int depth);
+
+// traces one primary ray per pixel from the eye, looking down -z, into image (width * height pixels, row by row)
+// returns the number of rays traced: primary, secondary and shadow rays
+long long render(const Scene &scene, const RenderSettings &settings, Vec3f *image);
+
+struct FrameState; // see framestate.h
+
+struct IncrementalStats {
+    int tiles = 0, dirtyTiles = 0; // the tiles of the image, and the ones traced again
+    bool full = false;             // all of them were, the frame could not be reused
+    long long pixels = 0;          // pixels traced
+    long long reusedHits = 0;      // ... of which the primary hit was known from the frame, only their shading was traced
+    long long rays = 0;            // rays traced, as counted by render()
+};
+
+// render() that re-renders only what changed since the frame, which image must hold: the tiles whose rays (primary,
+// secondary or shadow rays) may reach an object that moved, appeared or disappeared (in its old or new place), or
+// that hit an object whose material changed; the frame is then updated to the scene
+// everything is rendered when the frame is empty, or the camera, the size of the image or the lights changed
+// the image is the one render() gives, whatever was re-rendered
+IncrementalStats render_incremental(const Scene &scene, const RenderSettings &settings, FrameState &frame, Vec3f *image);
+
+struct ProgressiveSettings {
+    int minSamples = 4;            // samples every pixel gets in the first pass, at most maxSamples
+    int maxSamples = 64;           // most samples a pixel gets
+    int samplesPerPass = 4;        // samples added to the pixels that have not converged at every following pass
+    float tolerance = 1.f / 255;   // a pixel has converged when the standard error of its mean luminance is below this
+};
+
+struct ProgressiveStats {
+    int passes = 0;
+    long long samples = 0; // primary rays traced
+    long long rays = 0;    // all the rays traced: primary, secondary and shadow rays
+};
+
+// renders in passes, accumulating several samples per pixel spread over its area (anti-aliasing); after each pass
+// image holds the average of the samples so far, clamped to [0, 1], and is handed to 'preview' if there is one
+// samples are spent where the pixels vary (silhouettes, reflections and refractions): once a pixel has converged
+// it gets no more, and rendering stops when all have
+ProgressiveStats render_progressive(const Scene &scene, const RenderSettings &settings, const ProgressiveSettings &progressive,
+                                    Vec3f *image, const std::function<void(int pass, const Vec3f *image)> &preview = nullptr);
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "trimesh.h"
+#include "../2D-renderer/objloader.h"
+#include "../2D-renderer/profiler.h"
+
+// lattice coordinates have this many bits per axis, and the offsets of the vertices of a block 16
+constexpr int LATTICE_BITS = 21;
+constexpr std::uint32_t LATTICE_MAX = (1u << LATTICE_BITS) - 1;
+// largest extent of a triangle in lattice steps, a little below 2^16 so that rounding to the lattice keeps it in range
+constexpr float TRIANGLE_STEPS = 65000;
+
+static std::uint64_t pack_base(const std::uint32_t q[3]){
+    return q[0] | (std::uint64_t)q[1] << LATTICE_BITS | (std::uint64_t)q[2] << (2 * LATTICE_BITS);
+}
+
+static std::uint32_t base_coord(const std::uint64_t base, const int k){
+    return base >> (k * LATTICE_BITS) & LATTICE_MAX;
+}
+
+// a ray prepared for the watertight ray-triangle test (Woop, Benthin and Wald 2013): the triangles are moved
+// to the origin of the ray and sheared so that the ray runs along +z, and the edge functions of the projected
+// triangles are evaluated from the same values in every triangle sharing an edge, so no ray slips between them
+struct ShearedRay {
+    int kx, ky, kz;
+    float sx, sy, sz;
+    float orig[3];
+
+    ShearedRay(const Vec3f &o, const Vec3f &d){
+        const float dir[3] = {d.x, d.y, d.z};
+        orig[0] = o.x, orig[1] = o.y, orig[2] = o.z;
+        kz = std::fabs(dir[0]) > std::fabs(dir[1]) ? (std::fabs(dir[0]) > std::fabs(dir[2]) ? 0 : 2)
+                                                   : (std::fabs(dir[1]) > std::fabs(dir[2]) ? 1 : 2);
+        kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+        // keeps the winding of the triangles
+        if (dir[kz] < 0) std::swap(kx, ky);
+        sx = dir[kx] / dir[kz], sy = dir[ky] / dir[kz], sz = 1.f / dir[kz];
+    }
+
+    // distance to the triangle if the ray hits it after 0 and strictly before tmax, else INFINITY
+    float intersect(const float a[3], const float b[3], const float c[3], const float tmax) const {
+        const float A[3] = {a[0] - orig[0], a[1] - orig[1], a[2] - orig[2]};
+        const float B[3] = {b[0] - orig[0], b[1] - orig[1], b[2] - orig[2]};
+        const float C[3] = {c[0] - orig[0], c[1] - orig[1], c[2] - orig[2]};
+        const float ax = A[kx] - sx * A[kz], ay = A[ky] - sy * A[kz];
+        const float bx = B[kx] - sx * B[kz], by = B[ky] - sy * B[kz];
+        const float cx = C[kx] - sx * C[kz], cy = C[ky] - sy * C[kz];
+        float u = cx * by - cy * bx, v = ax * cy - ay * cx, w = bx * ay - by * ax;
+        // an edge function of exactly 0 may only be a rounding artifact, it is computed again in double
+        if (u == 0 || v == 0 || w == 0){
+            u = float(double(cx) * by - double(cy) * bx);
+            v = float(double(ax) * cy - double(ay) * cx);
+            w = float(double(bx) * ay - double(by) * ax);
+        }
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return INFINITY;
+        const float det = u + v + w;
+        if (det == 0) return INFINITY;
+        const float az = sz * A[kz], bz = sz * B[kz], cz = sz * C[kz];
+        const float t = (u * az + v * bz + w * cz) / det;
+        return t > 0 && t < tmax ? t : INFINITY;
+    }
+};
+
+void TriangleMesh::build(const std::vector<Vec3f> &vertices, const std::vector<int> &indices){
+    PROFILE_STAGE("mesh build");
+    nodes.clear();
+    blocks.clear();
+    count = indices.size() / 3;
+    if (!count) return;
+
+    // the lattice: as fine as 21 bits allow, but coarse enough for the largest triangle to fit in 16 bits
+    AABB bounds;
+    float largest[3] = {0, 0, 0};
+    for (int t = 0; t < count; t++){
+        AABB box;
+        for (int c = 0; c < 3; c++){
+            const Vec3f &p = vertices[indices[3 * t + c]];
+            const float q[3] = {p.x, p.y, p.z};
+            box.grow(q);
+        }
+        bounds.grow(box);
+        for (int k = 0; k < 3; k++) largest[k] = std::max(largest[k], box.bmax[k] - box.bmin[k]);
+    }
+    for (int k = 0; k < 3; k++){
+        origin[k] = bounds.bmin[k];
+        step[k] = std::max((bounds.bmax[k] - bounds.bmin[k]) / LATTICE_MAX, largest[k] / TRIANGLE_STEPS);
+        if (!(step[k] > 0)) step[k] = 1; // flat along this axis
+    }
+    std::vector<std::uint32_t> lattice(vertices.size() * 3);
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < vertices.size(); i++){
+        const float p[3] = {vertices[i].x, vertices[i].y, vertices[i].z};
+        for (int k = 0; k < 3; k++)
+            lattice[3 * i + k] = std::min<float>(LATTICE_MAX, std::max(0.f, std::round((p[k] - origin[k]) / step[k])));
+    }
+
+    // the tree is built over the triangles as they will be intersected, on the lattice
+    std::vector<AABB> boxes(count);
+    #pragma omp parallel for schedule(static)
+    for (int t = 0; t < count; t++)
+        for (int c = 0; c < 3; c++){
+            const std::uint32_t *q = &lattice[3 * indices[3 * t + c]];
+            const float p[3] = {origin[0] + q[0] * step[0], origin[1] + q[1] * step[1], origin[2] + q[2] * step[2]};
+            boxes[t].grow(p);
+        }
+    // leaves of up to two blocks: a block costs one cache line whatever it holds, and fewer leaves need fewer nodes
+    BVH bvh;
+    bvh.build(boxes, 6);
+    boxes = std::vector<AABB>();
+    nodes = std::move(bvh.nodes);
+
+    // the triangles of every leaf are packed in blocks, a block is closed when its next triangle would be
+    // too far from the others for 16-bit offsets
+    blocks.reserve(count / 2);
+    for (BVHNode &node : nodes){
+        if (!node.count) continue;
+        const int firstBlock = blocks.size();
+        std::uint32_t lo[3], hi[3];
+        int tris[3], n = 0;
+        auto flush = [&](){
+            TriangleBlock block;
+            block.base = pack_base(lo);
+            block.count = n;
+            for (int s = 0; s < n; s++)
+                for (int c = 0; c < 3; c++)
+                    for (int k = 0; k < 3; k++)
+                        block.v[s][c][k] = lattice[3 * indices[3 * tris[s] + c] + k] - lo[k];
+            blocks.push_back(block);
+            n = 0;
+        };
+        for (int i = node.offset; i < node.offset + node.count; i++){
+            const int t = bvh.prims[i];
+            std::uint32_t tlo[3] = {LATTICE_MAX, LATTICE_MAX, LATTICE_MAX}, thi[3] = {0, 0, 0};
+            for (int c = 0; c < 3; c++)
+                for (int k = 0; k < 3; k++){
+                    const std::uint32_t q = lattice[3 * indices[3 * t + c] + k];
+                    tlo[k] = std::min(tlo[k], q), thi[k] = std::max(thi[k], q);
+                }
+            bool fits = n < 3;
+            for (int k = 0; k < 3 && fits && n; k++)
+                fits = std::max(hi[k], thi[k]) - std::min(lo[k], tlo[k]) <= 0xffff;
+            if (!fits) flush();
+            for (int k = 0; k < 3; k++){
+                lo[k] = n ? std::min(lo[k], tlo[k]) : tlo[k];
+                hi[k] = n ? std::max(hi[k], thi[k]) : thi[k];
+            }
+            tris[n++] = t;
+        }
+        if (n) flush();
+        node.offset = firstBlock;
+        node.count = blocks.size() - firstBlock;
+    }
+    blocks.shrink_to_fit();
+}
+
+// the corners of the triangles of a block, in world space
+struct BlockTriangles {
+    float p[3][3][3]; // [triangle][corner][axis]
+};
+
+static void decode(const TriangleBlock &block, const float origin[3], const float step[3], BlockTriangles &out){
+    const std::uint32_t base[3] = {base_coord(block.base, 0), base_coord(block.base, 1), base_coord(block.base, 2)};
+    for (int s = 0; s < block.count; s++)
+        for (int c = 0; c < 3; c++)
+            for (int k = 0; k < 3; k++)
+                out.p[s][c][k] = origin[k] + float(base[k] + block.v[s][c][k]) * step[k];
+}
+
+int TriangleMesh::closest_hit(const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear) const {
+    if (nodes.empty()) return -1;
+    const SlabRay slab(rayOrig, rayDir);
+    const ShearedRay ray(rayOrig, rayDir);
+    if (slab.enter(nodes[0], tnear) == INFINITY) return -1;
+    int hit = -1;
+    int stack[BVH_STACK_SIZE];
+    int top = 0;
+    int current = 0;
+    long long tests = 0; // for the profile
+    BlockTriangles tri;
+    while (true){
+        const BVHNode &node = nodes[current];
+        if (node.count){
+            for (int b = node.offset; b < node.offset + node.count; b++){
+                const TriangleBlock &block = blocks[b];
+                decode(block, origin, step, tri);
+                tests += block.count;
+                for (int s = 0; s < block.count; s++){
+                    const float t = ray.intersect(tri.p[s][0], tri.p[s][1], tri.p[s][2], tnear);
+                    if (t < tnear) tnear = t, hit = 3 * b + s;
+                }
+            }
+        }
+        else {
+            // the nearer child is visited first, the other one only if it is still in front of the closest hit
+            int first = current + 1, second = node.offset;
+            if (slab.negative[node.axis]) std::swap(first, second);
+            const float t1 = slab.enter(nodes[first], tnear), t2 = slab.enter(nodes[second], tnear);
+            if (t1 != INFINITY){
+                if (t2 != INFINITY) stack[top++] = second;
+                current = first;
+                continue;
+            }
+            if (t2 != INFINITY){
+                current = second;
+                continue;
+            }
+        }
+        // skips the nodes pushed before a closer hit was found behind them
+        while (top && slab.enter(nodes[stack[top - 1]], tnear) == INFINITY) top--;
+        if (!top) break;
+        current = stack[--top];
+    }
+    PROFILE_COUNT("triangle tests", tests);
+    return hit;
+}
+
+bool TriangleMesh::any_hit(const Vec3f &rayOrig, const Vec3f &rayDir, const float tmax) const {
+    if (nodes.empty()) return false;
+    const SlabRay slab(rayOrig, rayDir);
+    const ShearedRay ray(rayOrig, rayDir);
+    int stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    BlockTriangles tri;
+    while (top){
+        const BVHNode &node = nodes[stack[--top]];
+        if (slab.enter(node, tmax) == INFINITY) continue;
+        if (node.count){
+            for (int b = node.offset; b < node.offset + node.count; b++){
+                const TriangleBlock &block = blocks[b];
+                decode(block, origin, step, tri);
+                PROFILE_COUNT("triangle tests", block.count);
+                for (int s = 0; s < block.count; s++)
+                    if (ray.intersect(tri.p[s][0], tri.p[s][1], tri.p[s][2], tmax) != INFINITY) return true;
+            }
+        }
+        else {
+            stack[top++] = node.offset;
+            stack[top++] = &node - nodes.data() + 1;
+        }
+    }
+    return false;
+}
+
+void TriangleMesh::triangle(const int t, Vec3f &a, Vec3f &b, Vec3f &c) const {
+    BlockTriangles tri;
+    decode(blocks[t / 3], origin, step, tri);
+    const float (*p)[3] = tri.p[t % 3];
+    a = Vec3f(p[0][0], p[0][1], p[0][2]);
+    b = Vec3f(p[1][0], p[1][1], p[1][2]);
+    c = Vec3f(p[2][0], p[2][1], p[2][2]);
+}
+
+Vec3f TriangleMesh::normal(const int t) const {
+    Vec3f a, b, c;
+    triangle(t, a, b, c);
+    const Vec3f e1 = b - a, e2 = c - a;
+    Vec3f n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+    return n.normalize();
+}
+
+bool load_obj_mesh(const std::string &filename, const float scale, const Vec3f &offset, TriangleMesh &mesh){
+    Mesh obj;
+    if (!load_obj(filename, obj)) return false;
+    std::vector<Vec3f> vertices(obj.nverts());
+    for (int i = 0; i < obj.nverts(); i++)
+        vertices[i] = Vec3f(obj.x[i], obj.y[i], obj.z[i]) * scale + offset;
+    // the index buffer is all that is kept of the .obj, the rest is freed before building
+    std::vector<int> indices = std::move(obj.indices);
+    obj = Mesh();
+    mesh.build(vertices, indices);
+    mesh.source = filename, mesh.scale = scale, mesh.offset = offset;
+    return true;
+}
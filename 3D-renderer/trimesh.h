@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "geometry.h"
+
+// up to three triangles of a BVH leaf in one cache line: their vertices are points of the lattice of the mesh,
+// stored as 16-bit offsets from a base point of the lattice
+struct alignas(64) TriangleBlock {
+    std::uint64_t base = 0;         // lattice coordinates of the base, 21 bits per axis
+    std::uint16_t v[3][3][3] = {};  // [triangle][corner][axis]
+    std::uint8_t count = 0;         // triangles in use
+};
+static_assert(sizeof(TriangleBlock) == 64, "a block is one cache line");
+
+// triangle mesh in a compact form for tracing, with a material like the one of a sphere
+// vertex positions are snapped to a lattice spanning the bounds of the mesh (up to 2^21 points per axis, fine
+// enough for any triangle to span at most 2^16), so a vertex shared by several triangles decodes to exactly the
+// same point in all of them and the watertight test leaves no cracks along shared edges
+class TriangleMesh {
+public:
+    Vec3f surfaceColor = 1, emissionColor = 0;
+    float transparency = 0, reflection = 0;
+
+    // where the mesh was loaded from, so scenes can be saved
+    std::string source;
+    float scale = 1;
+    Vec3f offset = 0;
+
+    // builds the mesh from a shared-vertex index buffer, three indices per triangle
+    void build(const std::vector<Vec3f> &vertices, const std::vector<int> &indices);
+
+    int ntriangles() const { return count; }
+    // triangles are numbered by their place in the blocks, some numbers below nslots() are unused
+    int nslots() const { return blocks.size() * 3; }
+    size_t memory() const { return blocks.size() * sizeof(TriangleBlock) + nodes.size() * sizeof(BVHNode); }
+    // box around all the triangles, empty for a mesh without any
+    AABB bounds() const {
+        AABB box;
+        if (!nodes.empty()) box.grow(AABB{{nodes[0].bmin[0], nodes[0].bmin[1], nodes[0].bmin[2]},
+                                         {nodes[0].bmax[0], nodes[0].bmax[1], nodes[0].bmax[2]}});
+        return box;
+    }
+
+    // the closest triangle hit by the ray strictly before tnear: tnear becomes its distance and its number is
+    // returned, or -1 if there is none
+    int closest_hit(const Vec3f &rayOrig, const Vec3f &rayDir, float &tnear) const;
+    // true if any triangle is hit by the ray before tmax
+    bool any_hit(const Vec3f &rayOrig, const Vec3f &rayDir, const float tmax) const;
+
+    void triangle(const int t, Vec3f &a, Vec3f &b, Vec3f &c) const;
+    // unit normal of a triangle, counter-clockwise corners facing the viewer
+    Vec3f normal(const int t) const;
+
+private:
+    float origin[3] = {0, 0, 0}, step[3] = {0, 0, 0}; // lattice point q is at origin + q * step
+    int count = 0;
+    std::vector<BVHNode> nodes; // leaves give a range of blocks
+    std::vector<TriangleBlock> blocks;
+};
+
+// loads the triangles of an .obj file (through the loader of the 2D renderer) into mesh,
+// their vertices scaled by 'scale' and moved by 'offset'
+bool load_obj_mesh(const std::string &filename, const float scale, const Vec3f &offset, TriangleMesh &mesh);